@@ -0,0 +1,948 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Each inner node consumes a prefix of bytes shared by everything under
+ * it and then one byte to pick a child. Nodes come in four sizes, with
+ * room for 4, 16, 48 or 256 children, and are replaced with the next
+ * size up or down as children come and go. The first ART_PREFIX bytes
+ * of a prefix are kept in the node, and the rest are read from the key
+ * of an element under it when they are needed.
+ *
+ * Elements are the leaves, and a leaf is put in the place of a subtree
+ * until a second key needs that subtree to tell them apart. An element
+ * whose key ends where a node picks a child is kept in an_end instead.
+ *
+ * Every entry knows its parent and its byte in the parent, so the
+ * neighbours of an element can be found without the head of the tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "art.h"
+
+#define ART_NODE4		1
+#define ART_NODE16		2
+#define ART_NODE48		3
+#define ART_NODE256		4
+
+#define ART_PREFIX		8
+
+struct art_node {
+	struct art_entry	 an_entry;
+	uint32_t		 an_depth;	/* of the first prefix byte */
+	uint32_t		 an_plen;
+	uint16_t		 an_nchildren;
+	uint8_t			 an_prefix[ART_PREFIX];
+	struct art_entry	*an_end;
+};
+
+struct art_node4 {
+	struct art_node		 n4_node;
+	uint8_t			 n4_keys[4];
+	struct art_entry	*n4_children[4];
+};
+
+struct art_node16 {
+	struct art_node		 n16_node;
+	uint8_t			 n16_keys[16];
+	struct art_entry	*n16_children[16];
+};
+
+struct art_node48 {
+	struct art_node		 n48_node;
+	uint8_t			 n48_index[256]; /* child + 1, or 0 */
+	struct art_entry	*n48_children[48];
+};
+
+struct art_node256 {
+	struct art_node		 n256_node;
+	struct art_entry	*n256_children[256];
+};
+
+/* a node is replaced with the next size down at these */
+#define ART_SHRINK16		3
+#define ART_SHRINK48		12
+#define ART_SHRINK256		40
+
+static inline void *
+art_e2n(const struct art_type *t, const struct art_entry *ae)
+{
+	unsigned long addr = (unsigned long)ae;
+
+	return ((void *)(addr - t->t_offset));
+}
+
+static inline struct art_entry *
+art_n2e(const struct art_type *t, const void *node)
+{
+	unsigned long addr = (unsigned long)node;
+
+	return ((struct art_entry *)(addr + t->t_offset));
+}
+
+static inline const uint8_t *
+art_key(const struct art_type *t, const struct art_entry *ae,
+    uint8_t *buf, size_t *len)
+{
+	return ((*t->t_key)(art_e2n(t, ae), buf, len));
+}
+
+static int
+art_keycmp(const uint8_t *a, size_t alen, const uint8_t *b, size_t blen)
+{
+	int rv;
+
+	rv = memcmp(a, b, alen < blen ? alen : blen);
+	if (rv != 0)
+		return (rv);
+
+	return (alen < blen ? -1 : alen > blen);
+}
+
+/* how many of the keys in a node16 are lower than b */
+static inline unsigned int
+art_node16_below(const struct art_node16 *n16, unsigned int b)
+{
+	unsigned int n = n16->n16_node.an_nchildren;
+#ifdef __SSE2__
+	__m128i k, v;
+	unsigned int m;
+
+	if (b > 0xff)
+		return (n);
+
+	/* flip the top bits so a signed compare orders them unsigned */
+	k = _mm_loadu_si128((const __m128i *)n16->n16_keys);
+	k = _mm_xor_si128(k, _mm_set1_epi8((char)0x80));
+	v = _mm_set1_epi8((char)(b ^ 0x80));
+	m = _mm_movemask_epi8(_mm_cmplt_epi8(k, v)) & ((1U << n) - 1);
+
+	return (__builtin_popcount(m));
+#else
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (n16->n16_keys[i] >= b)
+			break;
+	}
+
+	return (i);
+#endif
+}
+
+/* the slot of the child at b, or NULL */
+static struct art_entry **
+art_child(struct art_node *n, uint8_t b)
+{
+	struct art_node4 *n4;
+	struct art_node16 *n16;
+	struct art_node48 *n48;
+	unsigned int i;
+
+	switch (n->an_entry.ae_type) {
+	case ART_NODE4:
+		n4 = (struct art_node4 *)n;
+		for (i = 0; i < n->an_nchildren; i++) {
+			if (n4->n4_keys[i] == b)
+				return (&n4->n4_children[i]);
+		}
+		break;
+	case ART_NODE16:
+		n16 = (struct art_node16 *)n;
+#ifdef __SSE2__
+		i = _mm_movemask_epi8(_mm_cmpeq_epi8(
+		    _mm_loadu_si128((const __m128i *)n16->n16_keys),
+		    _mm_set1_epi8((char)b)));
+		i &= (1U << n->an_nchildren) - 1;
+		if (i != 0)
+			return (&n16->n16_children[__builtin_ctz(i)]);
+#else
+		for (i = 0; i < n->an_nchildren; i++) {
+			if (n16->n16_keys[i] == b)
+				return (&n16->n16_children[i]);
+		}
+#endif
+		break;
+	case ART_NODE48:
+		n48 = (struct art_node48 *)n;
+		i = n48->n48_index[b];
+		if (i != 0)
+			return (&n48->n48_children[i - 1]);
+		break;
+	case ART_NODE256:
+		if (((struct art_node256 *)n)->n256_children[b] != NULL)
+			return (&((struct art_node256 *)n)->n256_children[b]);
+		break;
+	}
+
+	return (NULL);
+}
+
+/* the child with the lowest byte that is b or higher */
+static struct art_entry *
+art_child_ge(const struct art_node *n, unsigned int b)
+{
+	const struct art_node4 *n4;
+	const struct art_node16 *n16;
+	const struct art_node48 *n48;
+	const struct art_node256 *n256;
+	unsigned int i;
+
+	switch (n->an_entry.ae_type) {
+	case ART_NODE4:
+		n4 = (const struct art_node4 *)n;
+		for (i = 0; i < n->an_nchildren; i++) {
+			if (n4->n4_keys[i] >= b)
+				return (n4->n4_children[i]);
+		}
+		break;
+	case ART_NODE16:
+		n16 = (const struct art_node16 *)n;
+		i = art_node16_below(n16, b);
+		if (i < n->an_nchildren)
+			return (n16->n16_children[i]);
+		break;
+	case ART_NODE48:
+		n48 = (const struct art_node48 *)n;
+		for (i = b; i <= 0xff; i++) {
+			if (n48->n48_index[i] == 0)
+				continue;
+			return (n48->n48_children[n48->n48_index[i] - 1]);
+		}
+		break;
+	case ART_NODE256:
+		n256 = (const struct art_node256 *)n;
+		for (i = b; i <= 0xff; i++) {
+			if (n256->n256_children[i] != NULL)
+				return (n256->n256_children[i]);
+		}
+		break;
+	}
+
+	return (NULL);
+}
+
+/* the child with the highest byte that is b or lower */
+static struct art_entry *
+art_child_le(const struct art_node *n, int b)
+{
+	const struct art_node4 *n4;
+	const struct art_node16 *n16;
+	const struct art_node48 *n48;
+	const struct art_node256 *n256;
+	int i;
+
+	if (b < 0)
+		return (NULL);
+
+	switch (n->an_entry.ae_type) {
+	case ART_NODE4:
+		n4 = (const struct art_node4 *)n;
+		for (i = n->an_nchildren - 1; i >= 0; i--) {
+			if (n4->n4_keys[i] <= b)
+				return (n4->n4_children[i]);
+		}
+		break;
+	case ART_NODE16:
+		n16 = (const struct art_node16 *)n;
+		i = art_node16_below(n16, b + 1);
+		if (i > 0)
+			return (n16->n16_children[i - 1]);
+		break;
+	case ART_NODE48:
+		n48 = (const struct art_node48 *)n;
+		for (i = b; i >= 0; i--) {
+			if (n48->n48_index[i] == 0)
+				continue;
+			return (n48->n48_children[n48->n48_index[i] - 1]);
+		}
+		break;
+	case ART_NODE256:
+		n256 = (const struct art_node256 *)n;
+		for (i = b; i >= 0; i--) {
+			if (n256->n256_children[i] != NULL)
+				return (n256->n256_children[i]);
+		}
+		break;
+	}
+
+	return (NULL);
+}
+
+static int
+art_full(const struct art_node *n)
+{
+	switch (n->an_entry.ae_type) {
+	case ART_NODE4:
+		return (n->an_nchildren == 4);
+	case ART_NODE16:
+		return (n->an_nchildren == 16);
+	case ART_NODE48:
+		return (n->an_nchildren == 48);
+	}
+
+	return (0);
+}
+
+/* n must have room for another child */
+static void
+art_add_child(struct art_node *n, uint8_t b, struct art_entry *ae)
+{
+	struct art_node4 *n4;
+	struct art_node16 *n16;
+	struct art_node48 *n48;
+	unsigned int i, nc = n->an_nchildren;
+
+	switch (n->an_entry.ae_type) {
+	case ART_NODE4:
+		n4 = (struct art_node4 *)n;
+		for (i = 0; i < nc && n4->n4_keys[i] < b; i++)
+			;
+		memmove(&n4->n4_keys[i + 1], &n4->n4_keys[i], nc - i);
+		memmove(&n4->n4_children[i + 1], &n4->n4_children[i],
+		    (nc - i) * sizeof(n4->n4_children[0]));
+		n4->n4_keys[i] = b;
+		n4->n4_children[i] = ae;
+		break;
+	case ART_NODE16:
+		n16 = (struct art_node16 *)n;
+		i = art_node16_below(n16, b);
+		memmove(&n16->n16_keys[i + 1], &n16->n16_keys[i], nc - i);
+		memmove(&n16->n16_children[i + 1], &n16->n16_children[i],
+		    (nc - i) * sizeof(n16->n16_children[0]));
+		n16->n16_keys[i] = b;
+		n16->n16_children[i] = ae;
+		break;
+	case ART_NODE48:
+		/* the children are kept packed at the start of the array */
+		n48 = (struct art_node48 *)n;
+		n48->n48_children[nc] = ae;
+		n48->n48_index[b] = nc + 1;
+		break;
+	case ART_NODE256:
+		((struct art_node256 *)n)->n256_children[b] = ae;
+		break;
+	}
+
+	n->an_nchildren++;
+	ae->ae_parent = n;
+	ae->ae_byte = b;
+}
+
+static void
+art_del_child(struct art_node *n, uint8_t b)
+{
+	struct art_node4 *n4;
+	struct art_node16 *n16;
+	struct art_node48 *n48;
+	struct art_entry *last;
+	unsigned int i, nc = n->an_nchildren;
+
+	switch (n->an_entry.ae_type) {
+	case ART_NODE4:
+		n4 = (struct art_node4 *)n;
+		for (i = 0; n4->n4_keys[i] != b; i++)
+			;
+		memmove(&n4->n4_keys[i], &n4->n4_keys[i + 1], nc - i - 1);
+		memmove(&n4->n4_children[i], &n4->n4_children[i + 1],
+		    (nc - i - 1) * sizeof(n4->n4_children[0]));
+		break;
+	case ART_NODE16:
+		n16 = (struct art_node16 *)n;
+		i = art_node16_below(n16, b);
+		memmove(&n16->n16_keys[i], &n16->n16_keys[i + 1], nc - i - 1);
+		memmove(&n16->n16_children[i], &n16->n16_children[i + 1],
+		    (nc - i - 1) * sizeof(n16->n16_children[0]));
+		break;
+	case ART_NODE48:
+		/* move the last child into the hole to keep them packed */
+		n48 = (struct art_node48 *)n;
+		i = n48->n48_index[b] - 1;
+		last = n48->n48_children[nc - 1];
+		n48->n48_children[i] = last;
+		n48->n48_index[last->ae_byte] = i + 1;
+		n48->n48_children[nc - 1] = NULL;
+		n48->n48_index[b] = 0;
+		break;
+	case ART_NODE256:
+		((struct art_node256 *)n)->n256_children[b] = NULL;
+		break;
+	}
+
+	n->an_nchildren--;
+}
+
+static struct art_node *
+art_alloc(uint8_t type)
+{
+	struct art_node *n;
+	size_t size;
+
+	switch (type) {
+	case ART_NODE4:
+		size = sizeof(struct art_node4);
+		break;
+	case ART_NODE16:
+		size = sizeof(struct art_node16);
+		break;
+	case ART_NODE48:
+		size = sizeof(struct art_node48);
+		break;
+	default:
+		size = sizeof(struct art_node256);
+		break;
+	}
+
+	n = calloc(1, size);
+	if (n == NULL)
+		return (NULL);
+
+	n->an_entry.ae_type = type;
+
+	return (n);
+}
+
+static struct art_entry *
+art_first(struct art_entry *ae)
+{
+	struct art_node *n;
+
+	while (ae->ae_type != ART_LEAF) {
+		n = (struct art_node *)ae;
+		if (n->an_end != NULL)
+			return (n->an_end);
+
+		ae = art_child_ge(n, 0);
+	}
+
+	return (ae);
+}
+
+static struct art_entry *
+art_last(struct art_entry *ae)
+{
+	struct art_node *n;
+	struct art_entry *c;
+
+	while (ae->ae_type != ART_LEAF) {
+		n = (struct art_node *)ae;
+		c = art_child_le(n, 0xff);
+		ae = c != NULL ? c : n->an_end;
+	}
+
+	return (ae);
+}
+
+/* the first leaf after everything under ae */
+static struct art_entry *
+art_after(const struct art_entry *ae)
+{
+	struct art_node *p;
+	struct art_entry *c;
+
+	while ((p = ae->ae_parent) != NULL) {
+		c = art_child_ge(p, ae->ae_byte == ART_END ?
+		    0 : ae->ae_byte + 1);
+		if (c != NULL)
+			return (art_first(c));
+
+		ae = &p->an_entry;
+	}
+
+	return (NULL);
+}
+
+/* the last leaf before everything under ae */
+static struct art_entry *
+art_before(const struct art_entry *ae)
+{
+	struct art_node *p;
+	struct art_entry *c;
+
+	while ((p = ae->ae_parent) != NULL) {
+		if (ae->ae_byte != ART_END) {
+			c = art_child_le(p, (int)ae->ae_byte - 1);
+			if (c != NULL)
+				return (art_last(c));
+			if (p->an_end != NULL)
+				return (p->an_end);
+		}
+
+		ae = &p->an_entry;
+	}
+
+	return (NULL);
+}
+
+/* where the tree points at ae */
+static struct art_entry **
+art_slot(struct art_tree *art, struct art_entry *ae)
+{
+	struct art_node *p = ae->ae_parent;
+
+	if (p == NULL)
+		return (&art->art_root);
+	if (ae->ae_byte == ART_END)
+		return (&p->an_end);
+
+	return (art_child(p, ae->ae_byte));
+}
+
+/* the whole prefix of n, which may have to come from a key under it */
+static const uint8_t *
+art_prefix(const struct art_type *t, struct art_node *n, uint8_t *buf)
+{
+	size_t len;
+
+	if (n->an_plen <= ART_PREFIX)
+		return (n->an_prefix);
+
+	return (art_key(t, art_first(&n->an_entry), buf, &len) +
+	    n->an_depth);
+}
+
+/* sets the prefix of n from the key of an element under it */
+static void
+art_reprefix(const struct art_type *t, struct art_node *n,
+    uint32_t depth, uint32_t plen)
+{
+	uint8_t buf[ART_KEYBUF];
+	const uint8_t *key;
+	size_t len;
+
+	key = art_key(t, art_first(&n->an_entry), buf, &len);
+
+	n->an_depth = depth;
+	n->an_plen = plen;
+	memcpy(n->an_prefix, key + depth,
+	    plen < ART_PREFIX ? plen : ART_PREFIX);
+}
+
+static void
+art_set_prefix(struct art_node *n, uint32_t depth, const uint8_t *key,
+    uint32_t plen)
+{
+	n->an_depth = depth;
+	n->an_plen = plen;
+	memcpy(n->an_prefix, key + depth,
+	    plen < ART_PREFIX ? plen : ART_PREFIX);
+}
+
+/*
+ * how many bytes of the prefix of n match key. if they don't all
+ * match, *dir says which side of the prefix key is on.
+ */
+static uint32_t
+art_prefix_match(const struct art_type *t, struct art_node *n,
+    const uint8_t *key, size_t len, int *dir)
+{
+	uint8_t buf[ART_KEYBUF];
+	const uint8_t *pfx = art_prefix(t, n, buf);
+	size_t d = n->an_depth;
+	uint32_t i;
+
+	for (i = 0; i < n->an_plen; i++) {
+		if (d + i == len) {
+			*dir = -1;
+			break;
+		}
+		if (key[d + i] != pfx[i]) {
+			*dir = key[d + i] < pfx[i] ? -1 : 1;
+			break;
+		}
+	}
+
+	return (i);
+}
+
+/* puts a leaf in a node that was just made for it */
+static void
+art_add_leaf(struct art_node *n, struct art_entry *ae,
+    const uint8_t *key, size_t len, size_t depth)
+{
+	if (len == depth) {
+		n->an_end = ae;
+		ae->ae_parent = n;
+		ae->ae_byte = ART_END;
+	} else
+		art_add_child(n, key[depth], ae);
+}
+
+/* moves the contents of n into the empty node m and puts m in its place */
+static void
+art_replace(struct art_tree *art, struct art_node *n, struct art_node *m)
+{
+	struct art_entry *c;
+
+	*art_slot(art, &n->an_entry) = &m->an_entry;
+
+	m->an_entry.ae_parent = n->an_entry.ae_parent;
+	m->an_entry.ae_byte = n->an_entry.ae_byte;
+	m->an_depth = n->an_depth;
+	m->an_plen = n->an_plen;
+	memcpy(m->an_prefix, n->an_prefix, sizeof(m->an_prefix));
+
+	m->an_end = n->an_end;
+	if (m->an_end != NULL)
+		m->an_end->ae_parent = m;
+
+	for (c = art_child_ge(n, 0); c != NULL;
+	    c = art_child_ge(n, c->ae_byte + 1))
+		art_add_child(m, c->ae_byte, c);
+
+	free(n);
+}
+
+/* takes n out of the tree if it has one thing left, or makes it smaller */
+static void
+art_shrink(const struct art_type *t, struct art_tree *art,
+    struct art_node *n)
+{
+	struct art_entry *c;
+	struct art_node *m;
+	uint8_t type;
+
+	if (n->an_nchildren + (n->an_end != NULL) == 1) {
+		c = n->an_end != NULL ? n->an_end : art_child_ge(n, 0);
+		if (c->ae_type != ART_LEAF) {
+			m = (struct art_node *)c;
+			art_reprefix(t, m, n->an_depth,
+			    n->an_plen + 1 + m->an_plen);
+		}
+
+		*art_slot(art, &n->an_entry) = c;
+		c->ae_parent = n->an_entry.ae_parent;
+		c->ae_byte = n->an_entry.ae_byte;
+		free(n);
+		return;
+	}
+
+	switch (n->an_entry.ae_type) {
+	case ART_NODE16:
+		if (n->an_nchildren > ART_SHRINK16)
+			return;
+		type = ART_NODE4;
+		break;
+	case ART_NODE48:
+		if (n->an_nchildren > ART_SHRINK48)
+			return;
+		type = ART_NODE16;
+		break;
+	case ART_NODE256:
+		if (n->an_nchildren > ART_SHRINK256)
+			return;
+		type = ART_NODE48;
+		break;
+	default:
+		return;
+	}
+
+	/* a bigger node than necessary is still fine */
+	m = art_alloc(type);
+	if (m != NULL)
+		art_replace(art, n, m);
+}
+
+void *
+_art_insert(const struct art_type *t, struct art_tree *art, void *elm)
+{
+	struct art_entry *ae = art_n2e(t, elm);
+	struct art_entry **slot = &art->art_root;
+	struct art_entry *c;
+	struct art_node *n, *m;
+	uint8_t buf[ART_KEYBUF], lbuf[ART_KEYBUF];
+	const uint8_t *key, *lkey, *pfx;
+	size_t len, llen, d = 0, i;
+	uint32_t p;
+	int dir;
+
+	key = (*t->t_key)(elm, buf, &len);
+	ae->ae_type = ART_LEAF;
+
+	if (*slot == NULL) {
+		ae->ae_parent = NULL;
+		ae->ae_byte = 0;
+		*slot = ae;
+		return (NULL);
+	}
+
+	for (;;) {
+		c = *slot;
+
+		if (c->ae_type == ART_LEAF) {
+			lkey = art_key(t, c, lbuf, &llen);
+			for (i = d; i < len && i < llen; i++) {
+				if (key[i] != lkey[i])
+					break;
+			}
+			if (i == len && i == llen)
+				return (art_e2n(t, c));
+
+			/* a node to tell the two keys apart */
+			m = art_alloc(ART_NODE4);
+			if (m == NULL)
+				return (elm);
+
+			m->an_entry.ae_parent = c->ae_parent;
+			m->an_entry.ae_byte = c->ae_byte;
+			art_set_prefix(m, d, key, i - d);
+			*slot = &m->an_entry;
+
+			art_add_leaf(m, c, lkey, llen, i);
+			art_add_leaf(m, ae, key, len, i);
+			return (NULL);
+		}
+
+		n = (struct art_node *)c;
+		p = art_prefix_match(t, n, key, len, &dir);
+		if (p < n->an_plen) {
+			/* split the prefix where the key leaves it */
+			m = art_alloc(ART_NODE4);
+			if (m == NULL)
+				return (elm);
+
+			pfx = art_prefix(t, n, lbuf);
+
+			m->an_entry.ae_parent = n->an_entry.ae_parent;
+			m->an_entry.ae_byte = n->an_entry.ae_byte;
+			art_set_prefix(m, n->an_depth, key, p);
+			*slot = &m->an_entry;
+
+			art_add_child(m, pfx[p], &n->an_entry);
+			art_reprefix(t, n, n->an_depth + p + 1,
+			    n->an_plen - p - 1);
+			art_add_leaf(m, ae, key, len, m->an_depth + p);
+			return (NULL);
+		}
+
+		d = n->an_depth + n->an_plen;
+		if (d == len) {
+			if (n->an_end != NULL)
+				return (art_e2n(t, n->an_end));
+
+			art_add_leaf(n, ae, key, len, d);
+			return (NULL);
+		}
+
+		slot = art_child(n, key[d]);
+		if (slot == NULL) {
+			if (art_full(n)) {
+				m = art_alloc(n->an_entry.ae_type + 1);
+				if (m == NULL)
+					return (elm);
+
+				art_replace(art, n, m);
+				n = m;
+			}
+
+			art_add_child(n, key[d], ae);
+			return (NULL);
+		}
+
+		d++;
+	}
+}
+
+void *
+_art_remove(const struct art_type *t, struct art_tree *art, void *elm)
+{
+	struct art_entry *ae = art_n2e(t, elm);
+	struct art_node *p = ae->ae_parent;
+
+	if (p == NULL) {
+		art->art_root = NULL;
+		return (elm);
+	}
+
+	if (ae->ae_byte == ART_END)
+		p->an_end = NULL;
+	else
+		art_del_child(p, ae->ae_byte);
+
+	art_shrink(t, art, p);
+
+	return (elm);
+}
+
+void *
+_art_find(const struct art_type *t, struct art_tree *art, const void *elm)
+{
+	struct art_entry *ae = art->art_root, **slot;
+	struct art_node *n;
+	uint8_t buf[ART_KEYBUF], lbuf[ART_KEYBUF];
+	const uint8_t *key, *lkey;
+	size_t len, llen, d, i, plen;
+
+	key = (*t->t_key)(elm, buf, &len);
+
+	while (ae != NULL && ae->ae_type != ART_LEAF) {
+		n = (struct art_node *)ae;
+		d = n->an_depth;
+
+		/* only check the stored prefix, the leaf is compared below */
+		plen = n->an_plen < ART_PREFIX ? n->an_plen : ART_PREFIX;
+		if (d + plen > len)
+			return (NULL);
+		for (i = 0; i < plen; i++) {
+			if (key[d + i] != n->an_prefix[i])
+				return (NULL);
+		}
+
+		d += n->an_plen;
+		if (d >= len) {
+			ae = d == len ? n->an_end : NULL;
+			break;
+		}
+
+		slot = art_child(n, key[d]);
+		ae = slot != NULL ? *slot : NULL;
+	}
+
+	if (ae == NULL)
+		return (NULL);
+
+	lkey = art_key(t, ae, lbuf, &llen);
+	if (llen != len || memcmp(key, lkey, len) != 0)
+		return (NULL);
+
+	return (art_e2n(t, ae));
+}
+
+/* the first element with a key greater than or equal to that of elm */
+void *
+_art_nfind(const struct art_type *t, struct art_tree *art, const void *elm)
+{
+	struct art_entry *ae = art->art_root, *c;
+	struct art_node *n;
+	uint8_t buf[ART_KEYBUF], lbuf[ART_KEYBUF];
+	const uint8_t *key, *lkey;
+	size_t len, llen, d;
+	int dir;
+
+	if (ae == NULL)
+		return (NULL);
+
+	key = (*t->t_key)(elm, buf, &len);
+
+	while (ae->ae_type != ART_LEAF) {
+		n = (struct art_node *)ae;
+		if (art_prefix_match(t, n, key, len, &dir) < n->an_plen) {
+			ae = dir < 0 ? art_first(ae) : art_after(ae);
+			goto done;
+		}
+
+		/* everything under n is at least as long as the key */
+		d = n->an_depth + n->an_plen;
+		if (d == len) {
+			ae = art_first(ae);
+			goto done;
+		}
+
+		c = art_child_ge(n, key[d]);
+		if (c == NULL) {
+			ae = art_after(ae);
+			goto done;
+		}
+		if (c->ae_byte != key[d]) {
+			ae = art_first(c);
+			goto done;
+		}
+
+		ae = c;
+	}
+
+	lkey = art_key(t, ae, lbuf, &llen);
+	if (art_keycmp(lkey, llen, key, len) < 0)
+		ae = art_after(ae);
+
+done:
+	return (ae == NULL ? NULL : art_e2n(t, ae));
+}
+
+void *
+_art_min(const struct art_type *t, struct art_tree *art)
+{
+	if (art->art_root == NULL)
+		return (NULL);
+
+	return (art_e2n(t, art_first(art->art_root)));
+}
+
+void *
+_art_max(const struct art_type *t, struct art_tree *art)
+{
+	if (art->art_root == NULL)
+		return (NULL);
+
+	return (art_e2n(t, art_last(art->art_root)));
+}
+
+void *
+_art_next(const struct art_type *t, void *elm)
+{
+	struct art_entry *ae = art_after(art_n2e(t, elm));
+
+	return (ae == NULL ? NULL : art_e2n(t, ae));
+}
+
+void *
+_art_prev(const struct art_type *t, void *elm)
+{
+	struct art_entry *ae = art_before(art_n2e(t, elm));
+
+	return (ae == NULL ? NULL : art_e2n(t, ae));
+}
+
+/* frees the nodes, leaving the elements as they are */
+void
+_art_destroy(struct art_tree *art)
+{
+	struct art_entry *ae = art->art_root;
+	struct art_node *n, *p;
+	unsigned int b = 0;
+
+	art->art_root = NULL;
+	if (ae == NULL || ae->ae_type == ART_LEAF)
+		return;
+
+	n = (struct art_node *)ae;
+	while (n != NULL) {
+		/* go down to the next child that is a node */
+		for (ae = art_child_ge(n, b); ae != NULL;
+		    ae = art_child_ge(n, ae->ae_byte + 1)) {
+			if (ae->ae_type != ART_LEAF)
+				break;
+		}
+		if (ae != NULL) {
+			n = (struct art_node *)ae;
+			b = 0;
+			continue;
+		}
+
+		p = n->an_entry.ae_parent;
+		b = n->an_entry.ae_byte + 1;
+		free(n);
+		n = p;
+	}
+}
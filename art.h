@@ -0,0 +1,241 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _ART_H_
+#define _ART_H_
+
+/*
+ * An adaptive radix tree.
+ *
+ * Elements are ordered by the bytes of their keys rather than by a
+ * comparison function, with a key that is a prefix of another ordered
+ * before it. ART_GENERATE takes a function that returns a pointer to
+ * the key of an element and its length, and ART_GENERATE_INT uses an
+ * unsigned integer member of the element as the key.
+ *
+ * The ART macros work like their RBT counterparts in bst.h. Keys are
+ * unique. The inner nodes of the tree are allocated as elements are
+ * inserted, and if that fails ART_INSERT returns the element it was
+ * given without inserting it. ART_DESTROY frees the nodes of a tree
+ * without touching its elements.
+ */
+
+#include <sys/_null.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct art_node;
+
+struct art_type {
+	const uint8_t	*(*t_key)(const void *, uint8_t *, size_t *);
+	unsigned int	  t_offset;	/* offset of art_entry in type */
+};
+
+struct art_entry {
+	struct art_node	 *ae_parent;
+	uint16_t	  ae_byte;	/* index in the parent, or ART_END */
+	uint8_t		  ae_type;	/* ART_LEAF or the kind of node */
+};
+
+#define ART_LEAF		0
+#define ART_END			256	/* the key ends at the parent */
+
+/* big enough for the key of ART_GENERATE_INT */
+#define ART_KEYBUF		8
+
+struct art_tree {
+	struct art_entry *art_root;
+};
+
+#define ART_HEAD(_name, _type)						\
+struct _name {								\
+	struct art_tree	  art_tree;					\
+}
+
+#define ART_ENTRY(_type)	struct art_entry
+
+#define ART_INITIALIZER(_head)	{ { NULL } }
+
+static inline void
+_art_init(struct art_tree *art)
+{
+	art->art_root = NULL;
+}
+
+static inline int
+_art_empty(struct art_tree *art)
+{
+	return (art->art_root == NULL);
+}
+
+/* integers are stored big endian so their bytes order like they do */
+static inline const uint8_t *
+_art_key_int(uint64_t v, size_t size, uint8_t *buf, size_t *len)
+{
+	size_t i;
+
+	for (i = size; i > 0; i--) {
+		buf[i - 1] = v & 0xff;
+		v >>= 8;
+	}
+
+	*len = size;
+	return (buf);
+}
+
+void	*_art_insert(const struct art_type *, struct art_tree *, void *);
+void	*_art_remove(const struct art_type *, struct art_tree *, void *);
+void	*_art_find(const struct art_type *, struct art_tree *,
+	     const void *);
+void	*_art_nfind(const struct art_type *, struct art_tree *,
+	     const void *);
+void	*_art_min(const struct art_type *, struct art_tree *);
+void	*_art_max(const struct art_type *, struct art_tree *);
+void	*_art_next(const struct art_type *, void *);
+void	*_art_prev(const struct art_type *, void *);
+void	 _art_destroy(struct art_tree *);
+
+#define ART_PROTOTYPE(_name, _type, _field)				\
+extern const struct art_type _name##_ART_TYPE;				\
+									\
+__unused static inline void						\
+_name##_ART_INIT(struct _name *head)					\
+{									\
+	_art_init(&head->art_tree);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_ART_INSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _art_insert(&_name##_ART_TYPE, &head->art_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_ART_REMOVE(struct _name *head, struct _type *elm)		\
+{									\
+	return _art_remove(&_name##_ART_TYPE, &head->art_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_ART_FIND(struct _name *head, const struct _type *key)		\
+{									\
+	return _art_find(&_name##_ART_TYPE, &head->art_tree, key);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_ART_NFIND(struct _name *head, const struct _type *key)		\
+{									\
+	return _art_nfind(&_name##_ART_TYPE, &head->art_tree, key);	\
+}									\
+									\
+__unused static inline int						\
+_name##_ART_EMPTY(struct _name *head)					\
+{									\
+	return _art_empty(&head->art_tree);				\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_ART_MIN(struct _name *head)					\
+{									\
+	return _art_min(&_name##_ART_TYPE, &head->art_tree);		\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_ART_MAX(struct _name *head)					\
+{									\
+	return _art_max(&_name##_ART_TYPE, &head->art_tree);		\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_ART_NEXT(struct _type *elm)					\
+{									\
+	return _art_next(&_name##_ART_TYPE, elm);			\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_ART_PREV(struct _type *elm)					\
+{									\
+	return _art_prev(&_name##_ART_TYPE, elm);			\
+}									\
+									\
+__unused static inline void						\
+_name##_ART_DESTROY(struct _name *head)					\
+{									\
+	_art_destroy(&head->art_tree);					\
+}
+
+#define ART_GENERATE_INTERNAL(_name, _type, _field, _keyfn)		\
+const struct art_type _name##_ART_TYPE = {				\
+	_keyfn,								\
+	offsetof(struct _type, _field),					\
+}
+
+/* _key returns a pointer to the key bytes and sets their length */
+#define ART_GENERATE(_name, _type, _field, _key)			\
+static const uint8_t *							\
+_name##_ART_KEY(const void *ptr, uint8_t *buf, size_t *len)		\
+{									\
+	const struct _type *p = ptr;					\
+	(void)buf;							\
+	return _key(p, len);						\
+}									\
+ART_GENERATE_INTERNAL(_name, _type, _field, _name##_ART_KEY)
+
+/* _member is an unsigned integer of up to 64 bits */
+#define ART_GENERATE_INT(_name, _type, _field, _member)			\
+static const uint8_t *							\
+_name##_ART_KEY(const void *ptr, uint8_t *buf, size_t *len)		\
+{									\
+	const struct _type *p = ptr;					\
+	return _art_key_int(p->_member, sizeof(p->_member), buf, len);	\
+}									\
+ART_GENERATE_INTERNAL(_name, _type, _field, _name##_ART_KEY)
+
+#define ART_INIT(_name, _head)		_name##_ART_INIT(_head)
+#define ART_INSERT(_name, _head, _elm)	_name##_ART_INSERT(_head, _elm)
+#define ART_REMOVE(_name, _head, _elm)	_name##_ART_REMOVE(_head, _elm)
+#define ART_FIND(_name, _head, _key)	_name##_ART_FIND(_head, _key)
+#define ART_NFIND(_name, _head, _key)	_name##_ART_NFIND(_head, _key)
+#define ART_EMPTY(_name, _head)		_name##_ART_EMPTY(_head)
+#define ART_MIN(_name, _head)		_name##_ART_MIN(_head)
+#define ART_MAX(_name, _head)		_name##_ART_MAX(_head)
+#define ART_NEXT(_name, _elm)		_name##_ART_NEXT(_elm)
+#define ART_PREV(_name, _elm)		_name##_ART_PREV(_elm)
+#define ART_DESTROY(_name, _head)	_name##_ART_DESTROY(_head)
+
+#define ART_FOREACH(_e, _name, _head)					\
+	for ((_e) = ART_MIN(_name, (_head));				\
+	     (_e) != NULL;						\
+	     (_e) = ART_NEXT(_name, (_e)))
+
+#define ART_FOREACH_SAFE(_e, _name, _head, _n)				\
+	for ((_e) = ART_MIN(_name, (_head));				\
+	     (_e) != NULL && ((_n) = ART_NEXT(_name, (_e)), 1);		\
+	     (_e) = (_n))
+
+#define ART_FOREACH_REVERSE(_e, _name, _head)				\
+	for ((_e) = ART_MAX(_name, (_head));				\
+	     (_e) != NULL;						\
+	     (_e) = ART_PREV(_name, (_e)))
+
+#define ART_FOREACH_REVERSE_SAFE(_e, _name, _head, _n)			\
+	for ((_e) = ART_MAX(_name, (_head));				\
+	     (_e) != NULL && ((_n) = ART_PREV(_name, (_e)), 1);		\
+	     (_e) = (_n))
+
+#endif /* _ART_H_ */
@@ -0,0 +1,241 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A synthetic load for the edf scheduler.
+ *
+ *	cc -O2 -pthread -I.. edf_load.c ../edf.c ../heap.c
+ *
+ * For each number of workers, a generator thread submits tasks at a
+ * steady rate for a while, with the rate set so the tasks would keep
+ * the given share of the workers busy. Each task spins for its service
+ * time and has a deadline between one and two times the deadline
+ * argument after it was submitted. Every fourth task from the generator
+ * submits a follow up task to the worker it runs on, which leaves work
+ * for the other workers to steal.
+ *
+ * Once every task has run, the counters from edf_stats are printed,
+ * including how many tasks finished after their deadline and by how
+ * much on average, and how many of them had not even started by then.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "edf.h"
+
+#define LOAD_MAXWORKERS		64
+
+struct load {
+	struct edf		 *l_edf;
+	struct edf_task		 *l_tasks;
+	unsigned int		  l_ntasks;	/* from the generator */
+	uint64_t		  l_service;	/* ns */
+	uint64_t		  l_deadline;	/* ns */
+};
+
+struct load_arg {
+	struct load		 *la_load;
+	unsigned int		  la_idx;
+};
+
+static struct load_arg *load_args;
+
+__attribute__((__noreturn__)) static void
+usage(void)
+{
+	extern char *__progname;
+
+	fprintf(stderr, "usage: %s [-d deadline_us] [-s service_us] "
+	    "[-t seconds] [-u load%%] [-w workers]\n", __progname);
+	exit(1);
+}
+
+/* like strtonum, which glibc does not have */
+static unsigned int
+getnum(const char *name, const char *arg, unsigned int min, unsigned int max)
+{
+	char *end;
+	long long v;
+
+	v = strtoll(arg, &end, 10);
+	if (arg[0] == '\0' || *end != '\0')
+		errx(1, "%s is invalid: %s", name, arg);
+	if (v < min)
+		errx(1, "%s is too small: %s", name, arg);
+	if (v > max)
+		errx(1, "%s is too large: %s", name, arg);
+
+	return (v);
+}
+
+static void
+load_sleep(uint64_t until)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	now = edf_now();
+	if (now >= until)
+		return;
+
+	ts.tv_sec = (until - now) / 1000000000ULL;
+	ts.tv_nsec = (until - now) % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+static uint64_t
+load_deadline(struct load *l)
+{
+	return (edf_now() + l->l_deadline +
+	    arc4random_uniform(l->l_deadline + 1));
+}
+
+static void
+load_task(void *arg)
+{
+	struct load_arg *la = arg;
+	struct load *l = la->la_load;
+	uint64_t end;
+	unsigned int i;
+
+	end = edf_now() + l->l_service;
+	while (edf_now() < end)
+		;
+
+	if (la->la_idx < l->l_ntasks && (la->la_idx & 3) == 0) {
+		i = l->l_ntasks + la->la_idx / 4;
+		edf_task_init(&l->l_tasks[i], load_task, &load_args[i]);
+		edf_submit(l->l_edf, &l->l_tasks[i], load_deadline(l),
+		    edf_worker(l->l_edf));
+	}
+}
+
+static void
+load_run(unsigned int nworkers, unsigned int seconds, unsigned int pct,
+    uint64_t service, uint64_t deadline)
+{
+	struct load l;
+	struct edf_stats es;
+	uint64_t interval, start;
+	unsigned int i, total;
+
+	/* the follow ups add a quarter again to the generated tasks */
+	interval = service * 100 * 5 / (4 * pct * nworkers);
+	if (interval == 0)
+		interval = 1;
+
+	l.l_ntasks = seconds * 1000000000ULL / interval;
+	l.l_service = service;
+	l.l_deadline = deadline;
+
+	total = l.l_ntasks + (l.l_ntasks + 3) / 4;
+	l.l_tasks = calloc(total, sizeof(*l.l_tasks));
+	load_args = calloc(total, sizeof(*load_args));
+	if (l.l_tasks == NULL || load_args == NULL)
+		err(1, "tasks");
+	for (i = 0; i < total; i++) {
+		load_args[i].la_load = &l;
+		load_args[i].la_idx = i;
+	}
+
+	if (edf_create(&l.l_edf, nworkers) != 0)
+		errx(1, "unable to create scheduler");
+
+	start = edf_now();
+	for (i = 0; i < l.l_ntasks; i++) {
+		load_sleep(start + i * interval);
+
+		edf_task_init(&l.l_tasks[i], load_task, &load_args[i]);
+		edf_submit(l.l_edf, &l.l_tasks[i], load_deadline(&l), EDF_ANY);
+	}
+
+	for (;;) {
+		edf_stats(l.l_edf, &es);
+		if (es.es_run == total)
+			break;
+		load_sleep(edf_now() + 1000000);
+	}
+	edf_destroy(l.l_edf);
+
+	printf("%7u %9llu %9llu %7.2f%% %10.1f %10llu %8llu %9llu\n",
+	    nworkers, (unsigned long long)es.es_run,
+	    (unsigned long long)es.es_missed,
+	    es.es_run ? 100.0 * es.es_missed / es.es_run : 0.0,
+	    es.es_missed ? es.es_late / 1000.0 / es.es_missed : 0.0,
+	    (unsigned long long)es.es_late_start,
+	    (unsigned long long)es.es_steals,
+	    (unsigned long long)es.es_wakeups);
+
+	free(load_args);
+	free(l.l_tasks);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int maxworkers = 8;
+	unsigned int seconds = 2;
+	unsigned int pct = 70;
+	uint64_t service = 20000;
+	uint64_t deadline = 1000000;
+	unsigned int n;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "d:s:t:u:w:")) != -1) {
+		switch (ch) {
+		case 'd':
+			deadline = getnum("deadline", optarg, 1, 4000000) *
+			    1000ULL;
+			break;
+		case 's':
+			service = getnum("service time", optarg, 1, 1000000) *
+			    1000ULL;
+			break;
+		case 't':
+			seconds = getnum("seconds", optarg, 1, 3600);
+			break;
+		case 'u':
+			pct = getnum("load", optarg, 1, 200);
+			break;
+		case 'w':
+			maxworkers = getnum("workers", optarg, 1,
+			    LOAD_MAXWORKERS);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	printf("%7s %9s %9s %8s %10s %10s %8s %9s\n", "workers", "run",
+	    "missed", "missed%", "late us", "late start", "steals",
+	    "wakeups");
+
+	for (n = 1; n <= maxworkers; n *= 2)
+		load_run(n, seconds, pct, service, deadline);
+
+	return (0);
+}
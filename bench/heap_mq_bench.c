@@ -0,0 +1,289 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Throughput and rank error of HEAP_MQ from 1 to 64 threads.
+ *
+ *	cc -O2 -pthread -I.. heap_mq_bench.c ../heap.c ../heap_mq.c
+ *
+ * For each thread count the queue gets two heaps per thread. The
+ * threads each own a share of the elements, and repeatedly insert
+ * them all and then extract as many elements as they inserted, giving
+ * the throughput in operations per second.
+ *
+ * The rank error of an extract is the number of elements in the queue
+ * that order before the one it returned. Recording the order of
+ * extracts from several threads would also measure whichever thread
+ * was preempted between taking an element and writing it down, so
+ * the rank error is measured by a single thread draining a queue with
+ * the same number of heaps. The keys are 0 to n - 1, and a Fenwick
+ * tree of the keys already extracted gives the exact rank of each one.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "heap.h"
+
+#define BENCH_MAXTHREADS	64
+
+struct elm {
+	uint64_t		  e_key;
+	HEAP_ENTRY(elm)		  e_entry;
+};
+
+static int
+elm_cmp(const struct elm *a, const struct elm *b)
+{
+	if (a->e_key < b->e_key)
+		return (-1);
+	if (a->e_key > b->e_key)
+		return (1);
+	return (0);
+}
+
+HEAP_HEAD(elm_heap);
+HEAP_PROTOTYPE(elm_heap, elm);
+HEAP_GENERATE(elm_heap, elm, e_entry, elm_cmp);
+
+struct worker {
+	pthread_t		  w_thread;
+	struct _heap_mq		 *w_mq;
+	struct elm		**w_elms;
+	unsigned int		  w_nelms;
+	unsigned int		  w_rounds;
+};
+
+__attribute__((__noreturn__)) static void
+usage(void)
+{
+	extern char *__progname;
+
+	fprintf(stderr, "usage: %s [-n elements] [-r rounds] [-t threads]\n",
+	    __progname);
+	exit(1);
+}
+
+/* like strtonum, which glibc does not have */
+static unsigned int
+getnum(const char *name, const char *arg, unsigned int min, unsigned int max)
+{
+	char *end;
+	long long v;
+
+	v = strtoll(arg, &end, 10);
+	if (arg[0] == '\0' || *end != '\0')
+		errx(1, "%s is invalid: %s", name, arg);
+	if (v < min)
+		errx(1, "%s is too small: %s", name, arg);
+	if (v > max)
+		errx(1, "%s is too large: %s", name, arg);
+
+	return (v);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void *
+worker(void *arg)
+{
+	struct worker *w = arg;
+	struct elm *e;
+	unsigned int r, i;
+
+	for (r = 0; r < w->w_rounds; r++) {
+		for (i = 0; i < w->w_nelms; i++)
+			HEAP_MQ_INSERT(elm_heap, w->w_mq, w->w_elms[i]);
+
+		/* the elements that come back may be another thread's */
+		for (i = 0; i < w->w_nelms; i++) {
+			while ((e = HEAP_MQ_EXTRACT(elm_heap, w->w_mq)) == NULL)
+				;
+			w->w_elms[i] = e;
+		}
+	}
+
+	return (NULL);
+}
+
+static double
+throughput(struct elm *elms, unsigned int n, unsigned int rounds,
+    unsigned int nthreads)
+{
+	struct worker workers[BENCH_MAXTHREADS];
+	struct worker *w;
+	struct _heap_mq *mq;
+	unsigned int share = n / nthreads;
+	unsigned int i, j;
+	double start, elapsed;
+
+	if (HEAP_MQ_CREATE(elm_heap, &mq, nthreads * 2) != 0)
+		errx(1, "unable to create queue");
+
+	for (i = 0; i < nthreads; i++) {
+		w = &workers[i];
+		w->w_mq = mq;
+		w->w_nelms = share;
+		w->w_rounds = rounds;
+		w->w_elms = calloc(share, sizeof(*w->w_elms));
+		if (w->w_elms == NULL)
+			err(1, "elements");
+		for (j = 0; j < share; j++)
+			w->w_elms[j] = &elms[i * share + j];
+	}
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		w = &workers[i];
+		if (pthread_create(&w->w_thread, NULL, worker, w) != 0)
+			errx(1, "unable to create thread");
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].w_thread, NULL);
+	elapsed = now() - start;
+
+	if (HEAP_MQ_EXTRACT(elm_heap, mq) != NULL)
+		errx(1, "queue is not empty");
+
+	for (i = 0; i < nthreads; i++)
+		free(workers[i].w_elms);
+	HEAP_MQ_DESTROY(mq);
+
+	return (2.0 * rounds * share * nthreads / elapsed);
+}
+
+static void
+rank_error(struct elm *elms, unsigned int n, unsigned int nthreads,
+    double *mean, uint64_t *max)
+{
+	struct _heap_mq *mq;
+	struct elm *e;
+	uint64_t *fenwick;
+	uint64_t rank, sum, total = 0;
+	unsigned int i, k;
+
+	fenwick = calloc(n + 1, sizeof(*fenwick));
+	if (fenwick == NULL)
+		err(1, "fenwick tree");
+
+	if (HEAP_MQ_CREATE(elm_heap, &mq, nthreads * 2) != 0)
+		errx(1, "unable to create queue");
+
+	for (i = 0; i < n; i++)
+		HEAP_MQ_INSERT(elm_heap, mq, &elms[i]);
+
+	*max = 0;
+	for (i = 0; i < n; i++) {
+		e = HEAP_MQ_EXTRACT(elm_heap, mq);
+		if (e == NULL)
+			errx(1, "queue ran out after %u elements", i);
+
+		/* the lower keys that haven't been extracted yet */
+		sum = 0;
+		for (k = e->e_key; k > 0; k -= k & -k)
+			sum += fenwick[k];
+		rank = e->e_key - sum;
+		for (k = e->e_key + 1; k <= n; k += k & -k)
+			fenwick[k]++;
+
+		total += rank;
+		if (rank > *max)
+			*max = rank;
+	}
+
+	*mean = (double)total / n;
+
+	HEAP_MQ_DESTROY(mq);
+	free(fenwick);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct elm *elms;
+	unsigned int n = 400000;
+	unsigned int rounds = 10;
+	unsigned int maxthreads = BENCH_MAXTHREADS;
+	unsigned int nthreads, i, j;
+	uint64_t key, max;
+	double mean, ops;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:r:t:")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = getnum("elements", optarg, 1, UINT32_MAX / 2);
+			break;
+		case 'r':
+			rounds = getnum("rounds", optarg, 1, 1000000);
+			break;
+		case 't':
+			maxthreads = getnum("threads", optarg, 1,
+			    BENCH_MAXTHREADS);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	elms = calloc(n, sizeof(*elms));
+	if (elms == NULL)
+		err(1, "elements");
+
+	/* the keys 0 to n - 1, shuffled */
+	for (i = 0; i < n; i++)
+		elms[i].e_key = i;
+	for (i = n - 1; i > 0; i--) {
+		j = arc4random_uniform(i + 1);
+		key = elms[i].e_key;
+		elms[i].e_key = elms[j].e_key;
+		elms[j].e_key = key;
+	}
+
+	printf("%7s %6s %12s %10s %10s\n", "threads", "heaps", "Mops/s",
+	    "rank mean", "rank max");
+
+	for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+		ops = throughput(elms, n, rounds, nthreads);
+		rank_error(elms, n, nthreads, &mean, &max);
+
+		printf("%7u %6u %12.2f %10.1f %10llu\n", nthreads,
+		    nthreads * 2, ops / 1e6, mean, (unsigned long long)max);
+	}
+
+	free(elms);
+
+	return (0);
+}
@@ -41,6 +41,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <string.h>
+
 #include "bst.h"
 
 static inline struct bst_entry *
@@ -59,31 +61,161 @@ bst_e2n(const struct bst_type *t, struct bst_entry *e)
 	return ((void *)(addr - t->t_offset));
 }
 
-#define BST_CHILD(_bse, _c)	(_bse)->bst_children[(_c)]
+#ifdef BST_STATS
+static inline struct bst_counters *
+bst_stats(const struct bst_type *t)
+{
+	unsigned int idx = _bst_stats_idx;
+
+	if (t->t_stats == NULL)
+		return (NULL);
+	if (idx == 0)
+		idx = _bst_stats_assign();
+
+	return (&t->t_stats->bs_slots[idx - 1].bss_counters);
+}
+
+/* only the thread that a slot belongs to adds to it */
+#define BST_STATS_ADD(_t, _c, _n) do {					\
+	struct bst_counters *_bstc = bst_stats(_t);			\
+	uint64_t *_v;							\
+	if (_bstc != NULL) {						\
+		_v = &_bstc->_c;					\
+		__atomic_store_n(_v,					\
+		    __atomic_load_n(_v, __ATOMIC_RELAXED) + (_n),	\
+		    __ATOMIC_RELAXED);					\
+	}								\
+} while (0)
+#else
+#define BST_STATS_ADD(_t, _c, _n)	do { } while (0)
+#endif
+
+/*
+ * The links between entries are only read and written via these
+ * macros. When BST_RELATIVE is defined this file is built for trees
+ * that store self-relative offsets instead of pointers (see bstr.c),
+ * where an offset of 0 is used as NULL.
+ */
+
+#ifdef BST_RELATIVE
+static inline struct bst_entry *
+bst_link_get(const long *link)
+{
+	unsigned long addr = (unsigned long)link;
+
+	if (*link == 0)
+		return (NULL);
+
+	return ((struct bst_entry *)(addr + *link));
+}
+
+static inline void
+bst_link_set(long *link, const struct bst_entry *bste)
+{
+	unsigned long addr = (unsigned long)link;
+
+	*link = (bste == NULL) ? 0 : (long)((unsigned long)bste - addr);
+}
+
+#define BST_LINK(_l)		bst_link_get(&(_l))
+#define BST_SET_LINK(_l, _e)	bst_link_set(&(_l), (_e))
+#define BST_LINK_POISON(_p)	((long)(_p))
+#else
+#define BST_LINK(_l)		(_l)
+#define BST_SET_LINK(_l, _e)	((_l) = (_e))
+#define BST_LINK_POISON(_p)	((struct bst_entry *)(_p))
+#endif
+
+#define BST_CHILD(_bse, _c)	BST_LINK((_bse)->bst_children[(_c)])
 #define BST_LEFT(_bse)		BST_CHILD((_bse), 0)
 #define BST_RIGHT(_bse)		BST_CHILD((_bse), 1)
-#define BST_PARENT(_bse)	(_bse)->bst_parent
+#define BST_PARENT(_bse)	BST_LINK((_bse)->bst_parent)
 #define BST_DATA(_bse)		(_bse)->bst_data
 
-#define BST_ROOT(_bst)		(_bst)->bst_root
+#define BST_SET_CHILD(_bse, _c, _e)					\
+	BST_SET_LINK((_bse)->bst_children[(_c)], (_e))
+#define BST_SET_LEFT(_bse, _e)	BST_SET_CHILD((_bse), 0, (_e))
+#define BST_SET_RIGHT(_bse, _e)	BST_SET_CHILD((_bse), 1, (_e))
+#define BST_SET_PARENT(_bse, _e) BST_SET_LINK((_bse)->bst_parent, (_e))
+
+#define BST_ROOT(_bst)		BST_LINK((_bst)->bst_root)
+#define BST_SET_ROOT(_bst, _e)	BST_SET_LINK((_bst)->bst_root, (_e))
+
+static inline void
+bst_copy(struct bst_entry *dst, const struct bst_entry *src)
+{
+	BST_SET_PARENT(dst, BST_PARENT(src));
+	BST_SET_LEFT(dst, BST_LEFT(src));
+	BST_SET_RIGHT(dst, BST_RIGHT(src));
+	BST_DATA(dst) = BST_DATA(src);
+}
+
+/*
+ * Trees with a t_prefix function cache a prefix of each key in a
+ * bst_pentry. The prefix of the search key is worked out once, and
+ * the comparison function is only called when it matches the prefix
+ * cached in a node, which saves a trip out to the node for the key.
+ */
+
+#define BST_PREFIX(_bste)	(((struct bst_pentry *)(_bste))->bstp_prefix)
+
+struct bst_key {
+	const void		*k_key;
+	uint64_t		 k_prefix;
+	int			 k_cached;
+};
+
+static inline void
+bst_key(const struct bst_type *t, struct bst_key *k, const void *key)
+{
+	k->k_key = key;
+	k->k_cached = key != NULL && t->t_prefix != NULL;
+	k->k_prefix = k->k_cached ? (*t->t_prefix)(key) : 0;
+}
+
+static inline int
+bst_compare(const struct bst_type *t, const struct bst_key *k,
+    struct bst_entry *bste)
+{
+	uint64_t prefix;
+
+	if (k->k_cached) {
+		prefix = BST_PREFIX(bste);
+		if (k->k_prefix != prefix)
+			return (k->k_prefix < prefix ? -1 : 1);
+	}
+
+	BST_STATS_ADD(t, bstc_compares, 1);
+	return ((*t->t_compare)(k->k_key, bst_e2n(t, bste)));
+}
+
+/* fills in the cached prefix before a node goes into the tree */
+static inline void
+bst_set_prefix(const struct bst_type *t, struct bst_entry *bste)
+{
+	if (t->t_prefix != NULL)
+		BST_PREFIX(bste) = (*t->t_prefix)(bst_e2n(t, bste));
+}
 
 /* Finds the node with the same key as elm */
 void *
 _bst_find(const struct bst_type *t, struct bstree *bst, const void *key)
 {
 	struct bst_entry *tmp = BST_ROOT(bst);
-	void *node;
+	struct bst_key k;
 	int comp;
 
+	bst_key(t, &k, key);
+	BST_STATS_ADD(t, bstc_descents, 1);
 	while (tmp != NULL) {
-		node = bst_e2n(t, tmp);
-		comp = (*t->t_compare)(key, node);
+		BST_STATS_ADD(t, bstc_depth, 1);
+		comp = bst_compare(t, &k, tmp);
 		if (comp < 0)
 			tmp = BST_LEFT(tmp);
 		else if (comp > 0)
 			tmp = BST_RIGHT(tmp);
 		else
-			return (node);
+			return (bst_e2n(t, tmp));
 	}
 
 	return (NULL);
@@ -94,13 +226,17 @@ void *
 _bst_nfind(const struct bst_type *t, struct bstree *bst, const void *key)
 {
 	struct bst_entry *tmp = BST_ROOT(bst);
+	struct bst_key k;
 	void *node;
 	void *res = NULL;
 	int comp;
 
+	bst_key(t, &k, key);
+	BST_STATS_ADD(t, bstc_descents, 1);
 	while (tmp != NULL) {
+		BST_STATS_ADD(t, bstc_depth, 1);
 		node = bst_e2n(t, tmp);
-		comp = (*t->t_compare)(key, node);
+		comp = bst_compare(t, &k, tmp);
 		if (comp < 0) {
 			res = node;
 			tmp = BST_LEFT(tmp);
@@ -113,6 +249,161 @@ _bst_nfind(const struct bst_type *t, struct bstree *bst, const void *key)
 	return (res);
 }
 
+/* Finds the first (leftmost) node with the same key */
+void *
+_bst_find_first(const struct bst_type *t, struct bstree *bst, const void *key)
+{
+	struct bst_entry *tmp = BST_ROOT(bst);
+	struct bst_key k;
+	void *node;
+	void *res = NULL;
+	int comp;
+
+	bst_key(t, &k, key);
+	BST_STATS_ADD(t, bstc_descents, 1);
+	while (tmp != NULL) {
+		BST_STATS_ADD(t, bstc_depth, 1);
+		node = bst_e2n(t, tmp);
+		comp = bst_compare(t, &k, tmp);
+		if (comp > 0)
+			tmp = BST_RIGHT(tmp);
+		else {
+			if (comp == 0)
+				res = node;
+			tmp = BST_LEFT(tmp);
+		}
+	}
+
+	return (res);
+}
+
+/* Finds the last (rightmost) node with the same key */
+void *
+_bst_find_last(const struct bst_type *t, struct bstree *bst, const void *key)
+{
+	struct bst_entry *tmp = BST_ROOT(bst);
+	struct bst_key k;
+	void *node;
+	void *res = NULL;
+	int comp;
+
+	bst_key(t, &k, key);
+	BST_STATS_ADD(t, bstc_descents, 1);
+	while (tmp != NULL) {
+		BST_STATS_ADD(t, bstc_depth, 1);
+		node = bst_e2n(t, tmp);
+		comp = bst_compare(t, &k, tmp);
+		if (comp < 0)
+			tmp = BST_LEFT(tmp);
+		else {
+			if (comp == 0)
+				res = node;
+			tmp = BST_RIGHT(tmp);
+		}
+	}
+
+	return (res);
+}
+
+/* Counts the nodes with the same key */
+size_t
+_bst_count(const struct bst_type *t, struct bstree *bst, const void *key)
+{
+	struct bst_key k;
+	void *node;
+	size_t n = 0;
+
+	bst_key(t, &k, key);
+	node = _bst_find_first(t, bst, key);
+	while (node != NULL && bst_compare(t, &k, bst_n2e(t, node)) == 0) {
+		n++;
+		node = _bst_next(t, node);
+	}
+
+	return (n);
+}
+
+/*
+ * Finds where a node with a duplicate key would be attached, which is
+ * after (to the right of) every node with the same key.
+ */
+static inline void
+bst_descend_multi(const struct bst_type *t, struct bstree *bst,
+    const void *key, struct bst_entry **parentp, int *compp)
+{
+	struct bst_entry *tmp = BST_ROOT(bst);
+	struct bst_entry *parent = NULL;
+	struct bst_key k;
+	int comp = 0;
+
+	bst_key(t, &k, key);
+	BST_STATS_ADD(t, bstc_descents, 1);
+	while (tmp != NULL) {
+		BST_STATS_ADD(t, bstc_depth, 1);
+		parent = tmp;
+
+		comp = bst_compare(t, &k, tmp) >= 0;
+		tmp = BST_CHILD(tmp, comp);
+	}
+
+	*parentp = parent;
+	*compp = comp;
+}
+
+/*
+ * Finds the node with the same key, or if there isn't one, the parent
+ * and side that a node with that key would be attached to.
+ */
+static inline struct bst_entry *
+bst_descend(const struct bst_type *t, struct bstree *bst, const void *key,
+    struct bst_entry **parentp, int *compp)
+{
+	struct bst_entry *tmp = BST_ROOT(bst);
+	struct bst_entry *parent = NULL;
+	struct bst_key k;
+	int comp = 0;
+
+	bst_key(t, &k, key);
+	BST_STATS_ADD(t, bstc_descents, 1);
+	while (tmp != NULL) {
+		BST_STATS_ADD(t, bstc_depth, 1);
+		parent = tmp;
+
+		comp = bst_compare(t, &k, tmp);
+		if (comp == 0)
+			return (tmp);
+
+		comp = comp > 0;
+		tmp = BST_CHILD(tmp, comp);
+	}
+
+	*parentp = parent;
+	*compp = comp;
+
+	return (NULL);
+}
+
+/* puts nbste in the place of obste in the tree */
+static inline void
+bst_replace(struct bstree *bst, struct bst_entry *obste,
+    struct bst_entry *nbste)
+{
+	struct bst_entry *parent, *child;
+
+	bst_copy(nbste, obste);
+
+	parent = BST_PARENT(nbste);
+	if (parent != NULL)
+		BST_SET_CHILD(parent, BST_RIGHT(parent) == obste, nbste);
+	else
+		BST_SET_ROOT(bst, nbste);
+
+	if ((child = BST_LEFT(nbste)) != NULL)
+		BST_SET_PARENT(child, nbste);
+	if ((child = BST_RIGHT(nbste)) != NULL)
+		BST_SET_PARENT(child, nbste);
+}
+
 void *
 _bst_next(const struct bst_type *t, void *elm)
 {
@@ -227,7 +518,7 @@ _bst_set_left(const struct bst_type *t, void *node, void *left)
 	struct bst_entry *bste = bst_n2e(t, node);
 	struct bst_entry *bstl = (left == NULL) ? NULL : bst_n2e(t, left);
 
-	BST_LEFT(bste) = bstl;
+	BST_SET_LEFT(bste, bstl);
 }
 
 void
@@ -236,7 +527,7 @@ _bst_set_right(const struct bst_type *t, void *node, void *right)
 	struct bst_entry *bste = bst_n2e(t, node);
 	struct bst_entry *bstr = (right == NULL) ? NULL : bst_n2e(t, right);
 
-	BST_RIGHT(bste) = bstr;
+	BST_SET_RIGHT(bste, bstr);
 }
 
 void
@@ -245,7 +536,7 @@ _bst_set_parent(const struct bst_type *t, void *node, void *parent)
 	struct bst_entry *bste = bst_n2e(t, node);
 	struct bst_entry *bstp = (parent == NULL) ? NULL : bst_n2e(t, parent);
 
-	BST_PARENT(bste) = bstp;
+	BST_SET_PARENT(bste, bstp);
 }
 
 void
@@ -253,8 +544,8 @@ _bst_poison(const struct bst_type *t, void *node, unsigned long poison)
 {
 	struct bst_entry *bste = bst_n2e(t, node);
 
-	BST_PARENT(bste) = BST_LEFT(bste) = BST_RIGHT(bste) =
-	    (struct bst_entry *)poison;
+	bste->bst_parent = bste->bst_children[0] = bste->bst_children[1] =
+	    BST_LINK_POISON(poison);
 }
 
 int
@@ -262,9 +553,461 @@ _bst_check(const struct bst_type *t, void *node, unsigned long poison)
 {
 	struct bst_entry *bste = bst_n2e(t, node);
 
-	return ((unsigned long)BST_PARENT(bste) == poison &&
-	    (unsigned long)BST_LEFT(bste) == poison &&
-	    (unsigned long)BST_RIGHT(bste) == poison);
+	/* the poison is stored as is, not as a link */
+	return (bste->bst_parent == BST_LINK_POISON(poison) &&
+	    bste->bst_children[0] == BST_LINK_POISON(poison) &&
+	    bste->bst_children[1] == BST_LINK_POISON(poison));
+}
+
+/*
+ * In-order iteration with an explicit stack.
+ *
+ * The stack holds the nodes whose left subtrees are being (or have
+ * been) visited but which have not been visited themselves yet. The
+ * right child of each node is prefetched as it is pushed, so it is
+ * likely to be cached by the time the node is popped and its right
+ * subtree is descended.
+ */
+
+#define bst_prefetch(_bste)	__builtin_prefetch(_bste)
+
+static inline void
+bst_iter_push(struct bst_iter *it, struct bst_entry *bste)
+{
+	while (bste != NULL) {
+		bst_prefetch(BST_RIGHT(bste));
+		it->bsti_stack[it->bsti_depth++] = bste;
+		bste = BST_LEFT(bste);
+	}
+}
+
+void
+_bst_iter_init(struct bstree *bst, struct bst_iter *it)
+{
+	it->bsti_hi = NULL;
+	it->bsti_once = 0;
+	it->bsti_depth = 0;
+	bst_iter_push(it, BST_ROOT(bst));
+}
+
+/* iterate over the nodes between lo and hi inclusive. NULL is unbounded */
+void
+_bst_iter_range(const struct bst_type *t, struct bstree *bst,
+    struct bst_iter *it, const void *lo, const void *hi)
+{
+	struct bst_entry *tmp = BST_ROOT(bst);
+	struct bst_key k;
+	int comp;
+
+	it->bsti_hi = hi;
+	it->bsti_once = 0;
+	it->bsti_depth = 0;
+
+	if (lo == NULL) {
+		bst_iter_push(it, tmp);
+		return;
+	}
+
+	/*
+	 * this is _bst_nfind, but it remembers the path it took. it keeps
+	 * going left past nodes equal to lo so the stack holds every node
+	 * that is not less than lo.
+	 */
+	bst_key(t, &k, lo);
+	BST_STATS_ADD(t, bstc_descents, 1);
+	while (tmp != NULL) {
+		BST_STATS_ADD(t, bstc_depth, 1);
+		comp = bst_compare(t, &k, tmp);
+		if (comp > 0) {
+			tmp = BST_RIGHT(tmp);
+			continue;
+		}
+
+		it->bsti_stack[it->bsti_depth++] = tmp;
+		tmp = BST_LEFT(tmp);
+	}
+}
+
+/* returns the number of nodes written to elms. 0 means it is finished */
+unsigned int
+_bst_iter_fill(const struct bst_type *t, struct bst_iter *it,
+    void **elms, unsigned int nelms)
+{
+	struct bst_entry *bste;
+	struct bst_key k;
+	unsigned int n;
+
+	if (it->bsti_once) {
+		if (nelms == 0 || it->bsti_depth == 0)
+			return (0);
+
+		it->bsti_once = 0;
+		it->bsti_depth = 0;
+		elms[0] = bst_e2n(t, it->bsti_stack[0]);
+		return (1);
+	}
+
+	bst_key(t, &k, it->bsti_hi);
+	for (n = 0; n < nelms && it->bsti_depth > 0; n++) {
+		bste = it->bsti_stack[--it->bsti_depth];
+
+		if (it->bsti_hi != NULL && bst_compare(t, &k, bste) < 0) {
+			it->bsti_depth = 0;
+			break;
+		}
+
+		bst_iter_push(it, BST_RIGHT(bste));
+		elms[n] = bst_e2n(t, bste);
+	}
+
+	return (n);
+}
+
+#define BST_WALK_BATCH		64
+
+int
+_bst_walk(const struct bst_type *t, struct bstree *bst,
+    const void *lo, const void *hi,
+    int (*fn)(void *, void **, unsigned int), void *arg)
+{
+	struct bst_iter it;
+	void *elms[BST_WALK_BATCH];
+	unsigned int n;
+	int rv;
+
+	_bst_iter_range(t, bst, &it, lo, hi);
+
+	while ((n = _bst_iter_fill(t, &it, elms, BST_WALK_BATCH)) > 0) {
+		rv = (*fn)(arg, elms, n);
+		if (rv != 0)
+			return (rv);
+	}
+
+	return (0);
+}
+
+/*
+ * Splitting a tree into units of work.
+ *
+ * The units are produced in order, so walking them one after the other
+ * visits the same nodes in the same order as walking the whole tree.
+ * The heaviest subtree is repeatedly replaced with its left subtree,
+ * its root on its own, and its right subtree until the units run out.
+ * If weight is NULL the tree is assumed to be balanced, so each child
+ * is estimated to be half the weight of its parent.
+ */
+
+static inline unsigned long
+bst_weight(const struct bst_type *t, struct bst_entry *bste,
+    unsigned long (*weight)(const void *), unsigned long pweight)
+{
+	if (weight == NULL)
+		return (pweight >> 1);
+
+	return ((*weight)(bst_e2n(t, bste)));
+}
+
+unsigned int
+_bst_split(const struct bst_type *t, struct bstree *bst,
+    struct bst_unit *units, unsigned int nunits,
+    unsigned long (*weight)(const void *))
+{
+	struct bst_unit *u;
+	struct bst_entry *bste, *l, *r;
+	unsigned long w;
+	unsigned int n, i, heavy;
+
+	bste = BST_ROOT(bst);
+	if (bste == NULL || nunits == 0)
+		return (0);
+
+	units[0].bstu_root = bste;
+	units[0].bstu_weight = bst_weight(t, bste, weight, ~0UL);
+	units[0].bstu_subtree = 1;
+	n = 1;
+
+	while (n + 2 <= nunits) {
+		heavy = n;
+		w = 1;
+		for (i = 0; i < n; i++) {
+			u = &units[i];
+			if (u->bstu_subtree && u->bstu_weight > w) {
+				heavy = i;
+				w = u->bstu_weight;
+			}
+		}
+		if (heavy == n)
+			break;
+
+		u = &units[heavy];
+		bste = u->bstu_root;
+		l = BST_LEFT(bste);
+		r = BST_RIGHT(bste);
+		if (l == NULL && r == NULL) {
+			u->bstu_subtree = 0;
+			continue;
+		}
+
+		/* make room for the children around this node */
+		i = (l != NULL) + (r != NULL);
+		memmove(u + 1 + i, u + 1, (n - heavy - 1) * sizeof(*u));
+		n += i;
+
+		if (l != NULL) {
+			u->bstu_root = l;
+			u->bstu_weight = bst_weight(t, l, weight, w);
+			u->bstu_subtree = 1;
+			u++;
+		}
+
+		u->bstu_root = bste;
+		u->bstu_weight = 1;
+		u->bstu_subtree = 0;
+
+		if (r != NULL) {
+			u++;
+			u->bstu_root = r;
+			u->bstu_weight = bst_weight(t, r, weight, w);
+			u->bstu_subtree = 1;
+		}
+	}
+
+	return (n);
+}
+
+void
+_bst_iter_unit(struct bst_iter *it, const struct bst_unit *u)
+{
+	it->bsti_hi = NULL;
+	it->bsti_depth = 0;
+
+	if (u->bstu_subtree) {
+		it->bsti_once = 0;
+		bst_iter_push(it, u->bstu_root);
+	} else {
+		/* equal keys rule out a bound, so stop after the node itself */
+		it->bsti_once = 1;
+		it->bsti_stack[it->bsti_depth++] = u->bstu_root;
+	}
+}
+
+/*
+ * Building a tree from elements that are already in order.
+ *
+ * The elements are taken from the next callback one at a time and
+ * placed with an in-order recursion over the number of elements, so
+ * no comparisons are needed and only the current path is kept on the
+ * stack. Splitting each range in half means every empty link is at
+ * the same depth, or one level deeper than the rest.
+ */
+
+struct bst_build {
+	const struct bst_type	 *b_type;
+	void			*(*b_next)(void *);
+	void			 *b_arg;
+	void			(*b_node)(const struct bst_build *,
+				    struct bst_entry *, size_t, size_t,
+				    unsigned int);
+	void			(*b_augment)(void *);
+	unsigned int		  b_depth;	/* depth of the bottom row */
+};
+
+static inline unsigned int
+bst_height(size_t n)
+{
+	unsigned int h = 0;
+
+	while (n > 0) {
+		n >>= 1;
+		h++;
+	}
+
+	return (h);
+}
+
+static struct bst_entry *
+bst_build(struct bst_build *b, size_t n, unsigned int depth)
+{
+	struct bst_entry *bste, *l, *r;
+	size_t ln, rn;
+
+	if (n == 0)
+		return (NULL);
+
+	ln = (n - 1) / 2;
+	rn = n - 1 - ln;
+
+	l = bst_build(b, ln, depth + 1);
+	bste = bst_n2e(b->b_type, (*b->b_next)(b->b_arg));
+	bst_set_prefix(b->b_type, bste);
+	r = bst_build(b, rn, depth + 1);
+
+	BST_SET_LEFT(bste, l);
+	if (l != NULL)
+		BST_SET_PARENT(l, bste);
+	BST_SET_RIGHT(bste, r);
+	if (r != NULL)
+		BST_SET_PARENT(r, bste);
+
+	(*b->b_node)(b, bste, ln, rn, depth);
+
+	return (bste);
+}
+
+static void
+bst_build_tree(struct bst_build *b, struct bstree *bst, size_t n)
+{
+	struct bst_entry *root;
+
+	b->b_depth = bst_height(n) - 1;
+
+	root = bst_build(b, n, 0);
+	if (root != NULL)
+		BST_SET_PARENT(root, NULL);
+
+	BST_SET_ROOT(bst, root);
+}
+
+/*
+ * Relocating the elements in a tree.
+ *
+ * The move callback copies an element to its new home and returns
+ * the new address, after which the links in and around the copy are
+ * fixed up. Elements are handed to the callback either a level at a
+ * time (BST_RELOCATE_BFS) or in van Emde Boas order (BST_RELOCATE_VEB),
+ * so a callback that allocates sequentially lays the tree out in that
+ * order. Parents are always moved before their children.
+ *
+ * The tree is valid between each move, but must not be used by
+ * anything else until _bst_relocate returns.
+ */
+
+struct bst_reloc {
+	const struct bst_type	 *r_type;
+	struct bstree		 *r_tree;
+	void			*(*r_move)(void *, void *);
+	void			 *r_arg;
+};
+
+static void	bst_reloc_veb(struct bst_reloc *, struct bst_entry *,
+		    unsigned int);
+
+static unsigned int
+bst_depth(struct bst_entry *bste)
+{
+	unsigned int l, r;
+
+	if (bste == NULL)
+		return (0);
+
+	l = bst_depth(BST_LEFT(bste));
+	r = bst_depth(BST_RIGHT(bste));
+
+	return (1 + (l > r ? l : r));
+}
+
+static struct bst_entry *
+bst_reloc_move(struct bst_reloc *r, struct bst_entry *bste)
+{
+	const struct bst_type *t = r->r_type;
+	struct bst_entry *parent, *left, *right;
+	struct bst_entry *nbste;
+
+	parent = BST_PARENT(bste);
+	left = BST_LEFT(bste);
+	right = BST_RIGHT(bste);
+
+	nbste = bst_n2e(t, (*r->r_move)(r->r_arg, bst_e2n(t, bste)));
+
+	/* the copy may not have links that are valid at its new address */
+	BST_SET_PARENT(nbste, parent);
+	BST_SET_LEFT(nbste, left);
+	BST_SET_RIGHT(nbste, right);
+
+	if (parent == NULL)
+		BST_SET_ROOT(r->r_tree, nbste);
+	else
+		BST_SET_CHILD(parent, BST_RIGHT(parent) == bste, nbste);
+	if (left != NULL)
+		BST_SET_PARENT(left, nbste);
+	if (right != NULL)
+		BST_SET_PARENT(right, nbste);
+
+	return (nbste);
+}
+
+/*
+ * lay out the subtrees of height h that are depth levels below bste,
+ * from left to right. a height of 1 moves just those nodes.
+ */
+static void
+bst_reloc_level(struct bst_reloc *r, struct bst_entry *bste,
+    unsigned int depth, unsigned int h)
+{
+	if (bste == NULL)
+		return;
+
+	if (depth == 0) {
+		bst_reloc_veb(r, bste, h);
+		return;
+	}
+
+	bst_reloc_level(r, BST_LEFT(bste), depth - 1, h);
+	bst_reloc_level(r, BST_RIGHT(bste), depth - 1, h);
+}
+
+static void
+bst_reloc_veb(struct bst_reloc *r, struct bst_entry *bste, unsigned int h)
+{
+	struct bst_entry *parent;
+	unsigned int top;
+	int side = 0;
+
+	if (h <= 1) {
+		bst_reloc_move(r, bste);
+		return;
+	}
+
+	/* lay out the top half of the subtree, then each bottom subtree */
+	top = h / 2;
+
+	parent = BST_PARENT(bste);
+	if (parent != NULL)
+		side = BST_RIGHT(parent) == bste;
+
+	bst_reloc_veb(r, bste, top);
+
+	bste = (parent == NULL) ? BST_ROOT(r->r_tree) :
+	    BST_CHILD(parent, side);
+	bst_reloc_level(r, bste, top, h - top);
+}
+
+void
+_bst_relocate(const struct bst_type *t, struct bstree *bst,
+    unsigned int order, void *(*move)(void *, void *), void *arg)
+{
+	struct bst_reloc r = {
+		.r_type = t,
+		.r_tree = bst,
+		.r_move = move,
+		.r_arg = arg,
+	};
+	unsigned int h, d;
+
+	h = bst_depth(BST_ROOT(bst));
+	if (h == 0)
+		return;
+
+	switch (order) {
+	case BST_RELOCATE_VEB:
+		bst_reloc_veb(&r, BST_ROOT(bst), h);
+		break;
+	case BST_RELOCATE_BFS:
+	default:
+		for (d = 0; d < h; d++)
+			bst_reloc_level(&r, BST_ROOT(bst), d, 1);
+		break;
+	}
 }
 
 /*
@@ -292,13 +1035,20 @@ rbt_e2n(const struct rbt_type *t, struct bst_entry *rbe)
 #define RBE_PARENT(_rbe)	BST_PARENT(_rbe)
 #define RBE_COLOR(_rbe)		BST_DATA(_rbe)
 
+#define RBE_SET_CHILD(_rbe, _c, _e) BST_SET_CHILD((_rbe), (_c), (_e))
+#define RBE_SET_LEFT(_rbe, _e)	BST_SET_LEFT((_rbe), (_e))
+#define RBE_SET_RIGHT(_rbe, _e)	BST_SET_RIGHT((_rbe), (_e))
+#define RBE_SET_PARENT(_rbe, _e) BST_SET_PARENT((_rbe), (_e))
+
 #define RBH_ROOT(_rbt)		BST_ROOT(_rbt)
+#define RBH_SET_ROOT(_rbt, _e)	BST_SET_ROOT((_rbt), (_e))
 
 static inline void
 rbe_set(struct bst_entry *rbe, struct bst_entry *parent)
 {
-	RBE_PARENT(rbe) = parent;
-	RBE_LEFT(rbe) = RBE_RIGHT(rbe) = NULL;
+	RBE_SET_PARENT(rbe, parent);
+	RBE_SET_LEFT(rbe, NULL);
+	RBE_SET_RIGHT(rbe, NULL);
 	RBE_COLOR(rbe) = RBE_RED;
 }
 
@@ -312,6 +1062,7 @@ rbe_set_blackred(struct bst_entry *black, struct bst_entry *red)
 static inline void
 rbe_augment(const struct rbt_type *t, struct bst_entry *rbe)
 {
+	BST_STATS_ADD(&t->t_bst, bstc_augments, 1);
 	(*t->t_augment)(rbt_e2n(t, rbe));
 }
 
@@ -329,23 +1080,25 @@ rbe_rotate_left(const struct rbt_type *t, struct bstree *rbt,
 	struct bst_entry *parent;
 	struct bst_entry *tmp;
 
+	BST_STATS_ADD(&t->t_bst, bstc_rotations, 1);
+
 	tmp = RBE_RIGHT(rbe);
-	RBE_RIGHT(rbe) = RBE_LEFT(tmp);
+	RBE_SET_RIGHT(rbe, RBE_LEFT(tmp));
 	if (RBE_RIGHT(rbe) != NULL)
-		RBE_PARENT(RBE_LEFT(tmp)) = rbe;
+		RBE_SET_PARENT(RBE_LEFT(tmp), rbe);
 
 	parent = RBE_PARENT(rbe);
-	RBE_PARENT(tmp) = parent;
+	RBE_SET_PARENT(tmp, parent);
 	if (parent != NULL) {
 		if (rbe == RBE_LEFT(parent))
-			RBE_LEFT(parent) = tmp;
+			RBE_SET_LEFT(parent, tmp);
 		else
-			RBE_RIGHT(parent) = tmp;
+			RBE_SET_RIGHT(parent, tmp);
 	} else
-		RBH_ROOT(rbt) = tmp;
+		RBH_SET_ROOT(rbt, tmp);
 
-	RBE_LEFT(tmp) = rbe;
-	RBE_PARENT(rbe) = tmp;
+	RBE_SET_LEFT(tmp, rbe);
+	RBE_SET_PARENT(rbe, tmp);
 
 	if (t->t_augment != NULL) {
 		rbe_augment(t, rbe);
@@ -363,23 +1116,25 @@ rbe_rotate_right(const struct rbt_type *t, struct bstree *rbt,
 	struct bst_entry *parent;
 	struct bst_entry *tmp;
 
+	BST_STATS_ADD(&t->t_bst, bstc_rotations, 1);
+
 	tmp = RBE_LEFT(rbe);
-	RBE_LEFT(rbe) = RBE_RIGHT(tmp);
+	RBE_SET_LEFT(rbe, RBE_RIGHT(tmp));
 	if (RBE_LEFT(rbe) != NULL)
-		RBE_PARENT(RBE_RIGHT(tmp)) = rbe;
+		RBE_SET_PARENT(RBE_RIGHT(tmp), rbe);
 
 	parent = RBE_PARENT(rbe);
-	RBE_PARENT(tmp) = parent;
+	RBE_SET_PARENT(tmp, parent);
 	if (parent != NULL) {
 		if (rbe == RBE_LEFT(parent))
-			RBE_LEFT(parent) = tmp;
+			RBE_SET_LEFT(parent, tmp);
 		else
-			RBE_RIGHT(parent) = tmp;
+			RBE_SET_RIGHT(parent, tmp);
 	} else
-		RBH_ROOT(rbt) = tmp;
+		RBH_SET_ROOT(rbt, tmp);
 
-	RBE_RIGHT(tmp) = rbe;
-	RBE_PARENT(rbe) = tmp;
+	RBE_SET_RIGHT(tmp, rbe);
+	RBE_SET_PARENT(rbe, tmp);
 
 	if (t->t_augment != NULL) {
 		rbe_augment(t, rbe);
@@ -398,6 +1153,7 @@ rbe_insert_color(const struct rbt_type *t, struct bstree *rbt,
 
 	while ((parent = RBE_PARENT(rbe)) != NULL &&
 	    RBE_COLOR(parent) == RBE_RED) {
+		BST_STATS_ADD(&t->t_bst, bstc_retraces, 1);
 		gparent = RBE_PARENT(parent);
 
 		if (parent == RBE_LEFT(gparent)) {
@@ -450,6 +1206,7 @@ rbe_remove_color(const struct rbt_type *t, struct bstree *rbt,
 
 	while ((rbe == NULL || RBE_COLOR(rbe) == RBE_BLACK) &&
 	    rbe != RBH_ROOT(rbt)) {
+		BST_STATS_ADD(&t->t_bst, bstc_retraces, 1);
 		if (RBE_LEFT(parent) == rbe) {
 			tmp = RBE_RIGHT(parent);
 			if (RBE_COLOR(tmp) == RBE_RED) {
@@ -553,34 +1310,34 @@ rbe_remove(const struct rbt_type *t, struct bstree *rbt, struct bst_entry *rbe)
 		parent = RBE_PARENT(rbe);
 		color = RBE_COLOR(rbe);
 		if (child != NULL)
-			RBE_PARENT(child) = parent;
+			RBE_SET_PARENT(child, parent);
 		if (parent != NULL) {
 			if (RBE_LEFT(parent) == rbe)
-				RBE_LEFT(parent) = child;
+				RBE_SET_LEFT(parent, child);
 			else
-				RBE_RIGHT(parent) = child;
+				RBE_SET_RIGHT(parent, child);
 
 			rbe_if_augment(t, parent);
 		} else
-			RBH_ROOT(rbt) = child;
+			RBH_SET_ROOT(rbt, child);
 		if (RBE_PARENT(rbe) == old)
 			parent = rbe;
-		*rbe = *old;
+		bst_copy(rbe, old);
 
 		tmp = RBE_PARENT(old);
 		if (tmp != NULL) {
 			if (RBE_LEFT(tmp) == old)
-				RBE_LEFT(tmp) = rbe;
+				RBE_SET_LEFT(tmp, rbe);
 			else
-				RBE_RIGHT(tmp) = rbe;
+				RBE_SET_RIGHT(tmp, rbe);
 
 			rbe_if_augment(t, tmp);
 		} else
-			RBH_ROOT(rbt) = rbe;
+			RBH_SET_ROOT(rbt, rbe);
 
-		RBE_PARENT(RBE_LEFT(old)) = rbe;
+		RBE_SET_PARENT(RBE_LEFT(old), rbe);
 		if (RBE_RIGHT(old))
-			RBE_PARENT(RBE_RIGHT(old)) = rbe;
+			RBE_SET_PARENT(RBE_RIGHT(old), rbe);
 
 		if (t->t_augment != NULL && parent != NULL) {
 			tmp = parent;
@@ -597,16 +1354,16 @@ rbe_remove(const struct rbt_type *t, struct bstree *rbt, struct bst_entry *rbe)
 	color = RBE_COLOR(rbe);
 
 	if (child != NULL)
-		RBE_PARENT(child) = parent;
+		RBE_SET_PARENT(child, parent);
 	if (parent != NULL) {
 		if (RBE_LEFT(parent) == rbe)
-			RBE_LEFT(parent) = child;
+			RBE_SET_LEFT(parent, child);
 		else
-			RBE_RIGHT(parent) = child;
+			RBE_SET_RIGHT(parent, child);
 
 		rbe_if_augment(t, parent);
 	} else
-		RBH_ROOT(rbt) = child;
+		RBH_SET_ROOT(rbt, child);
 color:
 	if (color == RBE_BLACK)
 		rbe_remove_color(t, rbt, parent, child);
@@ -625,38 +1382,165 @@ _rbt_remove(const struct rbt_type *t, struct bstree *rbt, void *elm)
 	return (old == NULL ? NULL : rbt_e2n(t, old));
 }
 
+static inline void
+rbe_insert_at(const struct rbt_type *t, struct bstree *rbt,
+    struct bst_entry *rbe, struct bst_entry *parent, int comp)
+{
+	bst_set_prefix(&t->t_bst, rbe);
+	rbe_set(rbe, parent);
+
+	if (parent != NULL) {
+		RBE_SET_CHILD(parent, comp, rbe);
+		rbe_if_augment(t, parent);
+	} else
+		RBH_SET_ROOT(rbt, rbe);
+
+	rbe_insert_color(t, rbt, rbe);
+}
+
 void *
 _rbt_insert(const struct rbt_type *t, struct bstree *rbt, void *elm)
 {
 	struct bst_entry *rbe = rbt_n2e(t, elm);
 	struct bst_entry *tmp;
-	struct bst_entry *parent = NULL;
-	void *node;
-	int comp = 0;
+	struct bst_entry *parent;
+	int comp;
 
-	tmp = RBH_ROOT(rbt);
-	while (tmp != NULL) {
-		parent = tmp;
+	tmp = bst_descend(&t->t_bst, rbt, elm, &parent, &comp);
+	if (tmp != NULL)
+		return (rbt_e2n(t, tmp));
 
-		node = rbt_e2n(t, tmp);
-		comp = (*t->t_bst.t_compare)(elm, node);
-		if (comp == 0)
- 			return (node);
-		comp = comp > 0;
-		tmp = RBE_CHILD(tmp, comp);
+	rbe_insert_at(t, rbt, rbe, parent, comp);
+
+	return (NULL);
+}
+
+/* inserts elm after any nodes with the same key */
+void
+_rbt_insert_multi(const struct rbt_type *t, struct bstree *rbt, void *elm)
+{
+	struct bst_entry *parent;
+	int comp;
+
+	bst_descend_multi(&t->t_bst, rbt, elm, &parent, &comp);
+	rbe_insert_at(t, rbt, rbt_n2e(t, elm), parent, comp);
+}
+
+/*
+ * links elm in as the child of parent on the side given by comp, or as
+ * the root if parent is NULL, for callers that did their own descent.
+ */
+void
+_rbt_insert_at(const struct rbt_type *t, struct bstree *rbt, void *elm,
+    void *parent, int comp)
+{
+	rbe_insert_at(t, rbt, rbt_n2e(t, elm),
+	    parent == NULL ? NULL : rbt_n2e(t, parent), comp);
+}
+
+/* removes and returns the node with the same key, if there is one */
+void *
+_rbt_delete_key(const struct rbt_type *t, struct bstree *rbt, const void *key)
+{
+	struct bst_entry *rbe;
+	struct bst_entry *parent;
+	int comp;
+
+	rbe = bst_descend(&t->t_bst, rbt, key, &parent, &comp);
+	if (rbe == NULL)
+		return (NULL);
+
+	rbe_remove(t, rbt, rbe);
+
+	return (rbt_e2n(t, rbe));
+}
+
+/*
+ * returns the node with the same key. if there isn't one, ctor is
+ * called to create it, and the new node is inserted and returned.
+ */
+void *
+_rbt_find_or_insert(const struct rbt_type *t, struct bstree *rbt,
+    const void *key, void *(*ctor)(void *, const void *), void *arg)
+{
+	struct bst_entry *tmp;
+	struct bst_entry *parent;
+	void *elm;
+	int comp;
+
+	tmp = bst_descend(&t->t_bst, rbt, key, &parent, &comp);
+	if (tmp != NULL)
+		return (rbt_e2n(t, tmp));
+
+	elm = (*ctor)(arg, key);
+	if (elm == NULL)
+		return (NULL);
+
+	rbe_insert_at(t, rbt, rbt_n2e(t, elm), parent, comp);
+
+	return (elm);
+}
+
+/*
+ * inserts elm, or puts it in the place of the node with the same key.
+ * the node it replaced is returned.
+ */
+void *
+_rbt_upsert(const struct rbt_type *t, struct bstree *rbt, void *elm)
+{
+	struct bst_entry *rbe = rbt_n2e(t, elm);
+	struct bst_entry *tmp;
+	struct bst_entry *parent;
+	int comp;
+
+	tmp = bst_descend(&t->t_bst, rbt, elm, &parent, &comp);
+	if (tmp == NULL) {
+		rbe_insert_at(t, rbt, rbe, parent, comp);
+		return (NULL);
 	}
 
-	rbe_set(rbe, parent);
+	bst_set_prefix(&t->t_bst, rbe);
+	bst_replace(rbt, tmp, rbe);
 
-	if (parent != NULL) {
-		RBE_CHILD(parent, comp) = rbe;
-		rbe_if_augment(t, parent);
-	} else
-		RBH_ROOT(rbt) = rbe;
+	if (t->t_augment != NULL) {
+		parent = rbe;
+		do {
+			rbe_augment(t, parent);
+			parent = RBE_PARENT(parent);
+		} while (parent != NULL);
+	}
 
-	rbe_insert_color(t, rbt, rbe);
+	return (rbt_e2n(t, tmp));
+}
 
-	return (NULL);
+static void
+rbe_build_node(const struct bst_build *b, struct bst_entry *rbe,
+    __unused size_t ln, __unused size_t rn, unsigned int depth)
+{
+	/* only the bottom row can be incomplete, so it is the red one */
+	RBE_COLOR(rbe) = (depth > 0 && depth == b->b_depth) ?
+	    RBE_RED : RBE_BLACK;
+
+	if (b->b_augment != NULL) {
+		BST_STATS_ADD(b->b_type, bstc_augments, 1);
+		(*b->b_augment)(bst_e2n(b->b_type, rbe));
+	}
+}
+
+/* the next callback must return n elements in order. rbt must be empty */
+void
+_rbt_build(const struct rbt_type *t, struct bstree *rbt, size_t n,
+    void *(*next)(void *), void *arg)
+{
+	struct bst_build b = {
+		.b_type = &t->t_bst,
+		.b_next = next,
+		.b_arg = arg,
+		.b_node = rbe_build_node,
+		.b_augment = t->t_augment,
+	};
+
+	bst_build_tree(&b, rbt, n);
 }
 
 /*
@@ -667,6 +1551,7 @@ _rbt_insert(const struct rbt_type *t, struct bstree *rbt, void *elm)
 #define avl_e2n(_t, _avle)	bst_e2n((_t), (_avle))
 
 #define AVLT_ROOT(_avlt)	BST_ROOT(_avlt)
+#define AVLT_SET_ROOT(_avlt, _e) BST_SET_ROOT((_avlt), (_e))
 
 #define AVLE_CHILD(_avle, _c)	BST_CHILD((_avle), (_c))
 #define AVLE_LEFT(_avle)	BST_LEFT(_avle)
@@ -674,6 +1559,11 @@ _rbt_insert(const struct rbt_type *t, struct bstree *rbt, void *elm)
 #define AVLE_PARENT(_avle)	BST_PARENT(_avle)
 #define AVLE_BALANCE(_avle)	BST_DATA(_avle)
 
+#define AVLE_SET_CHILD(_avle, _c, _e) BST_SET_CHILD((_avle), (_c), (_e))
+#define AVLE_SET_LEFT(_avle, _e) BST_SET_LEFT((_avle), (_e))
+#define AVLE_SET_RIGHT(_avle, _e) BST_SET_RIGHT((_avle), (_e))
+#define AVLE_SET_PARENT(_avle, _e) BST_SET_PARENT((_avle), (_e))
+
 static const int avl_balances[2] = { -1, 1 };
 
 /*
@@ -695,12 +1585,12 @@ avl_rotate(struct bst_entry *avle, int d)
 	child = AVLE_CHILD(avle, !d);
 	gchild = AVLE_CHILD(child, d);
 
-	AVLE_CHILD(child, d) = avle;
-	AVLE_PARENT(avle) = child;
+	AVLE_SET_CHILD(child, d, avle);
+	AVLE_SET_PARENT(avle, child);
 
-	AVLE_CHILD(avle, !d) = gchild;
+	AVLE_SET_CHILD(avle, !d, gchild);
 	if (gchild != NULL)
-		AVLE_PARENT(gchild) = avle;
+		AVLE_SET_PARENT(gchild, avle);
 
 	return (child);
 }
@@ -732,8 +1622,8 @@ avl_rebalance(struct bstree *avlt, struct bst_entry *parent,
 		AVLE_BALANCE(gchild) = 0;
 
 		child = avl_rotate(child, d);
-		AVLE_CHILD(avle, d) = child;
-		AVLE_PARENT(child) = avle;
+		AVLE_SET_CHILD(avle, d, child);
+		AVLE_SET_PARENT(child, avle);
 
 		diff = 1; /* tree is always shorter after double rotation */
 	} else {
@@ -748,51 +1638,48 @@ avl_rebalance(struct bstree *avlt, struct bst_entry *parent,
 	child = avl_rotate(avle, !d);
 	if (parent != NULL) {
 		d = AVLE_RIGHT(parent) == avle;
-		AVLE_CHILD(parent, d) = child;
+		AVLE_SET_CHILD(parent, d, child);
 	} else
-		AVLT_ROOT(avlt) = child;
-	AVLE_PARENT(child) = parent;
+		AVLT_SET_ROOT(avlt, child);
+	AVLE_SET_PARENT(child, parent);
 
 	*avlep = child;
 	return (diff);
 }
 
-void *
-_avl_insert(const struct bst_type *t, struct bstree *avlt, void *elm)
+#ifdef BST_STATS
+/* how many rotations avl_rebalance will do */
+static inline unsigned int
+avl_rotations(struct bst_entry *avle, int balance)
 {
-	struct bst_entry *avle = avl_n2e(t, elm);
-	struct bst_entry *tmp;
-	struct bst_entry *parent = NULL;
- 	void *node;
-	int comp = 0;
- 
-	tmp = AVLT_ROOT(avlt);
- 	while (tmp != NULL) {
-		parent = tmp;
+	int d = balance > 0;
+	int cbalance = AVLE_BALANCE(AVLE_CHILD(avle, d));
 
-		node = avl_e2n(t, tmp);
-		comp = (*t->t_compare)(elm, node);
-		if (comp == 0)
- 			return (node);
- 
-		comp = (comp > 0);
-		tmp = AVLE_CHILD(tmp, comp);
-	}
- 
-	AVLE_PARENT(avle) = parent;
-	AVLE_LEFT(avle) = AVLE_RIGHT(avle) = NULL;
+	return (avl_balances[!d] == cbalance ? 2 : 1);
+}
+#endif
+
+static inline void
+avle_insert_at(const struct bst_type *t, struct bstree *avlt,
+    struct bst_entry *avle, struct bst_entry *parent, int comp)
+{
+	bst_set_prefix(t, avle);
+	AVLE_SET_PARENT(avle, parent);
+	AVLE_SET_LEFT(avle, NULL);
+	AVLE_SET_RIGHT(avle, NULL);
 	AVLE_BALANCE(avle) = 0;
  
 	if (parent == NULL) {
-		AVLT_ROOT(avlt) = avle;
-		return (NULL);
+		AVLT_SET_ROOT(avlt, avle);
+		return;
  	}
  
-	AVLE_CHILD(parent, comp) = avle;
+	AVLE_SET_CHILD(parent, comp, avle);
  
 	for (;;) {
 		int obalance, nbalance;
  
+		BST_STATS_ADD(t, bstc_retraces, 1);
 		avle = parent;
 
 		obalance = AVLE_BALANCE(avle);
@@ -808,6 +1695,8 @@ _avl_insert(const struct bst_type *t, struct bstree *avlt, void *elm)
 
 		/* an existing lean has increased, so rebalance */
 		if (obalance != 0) {
+			BST_STATS_ADD(t, bstc_rotations,
+			    avl_rotations(avle, nbalance));
 			avl_rebalance(avlt, parent, &avle, nbalance);
 			break;
 		}
@@ -819,10 +1708,110 @@ _avl_insert(const struct bst_type *t, struct bstree *avlt, void *elm)
 
 		comp = AVLE_RIGHT(parent) == avle;
 	}
+}
+
+void *
+_avl_insert(const struct bst_type *t, struct bstree *avlt, void *elm)
+{
+	struct bst_entry *tmp;
+	struct bst_entry *parent;
+	int comp;
+
+	tmp = bst_descend(t, avlt, elm, &parent, &comp);
+	if (tmp != NULL)
+		return (avl_e2n(t, tmp));
+
+	avle_insert_at(t, avlt, avl_n2e(t, elm), parent, comp);
 
 	return (NULL);
 }
 
+/* inserts elm after any nodes with the same key */
+void
+_avl_insert_multi(const struct bst_type *t, struct bstree *avlt, void *elm)
+{
+	struct bst_entry *parent;
+	int comp;
+
+	bst_descend_multi(t, avlt, elm, &parent, &comp);
+	avle_insert_at(t, avlt, avl_n2e(t, elm), parent, comp);
+}
+
+/* see _rbt_insert_at */
+void
+_avl_insert_at(const struct bst_type *t, struct bstree *avlt, void *elm,
+    void *parent, int comp)
+{
+	avle_insert_at(t, avlt, avl_n2e(t, elm),
+	    parent == NULL ? NULL : avl_n2e(t, parent), comp);
+}
+
+/* removes and returns the node with the same key, if there is one */
+void *
+_avl_delete_key(const struct bst_type *t, struct bstree *avlt,
+    const void *key)
+{
+	struct bst_entry *avle;
+	struct bst_entry *parent;
+	int comp;
+
+	avle = bst_descend(t, avlt, key, &parent, &comp);
+	if (avle == NULL)
+		return (NULL);
+
+	return (_avl_remove(t, avlt, avl_e2n(t, avle)));
+}
+
+/*
+ * returns the node with the same key. if there isn't one, ctor is
+ * called to create it, and the new node is inserted and returned.
+ */
+void *
+_avl_find_or_insert(const struct bst_type *t, struct bstree *avlt,
+    const void *key, void *(*ctor)(void *, const void *), void *arg)
+{
+	struct bst_entry *tmp;
+	struct bst_entry *parent;
+	void *elm;
+	int comp;
+
+	tmp = bst_descend(t, avlt, key, &parent, &comp);
+	if (tmp != NULL)
+		return (avl_e2n(t, tmp));
+
+	elm = (*ctor)(arg, key);
+	if (elm == NULL)
+		return (NULL);
+
+	avle_insert_at(t, avlt, avl_n2e(t, elm), parent, comp);
+
+	return (elm);
+}
+
+/*
+ * inserts elm, or puts it in the place of the node with the same key.
+ * the node it replaced is returned.
+ */
+void *
+_avl_upsert(const struct bst_type *t, struct bstree *avlt, void *elm)
+{
+	struct bst_entry *avle = avl_n2e(t, elm);
+	struct bst_entry *tmp;
+	struct bst_entry *parent;
+	int comp;
+
+	tmp = bst_descend(t, avlt, elm, &parent, &comp);
+	if (tmp == NULL) {
+		avle_insert_at(t, avlt, avle, parent, comp);
+		return (NULL);
+	}
+
+	bst_set_prefix(t, avle);
+	bst_replace(avlt, tmp, avle);
+
+	return (avl_e2n(t, tmp));
+}
+
 void *
 _avl_remove(const struct bst_type *t, struct bstree *avlt, void *elm)
 {
@@ -844,30 +1833,30 @@ _avl_remove(const struct bst_type *t, struct bstree *avlt, void *elm)
 			/* avle is going to swap with its immediate child */
 
 			parent = next; /* so next will be the avle parent */
-			AVLE_PARENT(next) = parent;
+			AVLE_SET_PARENT(next, parent);
 
-			AVLE_LEFT(avle) = &sentinel;
+			AVLE_SET_LEFT(avle, &sentinel);
 		} else {
 			do {
 				parent = next;
 				next = AVLE_RIGHT(next);
 			} while (AVLE_RIGHT(next) != NULL);
 
-			AVLE_RIGHT(parent) = &sentinel;
+			AVLE_SET_RIGHT(parent, &sentinel);
 		}
 
 		/* swap the target entry with the next entry */
-		sentinel = *next;
-		*next = *avle;
+		bst_copy(&sentinel, next);
+		bst_copy(next, avle);
 
 		/* patch the next node into the surrounding tree */
-		AVLE_PARENT(AVLE_LEFT(avle)) = next;
-		AVLE_PARENT(AVLE_RIGHT(avle)) = next;
+		AVLE_SET_PARENT(AVLE_LEFT(avle), next);
+		AVLE_SET_PARENT(AVLE_RIGHT(avle), next);
 		if (nparent != NULL) {
 			comp = AVLE_RIGHT(nparent) == avle;
-			AVLE_CHILD(nparent, comp) = next;
+			AVLE_SET_CHILD(nparent, comp, next);
 		} else
-			AVLT_ROOT(avlt) = next;
+			AVLT_SET_ROOT(avlt, next);
 
 		avle = &sentinel;
 	}
@@ -877,19 +1866,20 @@ _avl_remove(const struct bst_type *t, struct bstree *avlt, void *elm)
 		next = AVLE_RIGHT(avle);
 
 	if (next != NULL)
-		AVLE_PARENT(next) = parent;
+		AVLE_SET_PARENT(next, parent);
 
 	if (parent == NULL) {
-		AVLT_ROOT(avlt) = next;
+		AVLT_SET_ROOT(avlt, next);
 		return (elm);
 	}
 
 	comp = AVLE_RIGHT(parent) == avle;
-	AVLE_CHILD(parent, comp) = next;
+	AVLE_SET_CHILD(parent, comp, next);
 
 	for (;;) {
 		int obalance, nbalance;
 
+		BST_STATS_ADD(t, bstc_retraces, 1);
 		avle = parent;
 
 		obalance = AVLE_BALANCE(avle);
@@ -904,8 +1894,12 @@ _avl_remove(const struct bst_type *t, struct bstree *avlt, void *elm)
 
 		if (nbalance == 0)
 			AVLE_BALANCE(avle) = 0;
-		else if (avl_rebalance(avlt, parent, &avle, nbalance) == 0)
-			break;
+		else {
+			BST_STATS_ADD(t, bstc_rotations,
+			    avl_rotations(avle, nbalance));
+			if (avl_rebalance(avlt, parent, &avle, nbalance) == 0)
+				break;
+		}
 
 		if (parent == NULL)
 			break;
@@ -915,3 +1909,26 @@ _avl_remove(const struct bst_type *t, struct bstree *avlt, void *elm)
 
 	return (elm);
 }
+
+static void
+avle_build_node(__unused const struct bst_build *b,
+    struct bst_entry *avle, size_t ln, size_t rn,
+    __unused unsigned int depth)
+{
+	AVLE_BALANCE(avle) = (int)bst_height(rn) - (int)bst_height(ln);
+}
+
+/* the next callback must return n elements in order. avlt must be empty */
+void
+_avl_build(const struct bst_type *t, struct bstree *avlt, size_t n,
+    void *(*next)(void *), void *arg)
+{
+	struct bst_build b = {
+		.b_type = t,
+		.b_next = next,
+		.b_arg = arg,
+		.b_node = avle_build_node,
+	};
+
+	bst_build_tree(&b, avlt, n);
+}
@@ -25,9 +25,11 @@
  */
 
 #ifndef	_BST_H_
+#define	_BST_H_
 
 #include <sys/_null.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /*
  * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
@@ -48,6 +50,10 @@
 struct bst_type {
 	int		(*t_compare)(const void *, const void *);
 	unsigned int	  t_offset;	/* offset of rb_entry in type */
+	uint64_t	(*t_prefix)(const void *); /* key prefix, or NULL */
+#ifdef BST_STATS
+	struct bst_stats *t_stats;
+#endif
 };
 
 struct bst_entry {
@@ -56,12 +62,92 @@ struct bst_entry {
 	unsigned int	  bst_data;
 };
 
+/*
+ * an entry that caches a prefix of the key next to the links. trees
+ * generated with a prefix function compare the cached prefixes as
+ * integers while they descend, and only call the comparison function
+ * when the prefixes are the same. the prefix must order the same way
+ * as the keys do, which the bst_prefix_bytes and bst_prefix_str
+ * helpers below do for keys compared with memcmp and strcmp.
+ */
+struct bst_pentry {
+	struct bst_entry  bstp_entry;
+	uint64_t	  bstp_prefix;
+};
+
 struct bstree {
 	struct bst_entry *bst_root;
 };
 
+/*
+ * an rb tree is at most 2 * log2(n + 1) high, which is well under this
+ * for any number of bst_entry structures that fit in a 64bit address space.
+ */
+#define BST_ITER_DEPTH		128
+
+struct bst_iter {
+	const void	 *bsti_hi;	/* inclusive upper bound, or NULL */
+	unsigned int	  bsti_once;	/* only the node on the stack */
+	unsigned int	  bsti_depth;
+	struct bst_entry *bsti_stack[BST_ITER_DEPTH];
+};
+
+/* a piece of a tree that can be walked independently of the rest */
+struct bst_unit {
+	struct bst_entry *bstu_root;
+	unsigned long	  bstu_weight;
+	unsigned int	  bstu_subtree;	/* 0 if bstu_root is on its own */
+};
+
+struct bst_reducer {
+	size_t		  r_size;	/* size of an accumulator */
+	void		(*r_init)(void *, void *);
+	void		(*r_elm)(void *, void *, void *);
+	void		(*r_merge)(void *, void *, const void *);
+};
+
 #define BST_INITIALIZER()	{ NULL }
 
+/* the first 8 bytes of a key as a big endian integer, padded with 0 */
+static inline uint64_t
+bst_prefix_bytes(const void *key, size_t len)
+{
+	const unsigned char *buf = (const unsigned char *)key;
+	uint64_t prefix = 0;
+	unsigned int i;
+
+	if (len >= sizeof(prefix)) {
+		__builtin_memcpy(&prefix, buf, sizeof(prefix));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		prefix = __builtin_bswap64(prefix);
+#endif
+		return (prefix);
+	}
+
+	for (i = 0; i < sizeof(prefix); i++) {
+		prefix <<= 8;
+		if (i < len)
+			prefix |= buf[i];
+	}
+
+	return (prefix);
+}
+
+static inline uint64_t
+bst_prefix_str(const char *key)
+{
+	uint64_t prefix = 0;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(prefix); i++) {
+		prefix <<= 8;
+		if (*key != '\0')
+			prefix |= (unsigned char)*key++;
+	}
+
+	return (prefix);
+}
+
 static inline void
 _bst_init(struct bstree *bst)
 {
@@ -78,6 +164,11 @@ void	*_bst_insert(const struct bst_type *, struct bstree *, void *);
 void	*_bst_remove(const struct bst_type *, struct bstree *, void *);
 void	*_bst_find(const struct bst_type *, struct bstree *, const void *);
 void	*_bst_nfind(const struct bst_type *, struct bstree *, const void *);
+void	*_bst_find_first(const struct bst_type *, struct bstree *,
+	     const void *);
+void	*_bst_find_last(const struct bst_type *, struct bstree *,
+	     const void *);
+size_t	 _bst_count(const struct bst_type *, struct bstree *, const void *);
 void	*_bst_root(const struct bst_type *, struct bstree *);
 void	*_bst_min(const struct bst_type *, struct bstree *);
 void	*_bst_max(const struct bst_type *, struct bstree *);
@@ -91,6 +182,97 @@ void	 _bst_set_right(const struct bst_type *, void *, void *);
 void	 _bst_set_parent(const struct bst_type *, void *, void *);
 void	 _bst_poison(const struct bst_type *, void *, unsigned long);
 int	 _bst_check(const struct bst_type *, void *, unsigned long);
+void	 _bst_iter_init(struct bstree *, struct bst_iter *);
+void	 _bst_iter_range(const struct bst_type *, struct bstree *,
+	     struct bst_iter *, const void *, const void *);
+unsigned int
+	 _bst_iter_fill(const struct bst_type *, struct bst_iter *,
+	     void **, unsigned int);
+int	 _bst_walk(const struct bst_type *, struct bstree *,
+	     const void *, const void *,
+	     int (*)(void *, void **, unsigned int), void *);
+unsigned int
+	 _bst_split(const struct bst_type *, struct bstree *,
+	     struct bst_unit *, unsigned int,
+	     unsigned long (*)(const void *));
+void	 _bst_iter_unit(struct bst_iter *, const struct bst_unit *);
+
+#define BST_RELOCATE_BFS	0	/* breadth first */
+#define BST_RELOCATE_VEB	1	/* van Emde Boas */
+
+void	 _bst_relocate(const struct bst_type *, struct bstree *,
+	     unsigned int, void *(*)(void *, void *), void *);
+
+/* bst_snapshot.c */
+int	 _bst_snapshot_write(const struct bst_type *, struct bstree *, int,
+	     size_t, size_t, size_t);
+
+/* bst_parallel.c */
+int	 _bst_parallel_foreach(const struct bst_type *, struct bstree *,
+	     unsigned int, unsigned long (*)(const void *),
+	     void (*)(void *, void *), void *);
+int	 _bst_parallel_reduce(const struct bst_type *, struct bstree *,
+	     unsigned int, unsigned long (*)(const void *),
+	     const struct bst_reducer *, void *, void *);
+
+/*
+ * Programs built with BST_STATS count what bst.c does for each tree
+ * type, in a slot for each thread like HEAP_STATS in heap.h. Trees
+ * whose type was not made by RBT_GENERATE or AVL_GENERATE, like the
+ * ones in bst.hpp, are not counted.
+ */
+#ifdef BST_STATS
+#define BST_STATS_SLOTS		64
+
+struct bst_counters {
+	uint64_t	  bstc_compares; /* comparison function calls */
+	uint64_t	  bstc_descents;
+	uint64_t	  bstc_depth;	/* nodes visited by descents */
+	uint64_t	  bstc_rotations;
+	uint64_t	  bstc_retraces; /* rebalancing steps up the tree */
+	uint64_t	  bstc_augments;
+};
+
+struct bst_stats_slot {
+	struct bst_counters bss_counters;
+} __attribute__((__aligned__(64)));
+
+struct bst_stats {
+	struct bst_stats_slot bs_slots[BST_STATS_SLOTS];
+};
+
+/* bst_stats.c */
+extern __thread unsigned int _bst_stats_idx;	/* slot + 1, or 0 */
+unsigned int	 _bst_stats_assign(void);
+void	 _bst_stats_snapshot(const struct bst_type *, struct bst_counters *);
+void	 _bst_stats_reset(const struct bst_type *);
+
+#define BST_STATS_PROTOTYPE(_name, _t)					\
+									\
+__unused static inline void						\
+_name##_STATS_SNAPSHOT(struct bst_counters *bstc)			\
+{									\
+	_bst_stats_snapshot((_t), bstc);				\
+}									\
+									\
+__unused static inline void						\
+_name##_STATS_RESET(void)						\
+{									\
+	_bst_stats_reset((_t));						\
+}
+#define BST_STATS_GENERATE(_name)					\
+static struct bst_stats _name##_STATS;
+#define BST_STATS_TYPE(_name)		&_name##_STATS,
+
+#define RBT_STATS_SNAPSHOT(_name, _c)	_name##_RBT_STATS_SNAPSHOT(_c)
+#define RBT_STATS_RESET(_name)		_name##_RBT_STATS_RESET()
+#define AVL_STATS_SNAPSHOT(_name, _c)	_name##_AVL_STATS_SNAPSHOT(_c)
+#define AVL_STATS_RESET(_name)		_name##_AVL_STATS_RESET()
+#else
+#define BST_STATS_PROTOTYPE(_name, _t)
+#define BST_STATS_GENERATE(_name)
+#define BST_STATS_TYPE(_name)
+#endif
 
 /*
  * red-black tree
@@ -107,11 +289,26 @@ struct _name {								\
 }
 
 #define RBT_ENTRY(_type)	struct bst_entry
+#define RBT_PREFIX_ENTRY(_type)	struct bst_pentry
 
 #define RBT_INITIALIZER(_head) { BST_INITIALIZER() }
 
 void	*_rbt_insert(const struct rbt_type *, struct bstree *, void *);
 void	*_rbt_remove(const struct rbt_type *, struct bstree *, void *);
+void	 _rbt_insert_multi(const struct rbt_type *, struct bstree *,
+	     void *);
+void	 _rbt_insert_at(const struct rbt_type *, struct bstree *, void *,
+	     void *, int);
+void	*_rbt_delete_key(const struct rbt_type *, struct bstree *,
+	     const void *);
+void	*_rbt_find_or_insert(const struct rbt_type *, struct bstree *,
+	     const void *, void *(*)(void *, const void *), void *);
+void	*_rbt_upsert(const struct rbt_type *, struct bstree *, void *);
+void	 _rbt_build(const struct rbt_type *, struct bstree *, size_t,
+	     void *(*)(void *), void *);
+int	 _rbt_snapshot_load(const struct rbt_type *, struct bstree *,
+	     void *, size_t, size_t, size_t, size_t,
+	     void *(*)(void *, void *), void *);
 
 #define RBT_PROTOTYPE(_name, _type, _field, _cmp)			\
 extern const struct rbt_type _name##_RBT_TYPE;				\
@@ -134,6 +331,32 @@ _name##_RBT_REMOVE(struct _name *head, struct _type *elm)		\
 	return _rbt_remove(&_name##_RBT_TYPE, &head->rb_tree, elm);	\
 }									\
 									\
+__unused static inline void						\
+_name##_RBT_INSERT_MULTI(struct _name *head, struct _type *elm)		\
+{									\
+	_rbt_insert_multi(&_name##_RBT_TYPE, &head->rb_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_DELETE_KEY(struct _name *head, const struct _type *key)	\
+{									\
+	return _rbt_delete_key(&_name##_RBT_TYPE, &head->rb_tree, key);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_FIND_OR_INSERT(struct _name *head, const struct _type *key,	\
+    void *(*ctor)(void *, const void *), void *arg)			\
+{									\
+	return _rbt_find_or_insert(&_name##_RBT_TYPE, &head->rb_tree,	\
+	    key, ctor, arg);						\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_UPSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _rbt_upsert(&_name##_RBT_TYPE, &head->rb_tree, elm);	\
+}									\
+									\
 __unused static inline struct _type *					\
 _name##_RBT_FIND(struct _name *head, const struct _type *key)		\
 {									\
@@ -149,6 +372,27 @@ _name##_RBT_NFIND(struct _name *head, const struct _type *key)		\
 }									\
 									\
 __unused static inline struct _type *					\
+_name##_RBT_FIND_FIRST(struct _name *head, const struct _type *key)	\
+{									\
+	return _bst_find_first(&_name##_RBT_TYPE.t_bst, &head->rb_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_FIND_LAST(struct _name *head, const struct _type *key)	\
+{									\
+	return _bst_find_last(&_name##_RBT_TYPE.t_bst, &head->rb_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline size_t						\
+_name##_RBT_COUNT(struct _name *head, const struct _type *key)		\
+{									\
+	return _bst_count(&_name##_RBT_TYPE.t_bst, &head->rb_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline struct _type *					\
 _name##_RBT_ROOT(struct _name *head)					\
 {									\
 	return _bst_root(&_name##_RBT_TYPE.t_bst, &head->rb_tree);	\
@@ -230,20 +474,107 @@ __unused static inline int						\
 _name##_RBT_CHECK(struct _type *elm, unsigned long poison)		\
 {									\
 	return _bst_check(&_name##_RBT_TYPE.t_bst, elm, poison);	\
-}
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_ITER_INIT(struct _name *head, struct bst_iter *it)		\
+{									\
+	_bst_iter_init(&head->rb_tree, it);				\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_ITER_RANGE(struct _name *head,				\
+    struct bst_iter *it, const struct _type *lo,			\
+    const struct _type *hi)						\
+{									\
+	_bst_iter_range(&_name##_RBT_TYPE.t_bst, &head->rb_tree, it,	\
+	    lo, hi);							\
+}									\
+									\
+__unused static inline unsigned int					\
+_name##_RBT_ITER_FILL(struct bst_iter *it,				\
+    struct _type **elms, unsigned int nelms)				\
+{									\
+	return _bst_iter_fill(&_name##_RBT_TYPE.t_bst, it,		\
+	    (void **)elms, nelms);					\
+}									\
+									\
+__unused static inline int						\
+_name##_RBT_WALK(struct _name *head, const struct _type *lo,		\
+    const struct _type *hi, int (*fn)(void *, void **, unsigned int),	\
+    void *arg)								\
+{									\
+	return _bst_walk(&_name##_RBT_TYPE.t_bst, &head->rb_tree,	\
+	    lo, hi, fn, arg);						\
+}									\
+									\
+__unused static inline int						\
+_name##_RBT_PARALLEL_FOREACH(struct _name *head, unsigned int nthreads,	\
+    unsigned long (*weight)(const void *),				\
+    void (*fn)(void *, void *), void *arg)				\
+{									\
+	return _bst_parallel_foreach(&_name##_RBT_TYPE.t_bst,		\
+	    &head->rb_tree, nthreads, weight, fn, arg);			\
+}									\
+									\
+__unused static inline int						\
+_name##_RBT_PARALLEL_REDUCE(struct _name *head, unsigned int nthreads,	\
+    unsigned long (*weight)(const void *),				\
+    const struct bst_reducer *r, void *arg, void *result)		\
+{									\
+	return _bst_parallel_reduce(&_name##_RBT_TYPE.t_bst,		\
+	    &head->rb_tree, nthreads, weight, r, arg, result);		\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_BUILD(struct _name *head, size_t n,				\
+    void *(*next)(void *), void *arg)					\
+{									\
+	_rbt_build(&_name##_RBT_TYPE, &head->rb_tree, n, next, arg);	\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_RELOCATE(struct _name *head, unsigned int order,		\
+    void *(*move)(void *, void *), void *arg)				\
+{									\
+	_bst_relocate(&_name##_RBT_TYPE.t_bst, &head->rb_tree,		\
+	    order, move, arg);						\
+}									\
+									\
+__unused static inline int						\
+_name##_RBT_SNAPSHOT_WRITE(struct _name *head, int fd,			\
+    size_t keyoff, size_t keylen)					\
+{									\
+	return _bst_snapshot_write(&_name##_RBT_TYPE.t_bst,		\
+	    &head->rb_tree, fd, sizeof(struct _type), keyoff, keylen);	\
+}									\
+									\
+__unused static inline int						\
+_name##_RBT_SNAPSHOT_LOAD(struct _name *head, void *map, size_t len,	\
+    size_t keyoff, size_t keylen,					\
+    void *(*fn)(void *, void *), void *arg)				\
+{									\
+	return _rbt_snapshot_load(&_name##_RBT_TYPE,			\
+	    &head->rb_tree, map, len, sizeof(struct _type),		\
+	    keyoff, keylen, fn, arg);					\
+}									\
+BST_STATS_PROTOTYPE(_name##_RBT, &_name##_RBT_TYPE.t_bst)
 
-#define RBT_GENERATE_INTERNAL(_name, _type, _field, _cmp, _aug)		\
+#define RBT_GENERATE_INTERNAL(_name, _type, _field, _cmp, _aug, _pfx)	\
 static int								\
 _name##_RBT_COMPARE(const void *lptr, const void *rptr)			\
 {									\
 	const struct _type *l = lptr, *r = rptr;			\
 	return _cmp(l, r);						\
 }									\
+BST_STATS_GENERATE(_name##_RBT)						\
 const struct rbt_type _name##_RBT_TYPE = {				\
 	_aug,								\
 	{								\
 		_name##_RBT_COMPARE,					\
 		offsetof(struct _type, _field),				\
+		_pfx,							\
+		BST_STATS_TYPE(_name##_RBT)				\
 	},								\
 }
 
@@ -254,16 +585,40 @@ _name##_RBT_AUGMENT(void *ptr)						\
 	struct _type *p = ptr;						\
 	return _aug(p);							\
 }									\
-RBT_GENERATE_INTERNAL(_name, _type, _field, _cmp, _name##_RBT_AUGMENT)
+RBT_GENERATE_INTERNAL(_name, _type, _field, _cmp,			\
+    _name##_RBT_AUGMENT, NULL)
 
 #define RBT_GENERATE(_name, _type, _field, _cmp)			\
-    RBT_GENERATE_INTERNAL(_name, _type, _field, _cmp, NULL)
+    RBT_GENERATE_INTERNAL(_name, _type, _field, _cmp, NULL, NULL)
+
+/* _field must be a RBT_PREFIX_ENTRY */
+#define RBT_GENERATE_PREFIX(_name, _type, _field, _cmp, _pfx)		\
+static uint64_t								\
+_name##_RBT_PREFIX(const void *ptr)					\
+{									\
+	const struct _type *p = ptr;					\
+	return _pfx(p);							\
+}									\
+RBT_GENERATE_INTERNAL(_name, _type, _field, _cmp, NULL,			\
+    _name##_RBT_PREFIX)
 
 #define RBT_INIT(_name, _head)		_name##_RBT_INIT(_head)
 #define RBT_INSERT(_name, _head, _elm)	_name##_RBT_INSERT(_head, _elm)
+#define RBT_INSERT_MULTI(_name, _head, _elm)				\
+	_name##_RBT_INSERT_MULTI(_head, _elm)
 #define RBT_REMOVE(_name, _head, _elm)	_name##_RBT_REMOVE(_head, _elm)
 #define RBT_FIND(_name, _head, _key)	_name##_RBT_FIND(_head, _key)
+#define RBT_DELETE_KEY(_name, _head, _key)				\
+	_name##_RBT_DELETE_KEY(_head, _key)
+#define RBT_FIND_OR_INSERT(_name, _head, _key, _ctor, _arg)		\
+	_name##_RBT_FIND_OR_INSERT(_head, _key, _ctor, _arg)
+#define RBT_UPSERT(_name, _head, _elm)	_name##_RBT_UPSERT(_head, _elm)
 #define RBT_NFIND(_name, _head, _key)	_name##_RBT_NFIND(_head, _key)
+#define RBT_FIND_FIRST(_name, _head, _key)				\
+	_name##_RBT_FIND_FIRST(_head, _key)
+#define RBT_FIND_LAST(_name, _head, _key)				\
+	_name##_RBT_FIND_LAST(_head, _key)
+#define RBT_COUNT(_name, _head, _key)	_name##_RBT_COUNT(_head, _key)
 #define RBT_ROOT(_name, _head)		_name##_RBT_ROOT(_head)
 #define RBT_EMPTY(_name, _head)		_name##_RBT_EMPTY(_head)
 #define RBT_MIN(_name, _head)		_name##_RBT_MIN(_head)
@@ -278,6 +633,26 @@ RBT_GENERATE_INTERNAL(_name, _type, _field, _cmp, _name##_RBT_AUGMENT)
 #define RBT_SET_PARENT(_name, _elm, _p)	_name##_RBT_SET_PARENT(_elm, _p)
 #define RBT_POISON(_name, _elm, _p)	_name##_RBT_POISON(_elm, _p)
 #define RBT_CHECK(_name, _elm, _p)	_name##_RBT_CHECK(_elm, _p)
+#define RBT_ITER_INIT(_name, _head, _it)				\
+	_name##_RBT_ITER_INIT(_head, _it)
+#define RBT_ITER_RANGE(_name, _head, _it, _lo, _hi)			\
+	_name##_RBT_ITER_RANGE(_head, _it, _lo, _hi)
+#define RBT_ITER_FILL(_name, _it, _elms, _n)				\
+	_name##_RBT_ITER_FILL(_it, _elms, _n)
+#define RBT_WALK(_name, _head, _lo, _hi, _fn, _arg)			\
+	_name##_RBT_WALK(_head, _lo, _hi, _fn, _arg)
+#define RBT_PARALLEL_FOREACH(_name, _head, _n, _w, _fn, _arg)		\
+	_name##_RBT_PARALLEL_FOREACH(_head, _n, _w, _fn, _arg)
+#define RBT_PARALLEL_REDUCE(_name, _head, _n, _w, _r, _arg, _res)	\
+	_name##_RBT_PARALLEL_REDUCE(_head, _n, _w, _r, _arg, _res)
+#define RBT_RELOCATE(_name, _head, _o, _move, _arg)			\
+	_name##_RBT_RELOCATE(_head, _o, _move, _arg)
+#define RBT_BUILD(_name, _head, _n, _next, _arg)			\
+	_name##_RBT_BUILD(_head, _n, _next, _arg)
+#define RBT_SNAPSHOT_WRITE(_name, _head, _fd, _koff, _klen)		\
+	_name##_RBT_SNAPSHOT_WRITE(_head, _fd, _koff, _klen)
+#define RBT_SNAPSHOT_LOAD(_name, _head, _map, _len, _ko, _kl, _fn, _arg)\
+	_name##_RBT_SNAPSHOT_LOAD(_head, _map, _len, _ko, _kl, _fn, _arg)
 
 #define RBT_FOREACH(_e, _name, _head)					\
 	for ((_e) = RBT_MIN(_name, (_head));				\
@@ -309,11 +684,26 @@ struct _name {								\
 }
 
 #define AVL_ENTRY(_type)	struct bst_entry
+#define AVL_PREFIX_ENTRY(_type)	struct bst_pentry
 
 #define AVL_INITIALIZER(_head)	{ BST_INITIALIZER() }
 
 void	*_avl_insert(const struct bst_type *, struct bstree *, void *);
 void	*_avl_remove(const struct bst_type *, struct bstree *, void *);
+void	 _avl_insert_multi(const struct bst_type *, struct bstree *,
+	     void *);
+void	 _avl_insert_at(const struct bst_type *, struct bstree *, void *,
+	     void *, int);
+void	*_avl_delete_key(const struct bst_type *, struct bstree *,
+	     const void *);
+void	*_avl_find_or_insert(const struct bst_type *, struct bstree *,
+	     const void *, void *(*)(void *, const void *), void *);
+void	*_avl_upsert(const struct bst_type *, struct bstree *, void *);
+void	 _avl_build(const struct bst_type *, struct bstree *, size_t,
+	     void *(*)(void *), void *);
+int	 _avl_snapshot_load(const struct bst_type *, struct bstree *,
+	     void *, size_t, size_t, size_t, size_t,
+	     void *(*)(void *, void *), void *);
 
 #define AVL_PROTOTYPE(_name, _type, _field, _cmp)			\
 extern const struct bst_type _name##_AVL_TYPE;				\
@@ -336,6 +726,33 @@ _name##_AVL_REMOVE(struct _name *head, struct _type *elm)		\
 	return _avl_remove(&_name##_AVL_TYPE, &head->avl_tree, elm);	\
 }									\
 									\
+__unused static inline void						\
+_name##_AVL_INSERT_MULTI(struct _name *head, struct _type *elm)		\
+{									\
+	_avl_insert_multi(&_name##_AVL_TYPE, &head->avl_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_DELETE_KEY(struct _name *head, const struct _type *key)	\
+{									\
+	return _avl_delete_key(&_name##_AVL_TYPE, &head->avl_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_FIND_OR_INSERT(struct _name *head, const struct _type *key,	\
+    void *(*ctor)(void *, const void *), void *arg)			\
+{									\
+	return _avl_find_or_insert(&_name##_AVL_TYPE, &head->avl_tree,	\
+	    key, ctor, arg);						\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_UPSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _avl_upsert(&_name##_AVL_TYPE, &head->avl_tree, elm);	\
+}									\
+									\
 __unused static inline struct _type *					\
 _name##_AVL_FIND(struct _name *head, const struct _type *key)		\
 {									\
@@ -349,6 +766,25 @@ _name##_AVL_NFIND(struct _name *head, const struct _type *key)		\
 }									\
 									\
 __unused static inline struct _type *					\
+_name##_AVL_FIND_FIRST(struct _name *head, const struct _type *key)	\
+{									\
+	return _bst_find_first(&_name##_AVL_TYPE, &head->avl_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_FIND_LAST(struct _name *head, const struct _type *key)	\
+{									\
+	return _bst_find_last(&_name##_AVL_TYPE, &head->avl_tree, key);	\
+}									\
+									\
+__unused static inline size_t						\
+_name##_AVL_COUNT(struct _name *head, const struct _type *key)		\
+{									\
+	return _bst_count(&_name##_AVL_TYPE, &head->avl_tree, key);	\
+}									\
+									\
+__unused static inline struct _type *					\
 _name##_AVL_ROOT(struct _name *head)					\
 {									\
 	return _bst_root(&_name##_AVL_TYPE, &head->avl_tree);		\
@@ -412,25 +848,138 @@ __unused static inline int						\
 _name##_AVL_CHECK(struct _type *elm, unsigned long poison)		\
 {									\
 	return _bst_check(&_name##_AVL_TYPE, elm, poison);		\
-}
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_ITER_INIT(struct _name *head, struct bst_iter *it)		\
+{									\
+	_bst_iter_init(&head->avl_tree, it);				\
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_ITER_RANGE(struct _name *head,				\
+    struct bst_iter *it, const struct _type *lo,			\
+    const struct _type *hi)						\
+{									\
+	_bst_iter_range(&_name##_AVL_TYPE, &head->avl_tree, it,		\
+	    lo, hi);							\
+}									\
+									\
+__unused static inline unsigned int					\
+_name##_AVL_ITER_FILL(struct bst_iter *it,				\
+    struct _type **elms, unsigned int nelms)				\
+{									\
+	return _bst_iter_fill(&_name##_AVL_TYPE, it,			\
+	    (void **)elms, nelms);					\
+}									\
+									\
+__unused static inline int						\
+_name##_AVL_WALK(struct _name *head, const struct _type *lo,		\
+    const struct _type *hi, int (*fn)(void *, void **, unsigned int),	\
+    void *arg)								\
+{									\
+	return _bst_walk(&_name##_AVL_TYPE, &head->avl_tree,		\
+	    lo, hi, fn, arg);						\
+}									\
+									\
+__unused static inline int						\
+_name##_AVL_PARALLEL_FOREACH(struct _name *head, unsigned int nthreads,	\
+    unsigned long (*weight)(const void *),				\
+    void (*fn)(void *, void *), void *arg)				\
+{									\
+	return _bst_parallel_foreach(&_name##_AVL_TYPE,			\
+	    &head->avl_tree,						\
+	    nthreads, weight, fn, arg);					\
+}									\
+									\
+__unused static inline int						\
+_name##_AVL_PARALLEL_REDUCE(struct _name *head, unsigned int nthreads,	\
+    unsigned long (*weight)(const void *),				\
+    const struct bst_reducer *r, void *arg, void *result)		\
+{									\
+	return _bst_parallel_reduce(&_name##_AVL_TYPE, &head->avl_tree,	\
+	    nthreads, weight, r, arg, result);				\
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_BUILD(struct _name *head, size_t n,				\
+    void *(*next)(void *), void *arg)					\
+{									\
+	_avl_build(&_name##_AVL_TYPE, &head->avl_tree, n, next, arg);	\
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_RELOCATE(struct _name *head, unsigned int order,		\
+    void *(*move)(void *, void *), void *arg)				\
+{									\
+	_bst_relocate(&_name##_AVL_TYPE, &head->avl_tree,		\
+	    order, move, arg);						\
+}									\
+									\
+__unused static inline int						\
+_name##_AVL_SNAPSHOT_WRITE(struct _name *head, int fd,			\
+    size_t keyoff, size_t keylen)					\
+{									\
+	return _bst_snapshot_write(&_name##_AVL_TYPE,			\
+	    &head->avl_tree, fd, sizeof(struct _type), keyoff, keylen);	\
+}									\
+									\
+__unused static inline int						\
+_name##_AVL_SNAPSHOT_LOAD(struct _name *head, void *map, size_t len,	\
+    size_t keyoff, size_t keylen,					\
+    void *(*fn)(void *, void *), void *arg)				\
+{									\
+	return _avl_snapshot_load(&_name##_AVL_TYPE,			\
+	    &head->avl_tree, map, len, sizeof(struct _type),		\
+	    keyoff, keylen, fn, arg);					\
+}									\
+BST_STATS_PROTOTYPE(_name##_AVL, &_name##_AVL_TYPE)
 
-#define AVL_GENERATE(_name, _type, _field, _cmp)			\
+#define AVL_GENERATE_INTERNAL(_name, _type, _field, _cmp, _pfx)		\
 static int								\
 _name##_AVL_COMPARE(const void *lptr, const void *rptr)			\
 {									\
 	const struct _type *l = lptr, *r = rptr;			\
 	return _cmp(l, r);						\
 }									\
+BST_STATS_GENERATE(_name##_AVL)						\
 const struct bst_type _name##_AVL_TYPE = {				\
 	_name##_AVL_COMPARE,						\
 	offsetof(struct _type, _field),					\
+	_pfx,								\
+	BST_STATS_TYPE(_name##_AVL)					\
 }
 
+#define AVL_GENERATE(_name, _type, _field, _cmp)			\
+    AVL_GENERATE_INTERNAL(_name, _type, _field, _cmp, NULL)
+
+/* _field must be an AVL_PREFIX_ENTRY */
+#define AVL_GENERATE_PREFIX(_name, _type, _field, _cmp, _pfx)		\
+static uint64_t								\
+_name##_AVL_PREFIX(const void *ptr)					\
+{									\
+	const struct _type *p = ptr;					\
+	return _pfx(p);							\
+}									\
+AVL_GENERATE_INTERNAL(_name, _type, _field, _cmp, _name##_AVL_PREFIX)
+
 #define AVL_INIT(_name, _head)		_name##_AVL_INIT(_head)
 #define AVL_INSERT(_name, _head, _elm)	_name##_AVL_INSERT(_head, _elm)
+#define AVL_INSERT_MULTI(_name, _head, _elm)				\
+	_name##_AVL_INSERT_MULTI(_head, _elm)
 #define AVL_REMOVE(_name, _head, _elm)	_name##_AVL_REMOVE(_head, _elm)
 #define AVL_FIND(_name, _head, _key)	_name##_AVL_FIND(_head, _key)
+#define AVL_DELETE_KEY(_name, _head, _key)				\
+	_name##_AVL_DELETE_KEY(_head, _key)
+#define AVL_FIND_OR_INSERT(_name, _head, _key, _ctor, _arg)		\
+	_name##_AVL_FIND_OR_INSERT(_head, _key, _ctor, _arg)
+#define AVL_UPSERT(_name, _head, _elm)	_name##_AVL_UPSERT(_head, _elm)
 #define AVL_NFIND(_name, _head, _key)	_name##_AVL_NFIND(_head, _key)
+#define AVL_FIND_FIRST(_name, _head, _key)				\
+	_name##_AVL_FIND_FIRST(_head, _key)
+#define AVL_FIND_LAST(_name, _head, _key)				\
+	_name##_AVL_FIND_LAST(_head, _key)
+#define AVL_COUNT(_name, _head, _key)	_name##_AVL_COUNT(_head, _key)
 #define AVL_ROOT(_name, _head)		_name##_AVL_ROOT(_head)
 #define AVL_EMPTY(_name, _head)		_name##_AVL_EMPTY(_head)
 #define AVL_MIN(_name, _head)		_name##_AVL_MIN(_head)
@@ -442,6 +991,26 @@ const struct bst_type _name##_AVL_TYPE = {				\
 #define AVL_PARENT(_name, _elm)		_name##_AVL_PARENT(_elm)
 #define AVL_POISON(_name, _elm, _p)	_name##_AVL_POISON(_elm, _p)
 #define AVL_CHECK(_name, _elm, _p)	_name##_AVL_CHECK(_elm, _p)
+#define AVL_ITER_INIT(_name, _head, _it)				\
+	_name##_AVL_ITER_INIT(_head, _it)
+#define AVL_ITER_RANGE(_name, _head, _it, _lo, _hi)			\
+	_name##_AVL_ITER_RANGE(_head, _it, _lo, _hi)
+#define AVL_ITER_FILL(_name, _it, _elms, _n)				\
+	_name##_AVL_ITER_FILL(_it, _elms, _n)
+#define AVL_WALK(_name, _head, _lo, _hi, _fn, _arg)			\
+	_name##_AVL_WALK(_head, _lo, _hi, _fn, _arg)
+#define AVL_PARALLEL_FOREACH(_name, _head, _n, _w, _fn, _arg)		\
+	_name##_AVL_PARALLEL_FOREACH(_head, _n, _w, _fn, _arg)
+#define AVL_PARALLEL_REDUCE(_name, _head, _n, _w, _r, _arg, _res)	\
+	_name##_AVL_PARALLEL_REDUCE(_head, _n, _w, _r, _arg, _res)
+#define AVL_RELOCATE(_name, _head, _o, _move, _arg)			\
+	_name##_AVL_RELOCATE(_head, _o, _move, _arg)
+#define AVL_BUILD(_name, _head, _n, _next, _arg)			\
+	_name##_AVL_BUILD(_head, _n, _next, _arg)
+#define AVL_SNAPSHOT_WRITE(_name, _head, _fd, _koff, _klen)		\
+	_name##_AVL_SNAPSHOT_WRITE(_head, _fd, _koff, _klen)
+#define AVL_SNAPSHOT_LOAD(_name, _head, _map, _len, _ko, _kl, _fn, _arg)\
+	_name##_AVL_SNAPSHOT_LOAD(_head, _map, _len, _ko, _kl, _fn, _arg)
 
 #define AVL_FOREACH(_e, _name, _head)					\
 	for ((_e) = AVL_MIN(_name, (_head));				\
@@ -0,0 +1,684 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _BST_HPP_
+#define _BST_HPP_
+
+/*
+ * C++ wrappers for the trees in bst.h.
+ *
+ *	struct elm {
+ *		int		key;
+ *		RBT_ENTRY(elm)	entry;
+ *	};
+ *
+ *	intrusive_rbtree<elm, &elm::entry, less_by_key> tree;
+ *
+ * intrusive_rbtree and intrusive_avltree are laid out as a single
+ * struct bstree, so from() can wrap the rb_tree or avl_tree inside a
+ * head declared with RBT_HEAD or AVL_HEAD, and the same tree can be
+ * used from C with the macros and from C++ with these. Compare is a
+ * default constructed less-than object like std::less, and has to
+ * order elements the same way as the comparison function given to the
+ * C macros. Entries declared with RBT_PREFIX_ENTRY are not supported.
+ * The inline functions from RBT_PROTOTYPE and AVL_PROTOTYPE rely on C
+ * converting void pointers, so only the heads should be shared with
+ * C++ code.
+ *
+ * Lookups, iteration, and the descents for inserts are done here, so
+ * Compare is inlined into them. Rebalancing is done by _rbt_insert_at,
+ * _rbt_remove and the AVL equivalents in bst.c, which do not compare
+ * elements. Nothing is allocated; the tree only links elements the
+ * caller owns, and moving a tree moves the root pointer.
+ */
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include "bst.h"
+}
+
+template <class T, bst_entry T::*Entry>
+struct bst_node {
+	static bst_entry *
+	entry(const T *elm)
+	{
+		return (const_cast<bst_entry *>(&(elm->*Entry)));
+	}
+
+	/* Entry is a constant, so this folds down to a fixed offset */
+	static std::size_t
+	offset(void)
+	{
+		alignas(T) static char obj[sizeof(T)];
+		const T *p = reinterpret_cast<const T *>(obj);
+
+		return (reinterpret_cast<const char *>(&(p->*Entry)) -
+		    reinterpret_cast<const char *>(p));
+	}
+
+	static T *
+	elm(const bst_entry *bste)
+	{
+		const char *e = reinterpret_cast<const char *>(bste);
+
+		e -= offset();
+
+		return (reinterpret_cast<T *>(const_cast<char *>(e)));
+	}
+
+	static bst_entry *
+	first(bst_entry *bste)
+	{
+		if (bste != nullptr) {
+			while (bste->bst_children[0] != nullptr)
+				bste = bste->bst_children[0];
+		}
+		return (bste);
+	}
+
+	static bst_entry *
+	last(bst_entry *bste)
+	{
+		if (bste != nullptr) {
+			while (bste->bst_children[1] != nullptr)
+				bste = bste->bst_children[1];
+		}
+		return (bste);
+	}
+
+	/* the next node on side c, ie, the successor if c is 1 */
+	static bst_entry *
+	step(bst_entry *bste, int c)
+	{
+		bst_entry *parent;
+
+		if (bste->bst_children[c] != nullptr) {
+			bste = bste->bst_children[c];
+			while (bste->bst_children[!c] != nullptr)
+				bste = bste->bst_children[!c];
+			return (bste);
+		}
+
+		while ((parent = bste->bst_parent) != nullptr &&
+		    parent->bst_children[c] == bste)
+			bste = parent;
+
+		return (parent);
+	}
+
+	/* three way comparison for the C code, built out of Compare */
+	template <class Compare>
+	static int
+	compare(const void *lptr, const void *rptr)
+	{
+		const T &l = *static_cast<const T *>(lptr);
+		const T &r = *static_cast<const T *>(rptr);
+		Compare cmp;
+
+		if (cmp(l, r))
+			return (-1);
+		if (cmp(r, l))
+			return (1);
+		return (0);
+	}
+
+	/* the type for the C code, which does not count C++ trees */
+	template <class Compare>
+	static bst_type
+	type(void)
+	{
+		bst_type t;
+
+		t.t_compare = compare<Compare>;
+		t.t_offset = static_cast<unsigned int>(offset());
+		t.t_prefix = nullptr;
+#ifdef BST_STATS
+		t.t_stats = nullptr;
+#endif
+
+		return (t);
+	}
+};
+
+template <class T, bst_entry T::*Entry, class V>
+class bst_iterator {
+	typedef bst_node<T, Entry> node;
+
+	template <class U, bst_entry U::*, class> friend class bst_iterator;
+	template <class U, bst_entry U::*, class, class> friend class bst_tree;
+
+	const bstree		*i_tree;
+	bst_entry		*i_entry;	/* nullptr is end() */
+
+	bst_iterator(const bstree *tree, bst_entry *bste) :
+	    i_tree(tree), i_entry(bste) { }
+
+public:
+	typedef std::bidirectional_iterator_tag	iterator_category;
+	typedef V				value_type;
+	typedef std::ptrdiff_t			difference_type;
+	typedef V				*pointer;
+	typedef V				&reference;
+
+	bst_iterator() : i_tree(nullptr), i_entry(nullptr) { }
+
+	/* iterators convert to const_iterators */
+	template <class W, class = typename std::enable_if<
+	    std::is_convertible<W *, V *>::value>::type>
+	bst_iterator(const bst_iterator<T, Entry, W> &it) :
+	    i_tree(it.i_tree), i_entry(it.i_entry) { }
+
+	reference
+	operator*() const
+	{
+		return (*node::elm(i_entry));
+	}
+
+	pointer
+	operator->() const
+	{
+		return (node::elm(i_entry));
+	}
+
+	bst_iterator &
+	operator++()
+	{
+		i_entry = node::step(i_entry, 1);
+		return (*this);
+	}
+
+	bst_iterator
+	operator++(int)
+	{
+		bst_iterator it = *this;
+		++*this;
+		return (it);
+	}
+
+	/* end() steps back to the last node */
+	bst_iterator &
+	operator--()
+	{
+		if (i_entry == nullptr)
+			i_entry = node::last(i_tree->bst_root);
+		else
+			i_entry = node::step(i_entry, 0);
+		return (*this);
+	}
+
+	bst_iterator
+	operator--(int)
+	{
+		bst_iterator it = *this;
+		--*this;
+		return (it);
+	}
+
+	template <class W>
+	bool
+	operator==(const bst_iterator<T, Entry, W> &it) const
+	{
+		return (i_entry == it.i_entry);
+	}
+
+	template <class W>
+	bool
+	operator!=(const bst_iterator<T, Entry, W> &it) const
+	{
+		return (i_entry != it.i_entry);
+	}
+};
+
+/*
+ * Ops link and unlink elements via the C code, and provide the type
+ * that it needs to find the entry in an element.
+ */
+
+template <class T, bst_entry T::*Entry, class Compare, void (*Augment)(T *)>
+struct bst_rbt_ops {
+	typedef bst_node<T, Entry> node;
+
+	static void
+	augment(void *elm)
+	{
+		(*Augment)(static_cast<T *>(elm));
+	}
+
+	static const struct rbt_type *
+	type(void)
+	{
+		static const struct rbt_type t = {
+			Augment == nullptr ? nullptr : augment,
+			node::template type<Compare>(),
+		};
+
+		return (&t);
+	}
+
+	static void
+	insert_at(bstree *tree, T *elm, T *parent, int comp)
+	{
+		_rbt_insert_at(type(), tree, elm, parent, comp);
+	}
+
+	static void
+	remove(bstree *tree, T *elm)
+	{
+		_rbt_remove(type(), tree, elm);
+	}
+};
+
+template <class T, bst_entry T::*Entry, class Compare>
+struct bst_avl_ops {
+	typedef bst_node<T, Entry> node;
+
+	static const struct bst_type *
+	type(void)
+	{
+		static const struct bst_type t =
+		    node::template type<Compare>();
+
+		return (&t);
+	}
+
+	static void
+	insert_at(bstree *tree, T *elm, T *parent, int comp)
+	{
+		_avl_insert_at(type(), tree, elm, parent, comp);
+	}
+
+	static void
+	remove(bstree *tree, T *elm)
+	{
+		_avl_remove(type(), tree, elm);
+	}
+};
+
+template <class T, bst_entry T::*Entry, class Compare, class Ops>
+class bst_tree {
+	typedef bst_node<T, Entry> node;
+
+	bstree			 t_tree;
+
+public:
+	typedef T		 value_type;
+	typedef T		&reference;
+	typedef const T		&const_reference;
+	typedef T		*pointer;
+	typedef const T		*const_pointer;
+	typedef std::size_t	 size_type;
+	typedef std::ptrdiff_t	 difference_type;
+	typedef Compare		 value_compare;
+
+	typedef bst_iterator<T, Entry, T>		iterator;
+	typedef bst_iterator<T, Entry, const T>		const_iterator;
+	typedef std::reverse_iterator<iterator>		reverse_iterator;
+	typedef std::reverse_iterator<const_iterator>	const_reverse_iterator;
+
+	bst_tree()
+	{
+		_bst_init(&t_tree);
+	}
+
+	bst_tree(const bst_tree &) = delete;
+	bst_tree &operator=(const bst_tree &) = delete;
+
+	bst_tree(bst_tree &&tree)
+	{
+		t_tree = tree.t_tree;
+		_bst_init(&tree.t_tree);
+	}
+
+	bst_tree &
+	operator=(bst_tree &&tree)
+	{
+		swap(tree);
+		return (*this);
+	}
+
+	/* use a tree that was set up with the C macros */
+	static bst_tree &
+	from(bstree *tree)
+	{
+		return (*reinterpret_cast<bst_tree *>(tree));
+	}
+
+	bstree *
+	c_tree()
+	{
+		return (&t_tree);
+	}
+
+	void
+	swap(bst_tree &tree)
+	{
+		std::swap(t_tree, tree.t_tree);
+	}
+
+	bool
+	empty() const
+	{
+		return (t_tree.bst_root == nullptr);
+	}
+
+	/* this walks the whole tree */
+	size_type
+	size() const
+	{
+		return (std::distance(begin(), end()));
+	}
+
+	/* forgets every element. the elements are not touched */
+	void
+	clear()
+	{
+		_bst_init(&t_tree);
+	}
+
+	iterator
+	begin()
+	{
+		return (iterator(&t_tree, node::first(t_tree.bst_root)));
+	}
+
+	const_iterator
+	begin() const
+	{
+		return (const_iterator(&t_tree, node::first(t_tree.bst_root)));
+	}
+
+	const_iterator
+	cbegin() const
+	{
+		return (begin());
+	}
+
+	iterator
+	end()
+	{
+		return (iterator(&t_tree, nullptr));
+	}
+
+	const_iterator
+	end() const
+	{
+		return (const_iterator(&t_tree, nullptr));
+	}
+
+	const_iterator
+	cend() const
+	{
+		return (end());
+	}
+
+	reverse_iterator
+	rbegin()
+	{
+		return (reverse_iterator(end()));
+	}
+
+	const_reverse_iterator
+	rbegin() const
+	{
+		return (const_reverse_iterator(end()));
+	}
+
+	reverse_iterator
+	rend()
+	{
+		return (reverse_iterator(begin()));
+	}
+
+	const_reverse_iterator
+	rend() const
+	{
+		return (const_reverse_iterator(begin()));
+	}
+
+	/* elm must be in this tree */
+	iterator
+	iterator_to(T &elm)
+	{
+		return (iterator(&t_tree, node::entry(&elm)));
+	}
+
+	const_iterator
+	iterator_to(const T &elm) const
+	{
+		return (const_iterator(&t_tree, node::entry(&elm)));
+	}
+
+	/* fails and returns the existing element if the key is taken */
+	std::pair<iterator, bool>
+	insert(T &elm)
+	{
+		bst_entry *bste = t_tree.bst_root;
+		bst_entry *parent = nullptr, *prev = nullptr;
+		Compare cmp;
+		int comp = 0;
+
+		while (bste != nullptr) {
+			parent = bste;
+			comp = !cmp(elm, *node::elm(bste));
+			if (comp)
+				prev = bste;
+			bste = bste->bst_children[comp];
+		}
+
+		/* prev is the greatest node that is not greater than elm */
+		if (prev != nullptr && !cmp(*node::elm(prev), elm))
+			return (std::make_pair(iterator(&t_tree, prev), false));
+
+		Ops::insert_at(&t_tree, &elm,
+		    parent == nullptr ? nullptr : node::elm(parent), comp);
+
+		return (std::make_pair(iterator_to(elm), true));
+	}
+
+	/* inserts elm after any elements with the same key */
+	iterator
+	insert_equal(T &elm)
+	{
+		bst_entry *bste = t_tree.bst_root;
+		bst_entry *parent = nullptr;
+		Compare cmp;
+		int comp = 0;
+
+		while (bste != nullptr) {
+			parent = bste;
+			comp = !cmp(elm, *node::elm(bste));
+			bste = bste->bst_children[comp];
+		}
+
+		Ops::insert_at(&t_tree, &elm,
+		    parent == nullptr ? nullptr : node::elm(parent), comp);
+
+		return (iterator_to(elm));
+	}
+
+	iterator
+	erase(const_iterator it)
+	{
+		T *elm = node::elm(it.i_entry);
+		iterator next(&t_tree, node::step(it.i_entry, 1));
+
+		Ops::remove(&t_tree, elm);
+
+		return (next);
+	}
+
+	iterator
+	erase(const_iterator first, const_iterator last)
+	{
+		while (first != last)
+			first = erase(first);
+
+		return (iterator(&t_tree, last.i_entry));
+	}
+
+	/* removes every element with the same key */
+	template <class K, class = typename std::enable_if<
+	    !std::is_convertible<K, const_iterator>::value>::type>
+	size_type
+	erase(const K &key)
+	{
+		std::pair<iterator, iterator> r = equal_range(key);
+		size_type n = 0;
+
+		while (r.first != r.second) {
+			r.first = erase(r.first);
+			n++;
+		}
+
+		return (n);
+	}
+
+	template <class K>
+	iterator
+	lower_bound(const K &key)
+	{
+		return (iterator(&t_tree, lower(key)));
+	}
+
+	template <class K>
+	const_iterator
+	lower_bound(const K &key) const
+	{
+		return (const_iterator(&t_tree, lower(key)));
+	}
+
+	template <class K>
+	iterator
+	upper_bound(const K &key)
+	{
+		return (iterator(&t_tree, upper(key)));
+	}
+
+	template <class K>
+	const_iterator
+	upper_bound(const K &key) const
+	{
+		return (const_iterator(&t_tree, upper(key)));
+	}
+
+	template <class K>
+	std::pair<iterator, iterator>
+	equal_range(const K &key)
+	{
+		return (std::make_pair(lower_bound(key), upper_bound(key)));
+	}
+
+	template <class K>
+	std::pair<const_iterator, const_iterator>
+	equal_range(const K &key) const
+	{
+		return (std::make_pair(lower_bound(key), upper_bound(key)));
+	}
+
+	template <class K>
+	iterator
+	find(const K &key)
+	{
+		return (iterator(&t_tree, search(key)));
+	}
+
+	template <class K>
+	const_iterator
+	find(const K &key) const
+	{
+		return (const_iterator(&t_tree, search(key)));
+	}
+
+	template <class K>
+	size_type
+	count(const K &key) const
+	{
+		std::pair<const_iterator, const_iterator> r = equal_range(key);
+
+		return (std::distance(r.first, r.second));
+	}
+
+private:
+	template <class K>
+	bst_entry *
+	lower(const K &key) const
+	{
+		bst_entry *bste = t_tree.bst_root;
+		bst_entry *res = nullptr;
+		Compare cmp;
+
+		while (bste != nullptr) {
+			if (cmp(*node::elm(bste), key))
+				bste = bste->bst_children[1];
+			else {
+				res = bste;
+				bste = bste->bst_children[0];
+			}
+		}
+
+		return (res);
+	}
+
+	template <class K>
+	bst_entry *
+	upper(const K &key) const
+	{
+		bst_entry *bste = t_tree.bst_root;
+		bst_entry *res = nullptr;
+		Compare cmp;
+
+		while (bste != nullptr) {
+			if (cmp(key, *node::elm(bste))) {
+				res = bste;
+				bste = bste->bst_children[0];
+			} else
+				bste = bste->bst_children[1];
+		}
+
+		return (res);
+	}
+
+	template <class K>
+	bst_entry *
+	search(const K &key) const
+	{
+		bst_entry *bste = lower(key);
+		Compare cmp;
+
+		if (bste != nullptr && cmp(key, *node::elm(bste)))
+			bste = nullptr;
+
+		return (bste);
+	}
+};
+
+template <class T, bst_entry T::*Entry, class Compare = std::less<T>,
+    void (*Augment)(T *) = nullptr>
+using intrusive_rbtree = bst_tree<T, Entry, Compare,
+    bst_rbt_ops<T, Entry, Compare, Augment>>;
+
+template <class T, bst_entry T::*Entry, class Compare = std::less<T>>
+using intrusive_avltree = bst_tree<T, Entry, Compare,
+    bst_avl_ops<T, Entry, Compare>>;
+
+#endif /* _BST_HPP_ */
@@ -0,0 +1,138 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Merging several trees of the same type into one ordered stream.
+ *
+ * Each tree has a cursor on the next element it will give up, and the
+ * cursors are kept in a pairing heap ordered by those elements. The
+ * next element of the merge is the one under the cursor at the root
+ * of the heap. That cursor then moves on with _bst_next and goes back
+ * into the heap, which costs O(log k) for k trees.
+ *
+ * Equal elements come out in the order their trees were added. The
+ * trees must not be changed while they are being merged.
+ */
+
+#include <sys/types.h>
+
+#include "bst_merge.h"
+
+static int
+bst_merge_cmp(const struct bst_merge_cursor *a,
+    const struct bst_merge_cursor *b)
+{
+	int rv;
+
+	rv = (*a->bsmc_type->t_compare)(a->bsmc_elm, b->bsmc_elm);
+	if (rv != 0)
+		return (rv);
+
+	return (a->bsmc_idx < b->bsmc_idx ? -1 : 1);
+}
+
+HEAP_PROTOTYPE(bst_merge_heap, bst_merge_cursor);
+HEAP_GENERATE(bst_merge_heap, bst_merge_cursor, bsmc_entry, bst_merge_cmp);
+
+void
+_bst_merge_init(const struct bst_type *t, struct bst_merge *m)
+{
+	m->bsm_type = t;
+	HEAP_INIT(bst_merge_heap, &m->bsm_heap);
+	m->bsm_cursors = NULL;
+	m->bsm_ncursors = 0;
+}
+
+/* adds a tree to the merge, with its cursor on the first element */
+void
+_bst_merge_add(struct bst_merge *m, struct bst_merge_cursor *c,
+    struct bstree *bst)
+{
+	c->bsmc_type = m->bsm_type;
+	c->bsmc_tree = bst;
+	c->bsmc_idx = m->bsm_ncursors++;
+	c->bsmc_next = m->bsm_cursors;
+	m->bsm_cursors = c;
+
+	c->bsmc_elm = _bst_min(m->bsm_type, bst);
+	if (c->bsmc_elm != NULL)
+		HEAP_INSERT(bst_merge_heap, &m->bsm_heap, c);
+}
+
+/* moves every cursor to the first element greater than or equal to key */
+void
+_bst_merge_seek(struct bst_merge *m, const void *key)
+{
+	const struct bst_type *t = m->bsm_type;
+	struct bst_merge_cursor *c;
+	void *elm;
+
+	HEAP_INIT(bst_merge_heap, &m->bsm_heap);
+
+	for (c = m->bsm_cursors; c != NULL; c = c->bsmc_next) {
+		elm = _bst_nfind(t, c->bsmc_tree, key);
+
+		/* nfind may land in the middle of a run of equal keys */
+		if (elm != NULL && (*t->t_compare)(key, elm) == 0)
+			elm = _bst_find_first(t, c->bsmc_tree, key);
+
+		c->bsmc_elm = elm;
+		if (elm != NULL)
+			HEAP_INSERT(bst_merge_heap, &m->bsm_heap, c);
+	}
+}
+
+void *
+_bst_merge_next(struct bst_merge *m)
+{
+	struct bst_merge_cursor *c;
+	void *elm;
+
+	c = HEAP_FIRST(bst_merge_heap, &m->bsm_heap);
+	if (c == NULL)
+		return (NULL);
+
+	elm = c->bsmc_elm;
+	c->bsmc_elm = _bst_next(m->bsm_type, elm);
+
+	/* runs from one tree leave its cursor at the root */
+	if (c->bsmc_elm == NULL)
+		HEAP_REMOVE(bst_merge_heap, &m->bsm_heap, c);
+	else
+		HEAP_UPDATE(bst_merge_heap, &m->bsm_heap, c);
+
+	return (elm);
+}
+
+/* takes up to nelms elements off the merge, so the first n is cheap */
+unsigned int
+_bst_merge_fill(struct bst_merge *m, void **elms, unsigned int nelms)
+{
+	unsigned int n;
+	void *elm;
+
+	for (n = 0; n < nelms; n++) {
+		elm = _bst_merge_next(m);
+		if (elm == NULL)
+			break;
+
+		elms[n] = elm;
+	}
+
+	return (n);
+}
@@ -0,0 +1,120 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _BST_MERGE_H_
+#define _BST_MERGE_H_
+
+/*
+ * Merging several trees of the same type into one ordered stream.
+ *
+ * RBT_MERGE_PROTOTYPE follows the RBT_PROTOTYPE of the trees being
+ * merged, and provides RBT_MERGE_INIT, RBT_MERGE_ADD, RBT_MERGE_SEEK,
+ * RBT_MERGE_NEXT and RBT_MERGE_FILL. AVL_MERGE_PROTOTYPE does the same
+ * for AVL trees. A cursor is added for each tree, and both the merge
+ * and its cursors are owned by the caller.
+ */
+
+#include "bst.h"
+#include "heap.h"
+
+/* a tree being merged with others, see _bst_merge_init */
+struct bst_merge_cursor {
+	HEAP_ENTRY(bst_merge_cursor) bsmc_entry;
+	const struct bst_type	*bsmc_type;
+	struct bstree		*bsmc_tree;
+	void			*bsmc_elm;	/* next element, or NULL */
+	struct bst_merge_cursor	*bsmc_next;
+	unsigned int		 bsmc_idx;	/* orders equal elements */
+};
+
+HEAP_HEAD(bst_merge_heap);
+
+struct bst_merge {
+	const struct bst_type	*bsm_type;
+	struct bst_merge_heap	 bsm_heap;	/* cursors with elements */
+	struct bst_merge_cursor	*bsm_cursors;
+	unsigned int		 bsm_ncursors;
+};
+
+void	 _bst_merge_init(const struct bst_type *, struct bst_merge *);
+void	 _bst_merge_add(struct bst_merge *, struct bst_merge_cursor *,
+	     struct bstree *);
+void	 _bst_merge_seek(struct bst_merge *, const void *);
+void	*_bst_merge_next(struct bst_merge *);
+unsigned int
+	 _bst_merge_fill(struct bst_merge *, void **, unsigned int);
+
+#define BST_MERGE_PROTOTYPE(_name, _type, _fn, _t, _tree)		\
+__unused static inline void						\
+_fn##_MERGE_INIT(struct bst_merge *m)					\
+{									\
+	_bst_merge_init((_t), m);					\
+}									\
+									\
+__unused static inline void						\
+_fn##_MERGE_ADD(struct bst_merge *m,					\
+    struct bst_merge_cursor *c, struct _name *head)			\
+{									\
+	_bst_merge_add(m, c, &head->_tree);				\
+}									\
+									\
+__unused static inline void						\
+_fn##_MERGE_SEEK(struct bst_merge *m, const struct _type *key)		\
+{									\
+	_bst_merge_seek(m, key);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_fn##_MERGE_NEXT(struct bst_merge *m)					\
+{									\
+	return _bst_merge_next(m);					\
+}									\
+									\
+__unused static inline unsigned int					\
+_fn##_MERGE_FILL(struct bst_merge *m,					\
+    struct _type **elms, unsigned int nelms)				\
+{									\
+	return _bst_merge_fill(m, (void **)elms, nelms);		\
+}
+
+#define RBT_MERGE_PROTOTYPE(_name, _type)				\
+	BST_MERGE_PROTOTYPE(_name, _type, _name##_RBT,			\
+	    &_name##_RBT_TYPE.t_bst, rb_tree)
+#define AVL_MERGE_PROTOTYPE(_name, _type)				\
+	BST_MERGE_PROTOTYPE(_name, _type, _name##_AVL,			\
+	    &_name##_AVL_TYPE, avl_tree)
+
+#define RBT_MERGE_INIT(_name, _m)	_name##_RBT_MERGE_INIT(_m)
+#define RBT_MERGE_ADD(_name, _m, _c, _head)				\
+	_name##_RBT_MERGE_ADD(_m, _c, _head)
+#define RBT_MERGE_SEEK(_name, _m, _key)					\
+	_name##_RBT_MERGE_SEEK(_m, _key)
+#define RBT_MERGE_NEXT(_name, _m)	_name##_RBT_MERGE_NEXT(_m)
+#define RBT_MERGE_FILL(_name, _m, _elms, _n)				\
+	_name##_RBT_MERGE_FILL(_m, _elms, _n)
+
+#define AVL_MERGE_INIT(_name, _m)	_name##_AVL_MERGE_INIT(_m)
+#define AVL_MERGE_ADD(_name, _m, _c, _head)				\
+	_name##_AVL_MERGE_ADD(_m, _c, _head)
+#define AVL_MERGE_SEEK(_name, _m, _key)					\
+	_name##_AVL_MERGE_SEEK(_m, _key)
+#define AVL_MERGE_NEXT(_name, _m)	_name##_AVL_MERGE_NEXT(_m)
+#define AVL_MERGE_FILL(_name, _m, _elms, _n)				\
+	_name##_AVL_MERGE_FILL(_m, _elms, _n)
+
+#endif /* _BST_MERGE_H_ */
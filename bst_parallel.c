@@ -0,0 +1,184 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Walk a tree with several threads.
+ *
+ * The tree is split into units with _bst_split, and threads take the
+ * next unit in order until there are none left. The calling thread
+ * does work too, so nthreads includes it. Reductions keep a separate
+ * accumulator per unit and merge them in tree order at the end, so
+ * r_merge does not need to be commutative.
+ *
+ * The tree must not be modified while it is being walked.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bst.h"
+
+#define BST_PARALLEL_UNITS	8	/* units per thread */
+
+#define BST_PARALLEL_BATCH	64
+
+struct bst_parallel {
+	const struct bst_type	 *p_type;
+	struct bst_unit		 *p_units;
+	unsigned int		  p_nunits;
+	unsigned int		  p_next;
+
+	void			(*p_fn)(void *, void *);
+	const struct bst_reducer *p_reducer;
+	void			 *p_arg;
+	char			 *p_accs;
+};
+
+static void *
+bst_parallel_worker(void *arg)
+{
+	struct bst_parallel *p = arg;
+	const struct bst_type *t = p->p_type;
+	const struct bst_reducer *r = p->p_reducer;
+	struct bst_iter it;
+	void *elms[BST_PARALLEL_BATCH];
+	void *acc;
+	unsigned int u, n, i;
+
+	for (;;) {
+		u = __atomic_fetch_add(&p->p_next, 1, __ATOMIC_RELAXED);
+		if (u >= p->p_nunits)
+			break;
+
+		_bst_iter_unit(&it, &p->p_units[u]);
+
+		if (r == NULL) {
+			while ((n = _bst_iter_fill(t, &it,
+			    elms, BST_PARALLEL_BATCH)) > 0) {
+				for (i = 0; i < n; i++)
+					(*p->p_fn)(p->p_arg, elms[i]);
+			}
+			continue;
+		}
+
+		acc = p->p_accs + (size_t)u * r->r_size;
+		(*r->r_init)(p->p_arg, acc);
+		while ((n = _bst_iter_fill(t, &it,
+		    elms, BST_PARALLEL_BATCH)) > 0) {
+			for (i = 0; i < n; i++)
+				(*r->r_elm)(p->p_arg, acc, elms[i]);
+		}
+	}
+
+	return (NULL);
+}
+
+static int
+bst_parallel_run(struct bst_parallel *p, struct bstree *bst,
+    unsigned int nthreads, unsigned long (*weight)(const void *))
+{
+	pthread_t *threads;
+	unsigned int i, n;
+
+	if (nthreads == 0)
+		nthreads = 1;
+
+	p->p_units = calloc(nthreads, sizeof(*p->p_units) * BST_PARALLEL_UNITS);
+	if (p->p_units == NULL)
+		return (ENOMEM);
+
+	p->p_nunits = _bst_split(p->p_type, bst, p->p_units,
+	    nthreads * BST_PARALLEL_UNITS, weight);
+	p->p_next = 0;
+
+	if (p->p_reducer != NULL) {
+		p->p_accs = calloc(p->p_nunits, p->p_reducer->r_size);
+		if (p->p_accs == NULL && p->p_nunits > 0) {
+			free(p->p_units);
+			return (ENOMEM);
+		}
+	}
+
+	/* the calling thread picks up any threads that couldn't start */
+	threads = calloc(nthreads, sizeof(*threads));
+	n = 0;
+	if (threads != NULL) {
+		for (i = 1; i < nthreads; i++) {
+			if (pthread_create(&threads[n], NULL,
+			    bst_parallel_worker, p) != 0)
+				break;
+			n++;
+		}
+	}
+
+	bst_parallel_worker(p);
+
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(p->p_units);
+
+	return (0);
+}
+
+int
+_bst_parallel_foreach(const struct bst_type *t, struct bstree *bst,
+    unsigned int nthreads, unsigned long (*weight)(const void *),
+    void (*fn)(void *, void *), void *arg)
+{
+	struct bst_parallel p;
+
+	memset(&p, 0, sizeof(p));
+	p.p_type = t;
+	p.p_fn = fn;
+	p.p_arg = arg;
+
+	return (bst_parallel_run(&p, bst, nthreads, weight));
+}
+
+int
+_bst_parallel_reduce(const struct bst_type *t, struct bstree *bst,
+    unsigned int nthreads, unsigned long (*weight)(const void *),
+    const struct bst_reducer *r, void *arg, void *result)
+{
+	struct bst_parallel p;
+	unsigned int u;
+	int error;
+
+	memset(&p, 0, sizeof(p));
+	p.p_type = t;
+	p.p_reducer = r;
+	p.p_arg = arg;
+
+	error = bst_parallel_run(&p, bst, nthreads, weight);
+	if (error != 0)
+		return (error);
+
+	(*r->r_init)(arg, result);
+	for (u = 0; u < p.p_nunits; u++)
+		(*r->r_merge)(arg, result, p.p_accs + (size_t)u * r->r_size);
+
+	free(p.p_accs);
+
+	return (0);
+}
@@ -0,0 +1,251 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Tree snapshots.
+ *
+ * A snapshot is a header followed by a copy of every element in the
+ * tree, in order. The bst_entry in each copy is zeroed; any other
+ * pointers inside the elements are written out as they are, so it is
+ * up to the caller to fix those up after a load.
+ *
+ * Snapshots are written with large sequential writes from a bounce
+ * buffer while the tree is walked, and the header is rewritten with
+ * the element count at the end, so the file descriptor must refer to
+ * something that can be seeked.
+ *
+ * Loading works on a snapshot that is already in memory, usually via
+ * a MAP_PRIVATE mmap of the file. The elements can be linked into the
+ * tree where they sit in the mapping, or the caller can supply a
+ * function that returns where each one should live instead. Either way
+ * the tree is rebuilt with _rbt_build or _avl_build in linear time
+ * without calling the comparison function.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bst.h"
+
+#define BST_SNAPSHOT_MAGIC	0x62737473	/* "bsts" */
+#define BST_SNAPSHOT_VERSION	1
+
+#define BST_SNAPSHOT_BUFSIZE	(1024 * 1024)
+#define BST_SNAPSHOT_BATCH	64
+
+struct bst_snapshot {
+	uint32_t		bss_magic;
+	uint32_t		bss_version;
+	uint32_t		bss_elmsize;
+	uint32_t		bss_entry;	/* offset of the bst_entry */
+	uint32_t		bss_keyoff;
+	uint32_t		bss_keylen;
+	uint64_t		bss_nelms;
+	uint8_t			bss_pad[32];	/* keep the elements aligned */
+};
+
+struct bst_snapshot_load {
+	char			*l_elm;
+	size_t			 l_elmsize;
+	void			*(*l_fn)(void *, void *);
+	void			*l_arg;
+};
+
+static int
+bst_snapshot_flush(int fd, const char *buf, size_t len)
+{
+	ssize_t rv;
+
+	while (len > 0) {
+		rv = write(fd, buf, len);
+		if (rv == -1) {
+			if (errno == EINTR)
+				continue;
+			return (errno);
+		}
+
+		buf += rv;
+		len -= rv;
+	}
+
+	return (0);
+}
+
+int
+_bst_snapshot_write(const struct bst_type *t, struct bstree *bst, int fd,
+    size_t elmsize, size_t keyoff, size_t keylen)
+{
+	struct bst_snapshot bss;
+	struct bst_iter it;
+	void *elms[BST_SNAPSHOT_BATCH];
+	char *buf;
+	size_t len, bufsize;
+	off_t off;
+	ssize_t rv;
+	unsigned int i, n;
+	int error;
+
+	/* the header is rewritten with the element count at the end */
+	off = lseek(fd, 0, SEEK_CUR);
+	if (off == -1)
+		return (errno);
+
+	bufsize = BST_SNAPSHOT_BUFSIZE;
+	if (bufsize < sizeof(bss) + elmsize)
+		bufsize = sizeof(bss) + elmsize;
+
+	buf = malloc(bufsize);
+	if (buf == NULL)
+		return (ENOMEM);
+
+	memset(&bss, 0, sizeof(bss));
+	bss.bss_magic = BST_SNAPSHOT_MAGIC;
+	bss.bss_version = BST_SNAPSHOT_VERSION;
+	bss.bss_elmsize = elmsize;
+	bss.bss_entry = t->t_offset;
+	bss.bss_keyoff = keyoff;
+	bss.bss_keylen = keylen;
+
+	memcpy(buf, &bss, sizeof(bss));
+	len = sizeof(bss);
+
+	_bst_iter_init(bst, &it);
+	while ((n = _bst_iter_fill(t, &it, elms, BST_SNAPSHOT_BATCH)) > 0) {
+		for (i = 0; i < n; i++) {
+			if (bufsize - len < elmsize) {
+				error = bst_snapshot_flush(fd, buf, len);
+				if (error != 0)
+					goto fail;
+				len = 0;
+			}
+
+			memcpy(buf + len, elms[i], elmsize);
+			memset(buf + len + t->t_offset, 0,
+			    sizeof(struct bst_entry));
+			len += elmsize;
+			bss.bss_nelms++;
+		}
+	}
+
+	error = bst_snapshot_flush(fd, buf, len);
+	if (error != 0)
+		goto fail;
+
+	rv = pwrite(fd, &bss, sizeof(bss), off);
+	if (rv == -1)
+		error = errno;
+	else if ((size_t)rv != sizeof(bss))
+		error = EIO;
+
+fail:
+	free(buf);
+	return (error);
+}
+
+static void *
+bst_snapshot_next(void *arg)
+{
+	struct bst_snapshot_load *l = arg;
+	void *elm = l->l_elm;
+
+	l->l_elm += l->l_elmsize;
+
+	if (l->l_fn != NULL)
+		elm = (*l->l_fn)(l->l_arg, elm);
+
+	return (elm);
+}
+
+static int
+bst_snapshot_check(const struct bst_type *t, struct bstree *bst,
+    void *map, size_t len, size_t elmsize, size_t keyoff, size_t keylen,
+    struct bst_snapshot_load *l, size_t *nelmsp)
+{
+	const struct bst_snapshot *bss = map;
+	uint64_t nelms;
+
+	if (!_bst_empty(bst))
+		return (EBUSY);
+
+	if (len < sizeof(*bss))
+		return (EINVAL);
+
+	if (bss->bss_magic != BST_SNAPSHOT_MAGIC ||
+	    bss->bss_version != BST_SNAPSHOT_VERSION)
+		return (EINVAL);
+
+	/* the snapshot has to be of the same type */
+	if (bss->bss_elmsize != elmsize ||
+	    bss->bss_entry != t->t_offset ||
+	    bss->bss_keyoff != keyoff ||
+	    bss->bss_keylen != keylen)
+		return (EINVAL);
+
+	nelms = bss->bss_nelms;
+	if (elmsize == 0 || nelms > (len - sizeof(*bss)) / elmsize)
+		return (EINVAL);
+
+	l->l_elm = (char *)map + sizeof(*bss);
+	l->l_elmsize = elmsize;
+	*nelmsp = nelms;
+
+	return (0);
+}
+
+int
+_rbt_snapshot_load(const struct rbt_type *t, struct bstree *rbt,
+    void *map, size_t len, size_t elmsize, size_t keyoff, size_t keylen,
+    void *(*fn)(void *, void *), void *arg)
+{
+	struct bst_snapshot_load l = { .l_fn = fn, .l_arg = arg };
+	size_t nelms;
+	int error;
+
+	error = bst_snapshot_check(&t->t_bst, rbt, map, len,
+	    elmsize, keyoff, keylen, &l, &nelms);
+	if (error != 0)
+		return (error);
+
+	_rbt_build(t, rbt, nelms, bst_snapshot_next, &l);
+
+	return (0);
+}
+
+int
+_avl_snapshot_load(const struct bst_type *t, struct bstree *avlt,
+    void *map, size_t len, size_t elmsize, size_t keyoff, size_t keylen,
+    void *(*fn)(void *, void *), void *arg)
+{
+	struct bst_snapshot_load l = { .l_fn = fn, .l_arg = arg };
+	size_t nelms;
+	int error;
+
+	error = bst_snapshot_check(t, avlt, map, len,
+	    elmsize, keyoff, keylen, &l, &nelms);
+	if (error != 0)
+		return (error);
+
+	_avl_build(t, avlt, nelms, bst_snapshot_next, &l);
+
+	return (0);
+}
@@ -0,0 +1,88 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The counters bst.c adds to when it is built with BST_STATS. They live
+ * here rather than in bst.c because bstr.c builds bst.c a second time.
+ *
+ * Each thread takes the next slot the first time it counts something.
+ * Only that thread writes to its slot, so the counters are updated
+ * without atomic read-modify-write operations, but a snapshot taken
+ * while trees are busy may be missing the latest updates. Programs
+ * with more threads than BST_STATS_SLOTS share slots and can lose
+ * counts.
+ */
+
+#include <sys/types.h>
+
+#include "bst.h"
+
+#ifdef BST_STATS
+#define BST_STATS_NCOUNTERS						\
+	(sizeof(struct bst_counters) / sizeof(uint64_t))
+
+__thread unsigned int _bst_stats_idx;
+static unsigned int bst_stats_threads;
+
+unsigned int
+_bst_stats_assign(void)
+{
+	unsigned int n;
+
+	n = __atomic_fetch_add(&bst_stats_threads, 1, __ATOMIC_RELAXED);
+	_bst_stats_idx = n % BST_STATS_SLOTS + 1;
+
+	return (_bst_stats_idx);
+}
+
+void
+_bst_stats_snapshot(const struct bst_type *t, struct bst_counters *bstc)
+{
+	uint64_t *dst = (uint64_t *)bstc;
+	const uint64_t *src;
+	unsigned int i, c;
+
+	for (c = 0; c < BST_STATS_NCOUNTERS; c++)
+		dst[c] = 0;
+
+	if (t->t_stats == NULL)
+		return;
+
+	for (i = 0; i < BST_STATS_SLOTS; i++) {
+		src = (const uint64_t *)&t->t_stats->bs_slots[i].bss_counters;
+		for (c = 0; c < BST_STATS_NCOUNTERS; c++)
+			dst[c] += __atomic_load_n(&src[c], __ATOMIC_RELAXED);
+	}
+}
+
+void
+_bst_stats_reset(const struct bst_type *t)
+{
+	uint64_t *dst;
+	unsigned int i, c;
+
+	if (t->t_stats == NULL)
+		return;
+
+	for (i = 0; i < BST_STATS_SLOTS; i++) {
+		dst = (uint64_t *)&t->t_stats->bs_slots[i].bss_counters;
+		for (c = 0; c < BST_STATS_NCOUNTERS; c++)
+			__atomic_store_n(&dst[c], 0, __ATOMIC_RELAXED);
+	}
+}
+#endif /* BST_STATS */
@@ -0,0 +1,81 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Build the tree code in bst.c a second time for relative trees.
+ *
+ * bst.c only reads and writes links via its BST_LINK macros, which
+ * BST_RELATIVE switches over to self-relative offsets. The types and
+ * functions are renamed to the bstr.h versions around the include.
+ */
+
+#include "bstr.h"
+
+#define bst_entry		bstr_entry
+#define bst_pentry		bstr_pentry
+#define bstree			bstr_tree
+#define bst_iter		bstr_iter
+#define bst_unit		bstr_unit
+
+#define _bst_find		_bstr_find
+#define _bst_nfind		_bstr_nfind
+#define _bst_find_first		_bstr_find_first
+#define _bst_find_last		_bstr_find_last
+#define _bst_count		_bstr_count
+#define _bst_root		_bstr_root
+#define _bst_min		_bstr_min
+#define _bst_max		_bstr_max
+#define _bst_next		_bstr_next
+#define _bst_prev		_bstr_prev
+#define _bst_left		_bstr_left
+#define _bst_right		_bstr_right
+#define _bst_parent		_bstr_parent
+#define _bst_set_left		_bstr_set_left
+#define _bst_set_right		_bstr_set_right
+#define _bst_set_parent		_bstr_set_parent
+#define _bst_poison		_bstr_poison
+#define _bst_check		_bstr_check
+#define _bst_iter_init		_bstr_iter_init
+#define _bst_iter_range		_bstr_iter_range
+#define _bst_iter_fill		_bstr_iter_fill
+#define _bst_walk		_bstr_walk
+#define _bst_split		_bstr_split
+#define _bst_iter_unit		_bstr_iter_unit
+#define _bst_relocate		_bstr_relocate
+
+#define _rbt_insert		_rbtr_insert
+#define _rbt_remove		_rbtr_remove
+#define _rbt_insert_multi	_rbtr_insert_multi
+#define _rbt_insert_at		_rbtr_insert_at
+#define _rbt_delete_key		_rbtr_delete_key
+#define _rbt_find_or_insert	_rbtr_find_or_insert
+#define _rbt_upsert		_rbtr_upsert
+#define _rbt_build		_rbtr_build
+
+#define _avl_insert		_avlr_insert
+#define _avl_remove		_avlr_remove
+#define _avl_insert_multi	_avlr_insert_multi
+#define _avl_insert_at		_avlr_insert_at
+#define _avl_delete_key		_avlr_delete_key
+#define _avl_find_or_insert	_avlr_find_or_insert
+#define _avl_upsert		_avlr_upsert
+#define _avl_build		_avlr_build
+
+#define BST_RELATIVE
+
+#include "bst.c"
@@ -0,0 +1,592 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _BSTR_H_
+#define _BSTR_H_
+
+/*
+ * Relative trees.
+ *
+ * These are the same RB and AVL trees as bst.h, but the links between
+ * entries (and from the head to the root) are stored as offsets from
+ * the link itself rather than as pointers. A tree where the head and
+ * all the elements live in the same mapping can therefore be used at
+ * whatever address that mapping appears, eg, in shared memory mapped
+ * by several processes, or in a file that is mmapped again later.
+ *
+ * The head is declared with RBT_REL_HEAD and the entry with
+ * RBT_REL_ENTRY, and RBT_REL_PROTOTYPE replaces RBT_PROTOTYPE.
+ * RBT_GENERATE, RBT_GENERATE_AUGMENT and RBT_GENERATE_PREFIX (with a
+ * RBT_REL_PREFIX_ENTRY) are used as normal, and the rest of the RBT
+ * macros then operate on the tree as usual. The AVL macros work the
+ * same way.
+ *
+ * Elements must not be copied or moved while they are in a tree.
+ * The parallel walks and snapshots from bst.h are not provided, since
+ * a relative tree can simply be mapped again, and neither are the
+ * merges from bst_merge.h.
+ */
+
+#include "bst.h"
+
+struct bstr_entry {
+	long		  bst_parent;
+	long		  bst_children[2];
+	unsigned int	  bst_data;
+};
+
+struct bstr_pentry {
+	struct bstr_entry bstp_entry;
+	uint64_t	  bstp_prefix;
+};
+
+struct bstr_tree {
+	long		  bst_root;
+};
+
+struct bstr_iter {
+	const void	 *bsti_hi;	/* inclusive upper bound, or NULL */
+	unsigned int	  bsti_once;	/* only the node on the stack */
+	unsigned int	  bsti_depth;
+	struct bstr_entry *bsti_stack[BST_ITER_DEPTH];
+};
+
+struct bstr_unit {
+	struct bstr_entry *bstu_root;
+	unsigned long	  bstu_weight;
+	unsigned int	  bstu_subtree;	/* 0 if bstu_root is on its own */
+};
+
+#define BSTR_INITIALIZER()	{ 0 }
+
+static inline void
+_bstr_init(struct bstr_tree *bst)
+{
+	bst->bst_root = 0;
+}
+
+static inline int
+_bstr_empty(struct bstr_tree *bst)
+{
+	return (bst->bst_root == 0);
+}
+
+void	*_bstr_find(const struct bst_type *, struct bstr_tree *, const void *);
+void	*_bstr_nfind(const struct bst_type *, struct bstr_tree *,
+	     const void *);
+void	*_bstr_find_first(const struct bst_type *, struct bstr_tree *,
+	     const void *);
+void	*_bstr_find_last(const struct bst_type *, struct bstr_tree *,
+	     const void *);
+size_t	 _bstr_count(const struct bst_type *, struct bstr_tree *, const void *);
+void	*_bstr_root(const struct bst_type *, struct bstr_tree *);
+void	*_bstr_min(const struct bst_type *, struct bstr_tree *);
+void	*_bstr_max(const struct bst_type *, struct bstr_tree *);
+void	*_bstr_next(const struct bst_type *, void *);
+void	*_bstr_prev(const struct bst_type *, void *);
+void	*_bstr_left(const struct bst_type *, void *);
+void	*_bstr_right(const struct bst_type *, void *);
+void	*_bstr_parent(const struct bst_type *, void *);
+void	 _bstr_set_left(const struct bst_type *, void *, void *);
+void	 _bstr_set_right(const struct bst_type *, void *, void *);
+void	 _bstr_set_parent(const struct bst_type *, void *, void *);
+void	 _bstr_poison(const struct bst_type *, void *, unsigned long);
+int	 _bstr_check(const struct bst_type *, void *, unsigned long);
+void	 _bstr_iter_init(struct bstr_tree *, struct bstr_iter *);
+void	 _bstr_iter_range(const struct bst_type *, struct bstr_tree *,
+	     struct bstr_iter *, const void *, const void *);
+unsigned int
+	 _bstr_iter_fill(const struct bst_type *, struct bstr_iter *,
+	     void **, unsigned int);
+int	 _bstr_walk(const struct bst_type *, struct bstr_tree *,
+	     const void *, const void *,
+	     int (*)(void *, void **, unsigned int), void *);
+unsigned int
+	 _bstr_split(const struct bst_type *, struct bstr_tree *,
+	     struct bstr_unit *, unsigned int,
+	     unsigned long (*)(const void *));
+void	 _bstr_iter_unit(struct bstr_iter *, const struct bstr_unit *);
+void	 _bstr_relocate(const struct bst_type *, struct bstr_tree *,
+	     unsigned int, void *(*)(void *, void *), void *);
+
+/*
+ * red-black tree
+ */
+
+#define RBT_REL_HEAD(_name, _type)					\
+struct _name {								\
+	struct bstr_tree rb_tree;					\
+}
+
+#define RBT_REL_ENTRY(_type)	struct bstr_entry
+#define RBT_REL_PREFIX_ENTRY(_type) struct bstr_pentry
+
+#define RBT_REL_INITIALIZER(_head) { BSTR_INITIALIZER() }
+
+void	*_rbtr_insert(const struct rbt_type *, struct bstr_tree *, void *);
+void	*_rbtr_remove(const struct rbt_type *, struct bstr_tree *, void *);
+void	 _rbtr_insert_multi(const struct rbt_type *, struct bstr_tree *,
+	     void *);
+void	 _rbtr_insert_at(const struct rbt_type *, struct bstr_tree *, void *,
+	     void *, int);
+void	*_rbtr_delete_key(const struct rbt_type *, struct bstr_tree *,
+	     const void *);
+void	*_rbtr_find_or_insert(const struct rbt_type *, struct bstr_tree *,
+	     const void *, void *(*)(void *, const void *), void *);
+void	*_rbtr_upsert(const struct rbt_type *, struct bstr_tree *, void *);
+void	 _rbtr_build(const struct rbt_type *, struct bstr_tree *, size_t,
+	     void *(*)(void *), void *);
+
+#define RBT_REL_PROTOTYPE(_name, _type, _field, _cmp)			\
+extern const struct rbt_type _name##_RBT_TYPE;				\
+									\
+__unused static inline void						\
+_name##_RBT_INIT(struct _name *head)					\
+{									\
+	_bstr_init(&head->rb_tree);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_INSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _rbtr_insert(&_name##_RBT_TYPE, &head->rb_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_REMOVE(struct _name *head, struct _type *elm)		\
+{									\
+	return _rbtr_remove(&_name##_RBT_TYPE, &head->rb_tree, elm);	\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_INSERT_MULTI(struct _name *head, struct _type *elm)		\
+{									\
+	_rbtr_insert_multi(&_name##_RBT_TYPE, &head->rb_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_DELETE_KEY(struct _name *head, const struct _type *key)	\
+{									\
+	return _rbtr_delete_key(&_name##_RBT_TYPE, &head->rb_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_FIND_OR_INSERT(struct _name *head, const struct _type *key,	\
+    void *(*ctor)(void *, const void *), void *arg)			\
+{									\
+	return _rbtr_find_or_insert(&_name##_RBT_TYPE, &head->rb_tree,	\
+	    key, ctor, arg);						\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_UPSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _rbtr_upsert(&_name##_RBT_TYPE, &head->rb_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_FIND(struct _name *head, const struct _type *key)		\
+{									\
+	return _bstr_find(&_name##_RBT_TYPE.t_bst,			\
+	    &head->rb_tree, key);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_NFIND(struct _name *head, const struct _type *key)		\
+{									\
+	return _bstr_nfind(&_name##_RBT_TYPE.t_bst,			\
+	    &head->rb_tree, key);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_FIND_FIRST(struct _name *head, const struct _type *key)	\
+{									\
+	return _bstr_find_first(&_name##_RBT_TYPE.t_bst,		\
+	    &head->rb_tree, key);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_FIND_LAST(struct _name *head, const struct _type *key)	\
+{									\
+	return _bstr_find_last(&_name##_RBT_TYPE.t_bst, &head->rb_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline size_t						\
+_name##_RBT_COUNT(struct _name *head, const struct _type *key)		\
+{									\
+	return _bstr_count(&_name##_RBT_TYPE.t_bst, &head->rb_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_ROOT(struct _name *head)					\
+{									\
+	return _bstr_root(&_name##_RBT_TYPE.t_bst, &head->rb_tree);	\
+}									\
+									\
+__unused static inline int						\
+_name##_RBT_EMPTY(struct _name *head)					\
+{									\
+	return _bstr_empty(&head->rb_tree);				\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_MIN(struct _name *head)					\
+{									\
+	return _bstr_min(&_name##_RBT_TYPE.t_bst, &head->rb_tree);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_MAX(struct _name *head)					\
+{									\
+	return _bstr_max(&_name##_RBT_TYPE.t_bst, &head->rb_tree);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_NEXT(struct _type *elm)					\
+{									\
+	return _bstr_next(&_name##_RBT_TYPE.t_bst, elm);		\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_PREV(struct _type *elm)					\
+{									\
+	return _bstr_prev(&_name##_RBT_TYPE.t_bst, elm);		\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_LEFT(struct _type *elm)					\
+{									\
+	return _bstr_left(&_name##_RBT_TYPE.t_bst, elm);		\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_RIGHT(struct _type *elm)					\
+{									\
+	return _bstr_right(&_name##_RBT_TYPE.t_bst, elm);		\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBT_PARENT(struct _type *elm)					\
+{									\
+	return _bstr_parent(&_name##_RBT_TYPE.t_bst, elm);		\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_SET_LEFT(struct _type *elm, struct _type *left)		\
+{									\
+	_bstr_set_left(&_name##_RBT_TYPE.t_bst, elm, left);		\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_SET_RIGHT(struct _type *elm, struct _type *right)		\
+{									\
+	_bstr_set_right(&_name##_RBT_TYPE.t_bst, elm, right);		\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_SET_PARENT(struct _type *elm, struct _type *parent)		\
+{									\
+	_bstr_set_parent(&_name##_RBT_TYPE.t_bst, elm, parent);		\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_POISON(struct _type *elm, unsigned long poison)		\
+{									\
+	_bstr_poison(&_name##_RBT_TYPE.t_bst, elm, poison);		\
+}									\
+									\
+__unused static inline int						\
+_name##_RBT_CHECK(struct _type *elm, unsigned long poison)		\
+{									\
+	return _bstr_check(&_name##_RBT_TYPE.t_bst, elm, poison);	\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_ITER_INIT(struct _name *head, struct bstr_iter *it)		\
+{									\
+	_bstr_iter_init(&head->rb_tree, it);				\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_ITER_RANGE(struct _name *head,				\
+    struct bstr_iter *it, const struct _type *lo,			\
+    const struct _type *hi)						\
+{									\
+	_bstr_iter_range(&_name##_RBT_TYPE.t_bst, &head->rb_tree, it,	\
+	    lo, hi);							\
+}									\
+									\
+__unused static inline unsigned int					\
+_name##_RBT_ITER_FILL(struct bstr_iter *it,				\
+    struct _type **elms, unsigned int nelms)				\
+{									\
+	return _bstr_iter_fill(&_name##_RBT_TYPE.t_bst, it,		\
+	    (void **)elms, nelms);					\
+}									\
+									\
+__unused static inline int						\
+_name##_RBT_WALK(struct _name *head, const struct _type *lo,		\
+    const struct _type *hi, int (*fn)(void *, void **, unsigned int),	\
+    void *arg)								\
+{									\
+	return _bstr_walk(&_name##_RBT_TYPE.t_bst, &head->rb_tree,	\
+	    lo, hi, fn, arg);						\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_BUILD(struct _name *head, size_t n,				\
+    void *(*next)(void *), void *arg)					\
+{									\
+	_rbtr_build(&_name##_RBT_TYPE, &head->rb_tree, n, next, arg);	\
+}									\
+									\
+__unused static inline void						\
+_name##_RBT_RELOCATE(struct _name *head, unsigned int order,		\
+    void *(*move)(void *, void *), void *arg)				\
+{									\
+	_bstr_relocate(&_name##_RBT_TYPE.t_bst, &head->rb_tree,		\
+	    order, move, arg);						\
+}									\
+BST_STATS_PROTOTYPE(_name##_RBT, &_name##_RBT_TYPE.t_bst)
+
+/*
+ * AVL tree
+ */
+
+#define AVL_REL_HEAD(_name, _type)					\
+struct _name {								\
+	struct bstr_tree avl_tree;					\
+}
+
+#define AVL_REL_ENTRY(_type)	struct bstr_entry
+#define AVL_REL_PREFIX_ENTRY(_type) struct bstr_pentry
+
+#define AVL_REL_INITIALIZER(_head) { BSTR_INITIALIZER() }
+
+void	*_avlr_insert(const struct bst_type *, struct bstr_tree *, void *);
+void	*_avlr_remove(const struct bst_type *, struct bstr_tree *, void *);
+void	 _avlr_insert_multi(const struct bst_type *, struct bstr_tree *,
+	     void *);
+void	 _avlr_insert_at(const struct bst_type *, struct bstr_tree *, void *,
+	     void *, int);
+void	*_avlr_delete_key(const struct bst_type *, struct bstr_tree *,
+	     const void *);
+void	*_avlr_find_or_insert(const struct bst_type *, struct bstr_tree *,
+	     const void *, void *(*)(void *, const void *), void *);
+void	*_avlr_upsert(const struct bst_type *, struct bstr_tree *, void *);
+void	 _avlr_build(const struct bst_type *, struct bstr_tree *, size_t,
+	     void *(*)(void *), void *);
+
+#define AVL_REL_PROTOTYPE(_name, _type, _field, _cmp)			\
+extern const struct bst_type _name##_AVL_TYPE;				\
+									\
+__unused static inline void						\
+_name##_AVL_INIT(struct _name *head)					\
+{									\
+	_bstr_init(&head->avl_tree);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_INSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _avlr_insert(&_name##_AVL_TYPE, &head->avl_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_REMOVE(struct _name *head, struct _type *elm)		\
+{									\
+	return _avlr_remove(&_name##_AVL_TYPE, &head->avl_tree, elm);	\
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_INSERT_MULTI(struct _name *head, struct _type *elm)		\
+{									\
+	_avlr_insert_multi(&_name##_AVL_TYPE, &head->avl_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_DELETE_KEY(struct _name *head, const struct _type *key)	\
+{									\
+	return _avlr_delete_key(&_name##_AVL_TYPE, &head->avl_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_FIND_OR_INSERT(struct _name *head, const struct _type *key,	\
+    void *(*ctor)(void *, const void *), void *arg)			\
+{									\
+	return _avlr_find_or_insert(&_name##_AVL_TYPE, &head->avl_tree,	\
+	    key, ctor, arg);						\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_UPSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _avlr_upsert(&_name##_AVL_TYPE, &head->avl_tree, elm);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_FIND(struct _name *head, const struct _type *key)		\
+{									\
+	return _bstr_find(&_name##_AVL_TYPE, &head->avl_tree, key);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_NFIND(struct _name *head, const struct _type *key)		\
+{									\
+	return _bstr_nfind(&_name##_AVL_TYPE, &head->avl_tree, key);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_FIND_FIRST(struct _name *head, const struct _type *key)	\
+{									\
+	return _bstr_find_first(&_name##_AVL_TYPE, &head->avl_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_FIND_LAST(struct _name *head, const struct _type *key)	\
+{									\
+	return _bstr_find_last(&_name##_AVL_TYPE, &head->avl_tree,	\
+	    key);							\
+}									\
+									\
+__unused static inline size_t						\
+_name##_AVL_COUNT(struct _name *head, const struct _type *key)		\
+{									\
+	return _bstr_count(&_name##_AVL_TYPE, &head->avl_tree, key);	\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_ROOT(struct _name *head)					\
+{									\
+	return _bstr_root(&_name##_AVL_TYPE, &head->avl_tree);		\
+}									\
+									\
+__unused static inline int						\
+_name##_AVL_EMPTY(struct _name *head)					\
+{									\
+	return _bstr_empty(&head->avl_tree);				\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_MIN(struct _name *head)					\
+{									\
+	return _bstr_min(&_name##_AVL_TYPE, &head->avl_tree);		\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_MAX(struct _name *head)					\
+{									\
+	return _bstr_max(&_name##_AVL_TYPE, &head->avl_tree);		\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_NEXT(struct _type *elm)					\
+{									\
+	return _bstr_next(&_name##_AVL_TYPE, elm);			\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_PREV(struct _type *elm)					\
+{									\
+	return _bstr_prev(&_name##_AVL_TYPE, elm);			\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_LEFT(struct _type *elm)					\
+{									\
+	return _bstr_left(&_name##_AVL_TYPE, elm);			\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_RIGHT(struct _type *elm)					\
+{									\
+	return _bstr_right(&_name##_AVL_TYPE, elm);			\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_AVL_PARENT(struct _type *elm)					\
+{									\
+	return _bstr_parent(&_name##_AVL_TYPE, elm);			\
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_POISON(struct _type *elm, unsigned long poison)		\
+{									\
+	return _bstr_poison(&_name##_AVL_TYPE, elm, poison);		\
+}									\
+									\
+__unused static inline int						\
+_name##_AVL_CHECK(struct _type *elm, unsigned long poison)		\
+{									\
+	return _bstr_check(&_name##_AVL_TYPE, elm, poison);		\
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_ITER_INIT(struct _name *head, struct bstr_iter *it)		\
+{									\
+	_bstr_iter_init(&head->avl_tree, it);				\
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_ITER_RANGE(struct _name *head,				\
+    struct bstr_iter *it, const struct _type *lo,			\
+    const struct _type *hi)						\
+{									\
+	_bstr_iter_range(&_name##_AVL_TYPE, &head->avl_tree, it,	\
+	    lo, hi);							\
+}									\
+									\
+__unused static inline unsigned int					\
+_name##_AVL_ITER_FILL(struct bstr_iter *it,				\
+    struct _type **elms, unsigned int nelms)				\
+{									\
+	return _bstr_iter_fill(&_name##_AVL_TYPE, it,			\
+	    (void **)elms, nelms);					\
+}									\
+									\
+__unused static inline int						\
+_name##_AVL_WALK(struct _name *head, const struct _type *lo,		\
+    const struct _type *hi, int (*fn)(void *, void **, unsigned int),	\
+    void *arg)								\
+{									\
+	return _bstr_walk(&_name##_AVL_TYPE, &head->avl_tree,		\
+	    lo, hi, fn, arg);						\
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_BUILD(struct _name *head, size_t n,				\
+    void *(*next)(void *), void *arg)					\
+{									\
+	_avlr_build(&_name##_AVL_TYPE, &head->avl_tree, n, next, arg);	\
+}									\
+									\
+__unused static inline void						\
+_name##_AVL_RELOCATE(struct _name *head, unsigned int order,		\
+    void *(*move)(void *, void *), void *arg)				\
+{									\
+	_bstr_relocate(&_name##_AVL_TYPE, &head->avl_tree,		\
+	    order, move, arg);						\
+}									\
+BST_STATS_PROTOTYPE(_name##_AVL, &_name##_AVL_TYPE)
+
+#endif /* _BSTR_H_ */
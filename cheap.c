@@ -0,0 +1,410 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "cheap.h"
+
+#define CHEAP_WALK		16	/* siblings before they are melded */
+
+/*
+ * che_next is NULL on the root, the next sibling on every other entry
+ * except the last child of a node, where it is the parent with
+ * CHEAP_LAST set.
+ */
+
+static inline struct _cheap_entry *
+cheap_n2e(const struct _heap_type *t, const void *node)
+{
+	unsigned long addr = (unsigned long)node;
+
+	return ((struct _cheap_entry *)(addr + t->t_offset));
+}
+
+static inline void *
+cheap_e2n(const struct _heap_type *t, const struct _cheap_entry *che)
+{
+	unsigned long addr = (unsigned long)che;
+
+	return ((void *)(addr - t->t_offset));
+}
+
+static inline int
+cheap_is_last(const struct _cheap_entry *che)
+{
+	return (((unsigned long)che->che_next & CHEAP_LAST) != 0);
+}
+
+static inline struct _cheap_entry *
+cheap_tag(struct _cheap_entry *parent)
+{
+	return ((struct _cheap_entry *)((unsigned long)parent | CHEAP_LAST));
+}
+
+static inline struct _cheap_entry *
+cheap_untag(struct _cheap_entry *che)
+{
+	return ((struct _cheap_entry *)((unsigned long)che & ~CHEAP_LAST));
+}
+
+/* the next sibling, or NULL at the end of the list */
+static inline struct _cheap_entry *
+cheap_sibling(const struct _cheap_entry *che)
+{
+	if (cheap_is_last(che))
+		return (NULL);
+
+	return (che->che_next);
+}
+
+/* links two trees, the higher one becoming the first child of the lower */
+static inline struct _cheap_entry *
+cheap_link(const struct _heap_type *t,
+    struct _cheap_entry *che1, struct _cheap_entry *che2)
+{
+	struct _cheap_entry *hi, *lo;
+
+	if (t->t_compare(cheap_e2n(t, che1), cheap_e2n(t, che2)) < 0) {
+		lo = che1;
+		hi = che2;
+	} else {
+		hi = che1;
+		lo = che2;
+	}
+
+	hi->che_next = lo->che_child != NULL ? lo->che_child : cheap_tag(lo);
+	lo->che_child = hi;
+	lo->che_next = NULL;
+
+	return (lo);
+}
+
+static inline struct _cheap_entry *
+cheap_merge(const struct _heap_type *t,
+    struct _cheap_entry *che1, struct _cheap_entry *che2)
+{
+	if (che1 == NULL)
+		return (che2);
+	if (che2 == NULL)
+		return (che1);
+
+	return (cheap_link(t, che1, che2));
+}
+
+/*
+ * melds a list of trees into one, pairing them off from the left and
+ * then folding the pairs in from the right. the list may end with
+ * NULL or with a tagged parent.
+ */
+static struct _cheap_entry *
+cheap_2pass_merge(const struct _heap_type *t, struct _cheap_entry *che)
+{
+	struct _cheap_entry *che1, *che2, *list = NULL;
+
+	/* first pass, the pairs are pushed onto list with che_next */
+	while (che != NULL) {
+		che1 = che;
+		che2 = cheap_sibling(che1);
+		if (che2 == NULL)
+			che = NULL;
+		else {
+			che = cheap_sibling(che2);
+			che1 = cheap_link(t, che1, che2);
+		}
+
+		che1->che_next = list;
+		list = che1;
+	}
+
+	if (list == NULL)
+		return (NULL);
+
+	/* second pass */
+	che1 = list;
+	list = che1->che_next;
+	while (list != NULL) {
+		che2 = list;
+		list = che2->che_next;
+		che1 = cheap_link(t, che1, che2);
+	}
+
+	che1->che_next = NULL;
+
+	return (che1);
+}
+
+/*
+ * melds a list of trees by repeatedly taking the first two off the
+ * list and putting the result on the end, so no node in the result
+ * gets more than log n children.
+ */
+static struct _cheap_entry *
+cheap_multipass_merge(const struct _heap_type *t, struct _cheap_entry *list)
+{
+	struct _cheap_entry *tail, *che1, *che2;
+
+	for (tail = list; cheap_sibling(tail) != NULL; tail = tail->che_next)
+		;
+	tail->che_next = NULL;
+
+	while (list != tail) {
+		che1 = list;
+		che2 = che1->che_next;
+		list = che2->che_next;
+
+		che1 = cheap_link(t, che1, che2);
+		if (list == NULL)
+			list = che1;
+		else
+			tail->che_next = che1;
+		tail = che1;
+	}
+
+	return (list);
+}
+
+/*
+ * takes a subtree that is not the root out of its parent's children.
+ * finding the sibling before it means walking the list, so if the
+ * list was long the rest of it is melded into one tree to make the
+ * next walk short.
+ */
+static void
+cheap_detach(const struct _heap_type *t, struct _cheap_entry *che)
+{
+	struct _cheap_entry *parent, *prev, *child;
+	unsigned int n = 0;
+
+	for (prev = che; !cheap_is_last(prev); prev = prev->che_next)
+		n++;
+	parent = cheap_untag(prev->che_next);
+
+	if (parent->che_child == che) {
+		parent->che_child = cheap_sibling(che);
+	} else {
+		for (prev = parent->che_child; prev->che_next != che;
+		    prev = prev->che_next)
+			n++;
+		prev->che_next = che->che_next;
+	}
+
+	che->che_next = NULL;
+
+	if (n > CHEAP_WALK) {
+		child = cheap_multipass_merge(t, parent->che_child);
+		child->che_next = cheap_tag(parent);
+		parent->che_child = child;
+	}
+}
+
+void
+_cheap_insert(const struct _heap_type *t, struct _cheap *h, void *node)
+{
+	struct _cheap_entry *che = cheap_n2e(t, node);
+
+	che->che_child = NULL;
+	che->che_next = NULL;
+
+	h->ch_root = cheap_merge(t, h->ch_root, che);
+}
+
+void
+_cheap_remove(const struct _heap_type *t, struct _cheap *h, void *node)
+{
+	struct _cheap_entry *che = cheap_n2e(t, node);
+	struct _cheap_entry *sub;
+
+	sub = cheap_2pass_merge(t, che->che_child);
+	che->che_child = NULL;
+
+	if (che == h->ch_root) {
+		h->ch_root = sub;
+		return;
+	}
+
+	cheap_detach(t, che);
+	h->ch_root = cheap_merge(t, h->ch_root, sub);
+}
+
+void
+_cheap_decrease(const struct _heap_type *t, struct _cheap *h, void *node)
+{
+	struct _cheap_entry *che = cheap_n2e(t, node);
+
+	if (che == h->ch_root)
+		return;
+
+	cheap_detach(t, che);
+	h->ch_root = cheap_link(t, h->ch_root, che);
+}
+
+void
+_cheap_update(const struct _heap_type *t, struct _cheap *h, void *node)
+{
+	struct _cheap_entry *che = cheap_n2e(t, node);
+	struct _cheap_entry *child;
+
+	for (child = che->che_child; child != NULL;
+	    child = cheap_sibling(child)) {
+		if (t->t_compare(cheap_e2n(t, child), node) < 0)
+			break;
+	}
+
+	/* the children are still in order, so treat it as a decrease */
+	if (child == NULL) {
+		_cheap_decrease(t, h, node);
+		return;
+	}
+
+	_cheap_remove(t, h, node);
+	_cheap_insert(t, h, node);
+}
+
+/* moves all the elements in h2 into h1 */
+void
+_cheap_meld(const struct _heap_type *t, struct _cheap *h1, struct _cheap *h2)
+{
+	h1->ch_root = cheap_merge(t, h1->ch_root, h2->ch_root);
+	h2->ch_root = NULL;
+}
+
+void
+_cheap_build(const struct _heap_type *t, struct _cheap *h,
+    void *(*next)(void *), void *arg)
+{
+	struct _cheap_entry *che, *list = NULL;
+	void *node;
+
+	while ((node = (*next)(arg)) != NULL) {
+		che = cheap_n2e(t, node);
+		che->che_child = NULL;
+		che->che_next = list;
+		list = che;
+	}
+
+	h->ch_root = cheap_merge(t, h->ch_root, cheap_2pass_merge(t, list));
+}
+
+void
+_cheap_build_array(const struct _heap_type *t, struct _cheap *h,
+    void **nodes, size_t n)
+{
+	struct _cheap_entry *che, *list = NULL;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		che = cheap_n2e(t, nodes[i]);
+		che->che_child = NULL;
+		che->che_next = list;
+		list = che;
+	}
+
+	h->ch_root = cheap_merge(t, h->ch_root, cheap_2pass_merge(t, list));
+}
+
+void *
+_cheap_extract(const struct _heap_type *t, struct _cheap *h)
+{
+	struct _cheap_entry *first = h->ch_root;
+
+	if (first == NULL)
+		return (NULL);
+
+	h->ch_root = cheap_2pass_merge(t, first->che_child);
+	first->che_child = NULL;
+
+	return (cheap_e2n(t, first));
+}
+
+void *
+_cheap_cextract(const struct _heap_type *t, struct _cheap *h,
+    const void *key)
+{
+	struct _cheap_entry *first = h->ch_root;
+
+	if (first == NULL || t->t_compare(key, cheap_e2n(t, first)) < 0)
+		return (NULL);
+
+	h->ch_root = cheap_2pass_merge(t, first->che_child);
+	first->che_child = NULL;
+
+	return (cheap_e2n(t, first));
+}
+
+/*
+ * removes every node that compares lower than or equal to key and
+ * passes it to fn, the same way as _heap_extract_until.
+ */
+size_t
+_cheap_extract_until(const struct _heap_type *t, struct _cheap *h,
+    const void *key, void (*fn)(void *, void *), void *arg)
+{
+	struct _cheap_entry *stack, *rest = NULL;
+	struct _cheap_entry *che, *child, *next;
+	size_t n = 0;
+
+	stack = h->ch_root;
+	if (stack == NULL || t->t_compare(key, cheap_e2n(t, stack)) < 0)
+		return (0);
+
+	/* both lists are linked with che_next */
+	while ((che = stack) != NULL) {
+		stack = che->che_next;
+
+		for (child = che->che_child; child != NULL; child = next) {
+			next = cheap_sibling(child);
+
+			if (t->t_compare(key, cheap_e2n(t, child)) < 0) {
+				child->che_next = rest;
+				rest = child;
+			} else {
+				child->che_next = stack;
+				stack = child;
+			}
+		}
+
+		che->che_child = NULL;
+		che->che_next = NULL;
+
+		(*fn)(arg, cheap_e2n(t, che));
+		n++;
+	}
+
+	h->ch_root = cheap_2pass_merge(t, rest);
+
+	return (n);
+}
+
+void *
+_cheap_iter_next(const struct _heap_type *t, const void *node)
+{
+	const struct _cheap_entry *che = cheap_n2e(t, node);
+
+	/* go down the tree first */
+	if (che->che_child != NULL)
+		return (cheap_e2n(t, che->che_child));
+
+	/* then right, or up to the parent until there is a right */
+	while (cheap_is_last(che))
+		che = cheap_untag(che->che_next);
+
+	if (che->che_next == NULL)
+		return (NULL);
+
+	return (cheap_e2n(t, che->che_next));
+}
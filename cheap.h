@@ -0,0 +1,206 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CHEAP_H_
+#define _CHEAP_H_
+
+/*
+ * A pairing heap with two pointers in each entry instead of three.
+ *
+ * CHEAP_HEAD, CHEAP_ENTRY, CHEAP_PROTOTYPE and CHEAP_GENERATE replace
+ * their HEAP counterparts, and then the HEAP macros from heap.h work
+ * on the heap as usual.
+ *
+ * Each entry points at its first child and its next sibling. The last
+ * sibling points back at the parent instead, with the low bit set to
+ * mark it. HEAP_REMOVE and HEAP_DECREASE walk the siblings of an
+ * element to find the one before it, so they cost time in the number
+ * of siblings. A long list of siblings is melded into one tree when
+ * it is walked, so a heap that has had many inserts and no extracts
+ * only pays for its flat root once.
+ *
+ * HEAP_INTAKE_*, HEAP_SPLIT, the ordered iterators and HEAP_MQ_* are
+ * not provided.
+ */
+
+#include <stdint.h>
+
+#include "heap.h"
+
+struct _cheap_entry {
+	struct _cheap_entry	*che_child;
+	struct _cheap_entry	*che_next;	/* or parent | CHEAP_LAST */
+};
+#define CHEAP_ENTRY(_entry)	struct _cheap_entry
+
+#define CHEAP_LAST		0x1UL
+
+struct _cheap {
+	struct _cheap_entry	*ch_root;
+};
+
+#define CHEAP_HEAD(_name)						\
+struct _name {								\
+	struct _cheap		heap;					\
+}
+
+#define CHEAP_INITIALIZER(_head)	{ { NULL } }
+
+static inline void
+_cheap_init(struct _cheap *h)
+{
+	h->ch_root = NULL;
+}
+
+static inline int
+_cheap_empty(struct _cheap *h)
+{
+	return (h->ch_root == NULL);
+}
+
+static inline void *
+_cheap_first(const struct _heap_type *t, struct _cheap *h)
+{
+	unsigned long addr = (unsigned long)h->ch_root;
+
+	if (addr == 0)
+		return (NULL);
+
+	return ((void *)(addr - t->t_offset));
+}
+
+void	 _cheap_insert(const struct _heap_type *, struct _cheap *, void *);
+void	 _cheap_remove(const struct _heap_type *, struct _cheap *, void *);
+void	 _cheap_decrease(const struct _heap_type *, struct _cheap *, void *);
+void	 _cheap_update(const struct _heap_type *, struct _cheap *, void *);
+void	 _cheap_meld(const struct _heap_type *, struct _cheap *,
+	     struct _cheap *);
+void	 _cheap_build(const struct _heap_type *, struct _cheap *,
+	     void *(*)(void *), void *);
+void	 _cheap_build_array(const struct _heap_type *, struct _cheap *,
+	     void **, size_t);
+void	*_cheap_extract(const struct _heap_type *, struct _cheap *);
+void	*_cheap_cextract(const struct _heap_type *, struct _cheap *,
+	     const void *);
+size_t	 _cheap_extract_until(const struct _heap_type *, struct _cheap *,
+	     const void *, void (*)(void *, void *), void *);
+void	*_cheap_iter_next(const struct _heap_type *, const void *);
+
+#define CHEAP_PROTOTYPE(_name, _type)					\
+extern const struct _heap_type *const _name##_HEAP_TYPE;		\
+									\
+static __unused inline void						\
+_name##_HEAP_INIT(struct _name *head)					\
+{									\
+	_cheap_init(&head->heap);					\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_INSERT(struct _name *head, struct _type *elm)		\
+{									\
+	_cheap_insert(_name##_HEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_REMOVE(struct _name *head, struct _type *elm)		\
+{									\
+	_cheap_remove(_name##_HEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_DECREASE(struct _name *head, struct _type *elm)		\
+{									\
+	_cheap_decrease(_name##_HEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_UPDATE(struct _name *head, struct _type *elm)		\
+{									\
+	_cheap_update(_name##_HEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_FIRST(struct _name *head)					\
+{									\
+	return _cheap_first(_name##_HEAP_TYPE, &head->heap);		\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_MERGE(struct _name *head1, struct _name *head2)		\
+{									\
+	_cheap_meld(_name##_HEAP_TYPE, &head1->heap, &head2->heap);	\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_BUILD(struct _name *head,					\
+    void *(*next)(void *), void *arg)					\
+{									\
+	_cheap_build(_name##_HEAP_TYPE, &head->heap, next, arg);	\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_BUILD_ARRAY(struct _name *head, struct _type **elms,	\
+    size_t n)								\
+{									\
+	_cheap_build_array(_name##_HEAP_TYPE, &head->heap,		\
+	    (void **)elms, n);						\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_EXTRACT(struct _name *head)				\
+{									\
+	return _cheap_extract(_name##_HEAP_TYPE, &head->heap);		\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_CEXTRACT(struct _name *head, const struct _type *key)	\
+{									\
+	return _cheap_cextract(_name##_HEAP_TYPE, &head->heap, key);	\
+}									\
+									\
+static __unused inline size_t						\
+_name##_HEAP_EXTRACT_UNTIL(struct _name *head, const struct _type *key,	\
+    void (*fn)(void *, void *), void *arg)				\
+{									\
+	return _cheap_extract_until(_name##_HEAP_TYPE, &head->heap,	\
+	    key, fn, arg);						\
+}									\
+									\
+static __unused inline int						\
+_name##_HEAP_EMPTY(struct _name *head)					\
+{									\
+	return _cheap_empty(&head->heap);				\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_ITER_FIRST(struct _name *head)				\
+{									\
+	return _cheap_first(_name##_HEAP_TYPE, &head->heap);		\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_ITER_NEXT(struct _type *elm)				\
+{									\
+	return _cheap_iter_next(_name##_HEAP_TYPE, elm);		\
+}
+
+/* the type is shared with heap.h, and no flags apply */
+#define CHEAP_GENERATE(_name, _type, _field, _cmp)			\
+    HEAP_GENERATE_INTERNAL(_name, _type, _field, _cmp, 0)
+
+#endif /* _CHEAP_H_ */
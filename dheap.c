@@ -0,0 +1,384 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dheap.h"
+
+#define DHEAP_D			4
+
+/*
+ * the slots are offset in the allocation so the children of each
+ * node, which start at DHEAP_D * i + 1, share a single cache line.
+ */
+#define DHEAP_ALIGN		(DHEAP_D * sizeof(struct _dheap_slot))
+#define DHEAP_PAD		(DHEAP_D - 1)
+
+#define DHEAP_MINSIZE		(64 - DHEAP_PAD)
+
+static inline struct _dheap_entry *
+dheap_n2e(const struct _dheap_type *t, const void *node)
+{
+	unsigned long addr = (unsigned long)node;
+
+	return ((struct _dheap_entry *)(addr + t->t_offset));
+}
+
+static inline uint64_t
+dheap_key(const struct _dheap_type *t, const void *node)
+{
+	return (t->t_key == NULL ? 0 : (*t->t_key)(node));
+}
+
+static inline int
+dheap_lt(const struct _dheap_type *t, const struct _dheap_slot *a,
+    const struct _dheap_slot *b)
+{
+	if (t->t_key != NULL)
+		return (a->dhs_key < b->dhs_key);
+
+	return ((*t->t_compare)(a->dhs_node, b->dhs_node) < 0);
+}
+
+static inline void
+dheap_set(const struct _dheap_type *t, struct _dheap *h, unsigned int i,
+    const struct _dheap_slot *dhs)
+{
+	h->dh_slots[i] = *dhs;
+	dheap_n2e(t, dhs->dhs_node)->dhe_idx = i;
+}
+
+/* picks the lowest of the children in [c, e) */
+static inline unsigned int
+dheap_min_child(const struct _dheap_type *t, const struct _dheap *h,
+    unsigned int c, unsigned int e)
+{
+	const struct _dheap_slot *slots = h->dh_slots;
+	unsigned int m = c;
+	uint64_t key;
+
+	if (t->t_key != NULL) {
+		/* cached keys can be compared without branching */
+		key = slots[c].dhs_key;
+		for (c++; c < e; c++) {
+			int lt = slots[c].dhs_key < key;
+
+			m = lt ? c : m;
+			key = lt ? slots[c].dhs_key : key;
+		}
+		return (m);
+	}
+
+	for (c++; c < e; c++) {
+		if ((*t->t_compare)(slots[c].dhs_node, slots[m].dhs_node) < 0)
+			m = c;
+	}
+
+	return (m);
+}
+
+static void
+dheap_sift_up(const struct _dheap_type *t, struct _dheap *h, unsigned int i,
+    const struct _dheap_slot *dhs)
+{
+	unsigned int p;
+
+	while (i > 0) {
+		p = (i - 1) / DHEAP_D;
+		if (!dheap_lt(t, dhs, &h->dh_slots[p]))
+			break;
+
+		dheap_set(t, h, i, &h->dh_slots[p]);
+		i = p;
+	}
+
+	dheap_set(t, h, i, dhs);
+}
+
+static void
+dheap_sift_down(const struct _dheap_type *t, struct _dheap *h,
+    unsigned int i, const struct _dheap_slot *dhs)
+{
+	unsigned int c, e, m;
+	unsigned int n = h->dh_len;
+
+	for (;;) {
+		c = i * DHEAP_D + 1;
+		if (c >= n)
+			break;
+
+		e = c + DHEAP_D;
+		if (e > n)
+			e = n;
+
+		m = dheap_min_child(t, h, c, e);
+		if (!dheap_lt(t, &h->dh_slots[m], dhs))
+			break;
+
+		dheap_set(t, h, i, &h->dh_slots[m]);
+		i = m;
+	}
+
+	dheap_set(t, h, i, dhs);
+}
+
+/* puts dhs at i, which was taken by a node with a different key */
+static void
+dheap_fix(const struct _dheap_type *t, struct _dheap *h, unsigned int i,
+    const struct _dheap_slot *dhs)
+{
+	if (i > 0 && dheap_lt(t, dhs, &h->dh_slots[(i - 1) / DHEAP_D]))
+		dheap_sift_up(t, h, i, dhs);
+	else
+		dheap_sift_down(t, h, i, dhs);
+}
+
+void
+_dheap_destroy(struct _dheap *h)
+{
+	if (h->dh_slots != NULL)
+		free(h->dh_slots - DHEAP_PAD);
+
+	_dheap_init(h);
+}
+
+int
+_dheap_reserve(struct _dheap *h, unsigned int n)
+{
+	struct _dheap_slot *slots;
+	unsigned int size;
+	void *mem;
+
+	if (n <= h->dh_size)
+		return (0);
+
+	size = h->dh_size < DHEAP_MINSIZE ? DHEAP_MINSIZE : h->dh_size;
+	while (size < n) {
+		if (size > (UINT_MAX - DHEAP_PAD) / 2)
+			return (ENOMEM);
+		size = size * 2 + DHEAP_PAD;
+	}
+
+	if (posix_memalign(&mem, DHEAP_ALIGN,
+	    (size + DHEAP_PAD) * sizeof(*slots)) != 0)
+		return (ENOMEM);
+
+	slots = (struct _dheap_slot *)mem + DHEAP_PAD;
+	if (h->dh_slots != NULL) {
+		memcpy(slots, h->dh_slots, h->dh_len * sizeof(*slots));
+		free(h->dh_slots - DHEAP_PAD);
+	}
+
+	h->dh_slots = slots;
+	h->dh_size = size;
+
+	return (0);
+}
+
+int
+_dheap_insert(const struct _dheap_type *t, struct _dheap *h, void *node)
+{
+	struct _dheap_slot dhs = { dheap_key(t, node), node };
+	int error;
+
+	if (h->dh_len == h->dh_size) {
+		error = _dheap_reserve(h, h->dh_len + 1);
+		if (error != 0)
+			return (error);
+	}
+
+	dheap_sift_up(t, h, h->dh_len++, &dhs);
+
+	return (0);
+}
+
+void
+_dheap_remove(const struct _dheap_type *t, struct _dheap *h, void *node)
+{
+	unsigned int i = dheap_n2e(t, node)->dhe_idx;
+	struct _dheap_slot dhs;
+
+	if (i == --h->dh_len)
+		return;
+
+	dhs = h->dh_slots[h->dh_len];
+	dheap_fix(t, h, i, &dhs);
+}
+
+void
+_dheap_decrease(const struct _dheap_type *t, struct _dheap *h, void *node)
+{
+	struct _dheap_slot dhs = { dheap_key(t, node), node };
+
+	dheap_sift_up(t, h, dheap_n2e(t, node)->dhe_idx, &dhs);
+}
+
+void
+_dheap_update(const struct _dheap_type *t, struct _dheap *h, void *node)
+{
+	struct _dheap_slot dhs = { dheap_key(t, node), node };
+
+	dheap_fix(t, h, dheap_n2e(t, node)->dhe_idx, &dhs);
+}
+
+/* rebuilds the heap bottom up, which is linear in the number of nodes */
+static void
+dheap_heapify(const struct _dheap_type *t, struct _dheap *h)
+{
+	struct _dheap_slot dhs;
+	unsigned int i;
+
+	if (h->dh_len < 2)
+		return;
+
+	for (i = (h->dh_len - 2) / DHEAP_D + 1; i-- > 0; ) {
+		dhs = h->dh_slots[i];
+		dheap_sift_down(t, h, i, &dhs);
+	}
+}
+
+static inline void
+dheap_append(const struct _dheap_type *t, struct _dheap *h, void *node)
+{
+	struct _dheap_slot dhs = { dheap_key(t, node), node };
+
+	dheap_set(t, h, h->dh_len++, &dhs);
+}
+
+/* moves all the nodes in h2 into h1 */
+int
+_dheap_meld(const struct _dheap_type *t, struct _dheap *h1,
+    struct _dheap *h2)
+{
+	unsigned int i;
+	int error;
+
+	if (h2->dh_len > UINT_MAX - h1->dh_len)
+		return (ENOMEM);
+
+	error = _dheap_reserve(h1, h1->dh_len + h2->dh_len);
+	if (error != 0)
+		return (error);
+
+	for (i = 0; i < h2->dh_len; i++)
+		dheap_append(t, h1, h2->dh_slots[i].dhs_node);
+	h2->dh_len = 0;
+
+	dheap_heapify(t, h1);
+
+	return (0);
+}
+
+int
+_dheap_build(const struct _dheap_type *t, struct _dheap *h,
+    void *(*next)(void *), void *arg)
+{
+	void *node;
+	int error = 0;
+
+	while ((node = (*next)(arg)) != NULL) {
+		if (h->dh_len == h->dh_size) {
+			error = _dheap_reserve(h, h->dh_len + 1);
+			if (error != 0) {
+				/* keep the nodes that were added */
+				break;
+			}
+		}
+
+		dheap_append(t, h, node);
+	}
+
+	dheap_heapify(t, h);
+
+	return (error);
+}
+
+int
+_dheap_build_array(const struct _dheap_type *t, struct _dheap *h,
+    void **nodes, size_t n)
+{
+	size_t i;
+	int error;
+
+	if (n > UINT_MAX - h->dh_len)
+		return (ENOMEM);
+
+	error = _dheap_reserve(h, h->dh_len + n);
+	if (error != 0)
+		return (error);
+
+	for (i = 0; i < n; i++)
+		dheap_append(t, h, nodes[i]);
+
+	dheap_heapify(t, h);
+
+	return (0);
+}
+
+void *
+_dheap_extract(const struct _dheap_type *t, struct _dheap *h)
+{
+	void *node;
+
+	node = _dheap_first(h);
+	if (node != NULL)
+		_dheap_remove(t, h, node);
+
+	return (node);
+}
+
+static inline int
+dheap_above(const struct _dheap_type *t, const struct _dheap *h,
+    const void *key, uint64_t k)
+{
+	const struct _dheap_slot *first = &h->dh_slots[0];
+
+	if (t->t_key != NULL)
+		return (k < first->dhs_key);
+
+	return ((*t->t_compare)(key, first->dhs_node) < 0);
+}
+
+void *
+_dheap_cextract(const struct _dheap_type *t, struct _dheap *h,
+    const void *key)
+{
+	if (h->dh_len == 0 || dheap_above(t, h, key, dheap_key(t, key)))
+		return (NULL);
+
+	return (_dheap_extract(t, h));
+}
+
+size_t
+_dheap_extract_until(const struct _dheap_type *t, struct _dheap *h,
+    const void *key, void (*fn)(void *, void *), void *arg)
+{
+	uint64_t k = dheap_key(t, key);
+	size_t n = 0;
+
+	while (h->dh_len > 0 && !dheap_above(t, h, key, k)) {
+		(*fn)(arg, _dheap_extract(t, h));
+		n++;
+	}
+
+	return (n);
+}
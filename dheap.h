@@ -0,0 +1,254 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _DHEAP_H_
+#define _DHEAP_H_
+
+/*
+ * An array based 4-ary heap.
+ *
+ * DHEAP_HEAD, DHEAP_ENTRY, DHEAP_PROTOTYPE and DHEAP_GENERATE replace
+ * their HEAP counterparts, and then the HEAP macros from heap.h work
+ * on the heap as usual, so a heap can be switched between backends by
+ * changing its declarations.
+ *
+ * Each slot in the array holds a pointer to an element, and each
+ * element stores the index of its slot so it can be removed or have
+ * its key changed without a search. Heaps generated with
+ * DHEAP_GENERATE_KEY order elements by an unsigned 64bit key that is
+ * cached in the slot, so comparing children does not touch the
+ * elements themselves.
+ *
+ * The array grows as elements are inserted. HEAP_INSERT, HEAP_MERGE
+ * and the HEAP_BUILD macros return ENOMEM if it can't, or
+ * DHEAP_RESERVE can be used to make room beforehand. DHEAP_DESTROY
+ * frees the array. HEAP_ITER_NEXT and the ordered iterators are not
+ * provided.
+ */
+
+#include <stdint.h>
+
+#include "heap.h"
+
+struct _dheap_type {
+	int			(*t_compare)(const void *, const void *);
+	uint64_t		(*t_key)(const void *);	/* or NULL */
+	unsigned int		  t_offset; /* offset of dheap_entry in type */
+};
+
+struct _dheap_entry {
+	unsigned int		  dhe_idx;
+};
+#define DHEAP_ENTRY(_entry)	struct _dheap_entry
+
+struct _dheap_slot {
+	uint64_t		  dhs_key;
+	void			 *dhs_node;
+};
+
+struct _dheap {
+	struct _dheap_slot	 *dh_slots;
+	unsigned int		  dh_len;
+	unsigned int		  dh_size;
+};
+
+#define DHEAP_HEAD(_name)						\
+struct _name {								\
+	struct _dheap		heap;					\
+}
+
+#define DHEAP_INITIALIZER(_head)	{ { NULL, 0, 0 } }
+
+static inline void
+_dheap_init(struct _dheap *h)
+{
+	h->dh_slots = NULL;
+	h->dh_len = 0;
+	h->dh_size = 0;
+}
+
+static inline int
+_dheap_empty(struct _dheap *h)
+{
+	return (h->dh_len == 0);
+}
+
+static inline void *
+_dheap_first(struct _dheap *h)
+{
+	if (h->dh_len == 0)
+		return (NULL);
+
+	return (h->dh_slots[0].dhs_node);
+}
+
+void	 _dheap_destroy(struct _dheap *);
+int	 _dheap_reserve(struct _dheap *, unsigned int);
+int	 _dheap_insert(const struct _dheap_type *, struct _dheap *, void *);
+void	 _dheap_remove(const struct _dheap_type *, struct _dheap *, void *);
+void	 _dheap_decrease(const struct _dheap_type *, struct _dheap *,
+	     void *);
+void	 _dheap_update(const struct _dheap_type *, struct _dheap *, void *);
+int	 _dheap_meld(const struct _dheap_type *, struct _dheap *,
+	     struct _dheap *);
+int	 _dheap_build(const struct _dheap_type *, struct _dheap *,
+	     void *(*)(void *), void *);
+int	 _dheap_build_array(const struct _dheap_type *, struct _dheap *,
+	     void **, size_t);
+void	*_dheap_extract(const struct _dheap_type *, struct _dheap *);
+void	*_dheap_cextract(const struct _dheap_type *, struct _dheap *,
+	     const void *);
+size_t	 _dheap_extract_until(const struct _dheap_type *, struct _dheap *,
+	     const void *, void (*)(void *, void *), void *);
+
+#define DHEAP_PROTOTYPE(_name, _type)					\
+extern const struct _dheap_type *const _name##_HEAP_TYPE;		\
+									\
+static __unused inline void						\
+_name##_HEAP_INIT(struct _name *head)					\
+{									\
+	_dheap_init(&head->heap);					\
+}									\
+									\
+static __unused inline void						\
+_name##_DHEAP_DESTROY(struct _name *head)				\
+{									\
+	_dheap_destroy(&head->heap);					\
+}									\
+									\
+static __unused inline int						\
+_name##_DHEAP_RESERVE(struct _name *head, unsigned int n)		\
+{									\
+	return _dheap_reserve(&head->heap, n);				\
+}									\
+									\
+static __unused inline int						\
+_name##_HEAP_INSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _dheap_insert(_name##_HEAP_TYPE, &head->heap, elm);	\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_REMOVE(struct _name *head, struct _type *elm)		\
+{									\
+	_dheap_remove(_name##_HEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_DECREASE(struct _name *head, struct _type *elm)		\
+{									\
+	_dheap_decrease(_name##_HEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_UPDATE(struct _name *head, struct _type *elm)		\
+{									\
+	_dheap_update(_name##_HEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_FIRST(struct _name *head)					\
+{									\
+	return _dheap_first(&head->heap);				\
+}									\
+									\
+static __unused inline int						\
+_name##_HEAP_MERGE(struct _name *head1, struct _name *head2)		\
+{									\
+	return _dheap_meld(_name##_HEAP_TYPE, &head1->heap,		\
+	    &head2->heap);						\
+}									\
+									\
+static __unused inline int						\
+_name##_HEAP_BUILD(struct _name *head,					\
+    void *(*next)(void *), void *arg)					\
+{									\
+	return _dheap_build(_name##_HEAP_TYPE, &head->heap, next, arg);	\
+}									\
+									\
+static __unused inline int						\
+_name##_HEAP_BUILD_ARRAY(struct _name *head, struct _type **elms,	\
+    size_t n)								\
+{									\
+	return _dheap_build_array(_name##_HEAP_TYPE, &head->heap,	\
+	    (void **)elms, n);						\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_EXTRACT(struct _name *head)				\
+{									\
+	return _dheap_extract(_name##_HEAP_TYPE, &head->heap);		\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_CEXTRACT(struct _name *head, const struct _type *key)	\
+{									\
+	return _dheap_cextract(_name##_HEAP_TYPE, &head->heap, key);	\
+}									\
+									\
+static __unused inline size_t						\
+_name##_HEAP_EXTRACT_UNTIL(struct _name *head, const struct _type *key,	\
+    void (*fn)(void *, void *), void *arg)				\
+{									\
+	return _dheap_extract_until(_name##_HEAP_TYPE, &head->heap,	\
+	    key, fn, arg);						\
+}									\
+									\
+static __unused inline int						\
+_name##_HEAP_EMPTY(struct _name *head)					\
+{									\
+	return _dheap_empty(&head->heap);				\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_ITER_FIRST(struct _name *head)				\
+{									\
+	return _dheap_first(&head->heap);				\
+}
+
+#define DHEAP_GENERATE_INTERNAL(_name, _type, _field, _cmp, _key)	\
+static const struct _dheap_type _name##_HEAP_INFO = {			\
+	_cmp,								\
+	_key,								\
+	offsetof(struct _type, _field),					\
+};									\
+const struct _dheap_type *const _name##_HEAP_TYPE = &_name##_HEAP_INFO
+
+#define DHEAP_GENERATE(_name, _type, _field, _cmp)			\
+static int								\
+_name##_HEAP_COMPARE(const void *lptr, const void *rptr)		\
+{									\
+	const struct _type *l = lptr, *r = rptr;			\
+	return _cmp(l, r);						\
+}									\
+DHEAP_GENERATE_INTERNAL(_name, _type, _field,				\
+    _name##_HEAP_COMPARE, NULL)
+
+#define DHEAP_GENERATE_KEY(_name, _type, _field, _key)			\
+static uint64_t								\
+_name##_HEAP_KEY(const void *ptr)					\
+{									\
+	const struct _type *p = ptr;					\
+	return _key(p);							\
+}									\
+DHEAP_GENERATE_INTERNAL(_name, _type, _field, NULL, _name##_HEAP_KEY)
+
+#define DHEAP_DESTROY(_name, _h)	_name##_DHEAP_DESTROY((_h))
+#define DHEAP_RESERVE(_name, _h, _n)	_name##_DHEAP_RESERVE((_h), (_n))
+
+#endif /* _DHEAP_H_ */
@@ -0,0 +1,427 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Each worker owns a heap and a lock around it. Tasks submitted to a
+ * worker go on its heap, and the submitter signals it if it is idle.
+ * If the worker is busy and another worker is idle, the idle one is
+ * signalled instead so it can steal the task.
+ *
+ * Workers only ever try the locks of other workers, so holding their
+ * own lock while stealing can't deadlock. Idle workers sleep with a
+ * timeout in case a wakeup went to a worker that lost the race for
+ * the task.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "edf.h"
+
+#define EDF_ALIGN		64
+#define EDF_IDLE_NSEC		10000000	/* 10ms */
+
+HEAP_HEAD(edf_heap);
+
+struct edf_worker {
+	pthread_mutex_t		  w_mtx;
+	pthread_cond_t		  w_cv;
+	struct edf_heap		  w_heap;
+	int			  w_idle;
+
+	struct edf		 *w_edf;
+	pthread_t		  w_thread;
+	unsigned int		  w_id;
+	uint32_t		  w_seed;
+
+	struct edf_stats	  w_stats;	/* only written by w_thread */
+} __attribute__((__aligned__(EDF_ALIGN)));
+
+struct edf {
+	struct edf_worker	 *e_workers;
+	unsigned int		  e_nworkers;
+	unsigned int		  e_nidle;
+	unsigned int		  e_next;
+	uint64_t		  e_pending;	/* submitted but not run */
+	uint64_t		  e_wakeups;
+	int			  e_stop;
+};
+
+static __thread struct edf_worker *edf_self;
+
+static int
+edf_task_cmp(const struct edf_task *a, const struct edf_task *b)
+{
+	if (a->et_deadline < b->et_deadline)
+		return (-1);
+
+	return (a->et_deadline > b->et_deadline);
+}
+
+HEAP_PROTOTYPE(edf_heap, edf_task);
+HEAP_GENERATE(edf_heap, edf_task, et_entry, edf_task_cmp);
+
+static inline void
+edf_count(uint64_t *c, uint64_t v)
+{
+	__atomic_store_n(c, *c + v, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t
+edf_random(struct edf_worker *w, unsigned int n)
+{
+	uint32_t x = w->w_seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	w->w_seed = x;
+
+	return (((uint64_t)x * n) >> 32);
+}
+
+uint64_t
+edf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+void
+edf_task_init(struct edf_task *et, void (*fn)(void *), void *arg)
+{
+	et->et_deadline = 0;
+	et->et_fn = fn;
+	et->et_arg = arg;
+}
+
+static void
+edf_signal(struct edf_worker *w)
+{
+	pthread_mutex_lock(&w->w_mtx);
+	pthread_cond_signal(&w->w_cv);
+	pthread_mutex_unlock(&w->w_mtx);
+}
+
+/* wakes an idle worker other than busy to come and steal from it */
+static void
+edf_wake_idle(struct edf *e, struct edf_worker *busy)
+{
+	struct edf_worker *w;
+	unsigned int i, o;
+
+	o = busy->w_id + 1;
+	for (i = 0; i < e->e_nworkers - 1; i++) {
+		w = &e->e_workers[(o + i) % e->e_nworkers];
+		if (!__atomic_load_n(&w->w_idle, __ATOMIC_RELAXED))
+			continue;
+
+		__atomic_fetch_add(&e->e_wakeups, 1, __ATOMIC_RELAXED);
+		edf_signal(w);
+		return;
+	}
+}
+
+void
+edf_submit(struct edf *e, struct edf_task *et, uint64_t deadline,
+    unsigned int worker)
+{
+	struct edf_worker *w;
+	int idle;
+
+	et->et_deadline = deadline;
+
+	if (worker != EDF_ANY)
+		w = &e->e_workers[worker % e->e_nworkers];
+	else if (edf_self != NULL && edf_self->w_edf == e)
+		w = edf_self;
+	else {
+		worker = __atomic_fetch_add(&e->e_next, 1, __ATOMIC_RELAXED);
+		w = &e->e_workers[worker % e->e_nworkers];
+	}
+
+	__atomic_fetch_add(&e->e_pending, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&w->w_mtx);
+	HEAP_INSERT(edf_heap, &w->w_heap, et);
+	idle = w->w_idle;
+	if (idle)
+		pthread_cond_signal(&w->w_cv);
+	pthread_mutex_unlock(&w->w_mtx);
+
+	if (idle) {
+		if (w != edf_self)
+			__atomic_fetch_add(&e->e_wakeups, 1, __ATOMIC_RELAXED);
+	} else if (__atomic_load_n(&e->e_nidle, __ATOMIC_RELAXED) > 0)
+		edf_wake_idle(e, w);
+}
+
+/*
+ * moves work from another worker into the heap of w, which is locked
+ * and empty. half the subtrees under the victim's root are taken, or
+ * the root itself if it is on its own.
+ */
+static int
+edf_steal(struct edf_worker *w)
+{
+	struct edf *e = w->w_edf;
+	struct edf_worker *v;
+	struct edf_task *et;
+	unsigned int i, o;
+	int stolen;
+
+	if (e->e_nworkers == 1)
+		return (0);
+
+	o = edf_random(w, e->e_nworkers);
+	for (i = 0; i < e->e_nworkers; i++) {
+		v = &e->e_workers[(o + i) % e->e_nworkers];
+		if (v == w || pthread_mutex_trylock(&v->w_mtx) != 0)
+			continue;
+
+		stolen = HEAP_SPLIT(edf_heap, &v->w_heap, &w->w_heap);
+		if (!stolen && !v->w_idle) {
+			et = HEAP_EXTRACT(edf_heap, &v->w_heap);
+			if (et != NULL) {
+				HEAP_INSERT(edf_heap, &w->w_heap, et);
+				stolen = 1;
+			}
+		}
+		pthread_mutex_unlock(&v->w_mtx);
+
+		if (stolen) {
+			edf_count(&w->w_stats.es_steals, 1);
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+static void
+edf_run(struct edf_worker *w, struct edf_task *et)
+{
+	struct edf *e = w->w_edf;
+	uint64_t deadline = et->et_deadline;
+	uint64_t now;
+	unsigned int i;
+
+	if (edf_now() > deadline)
+		edf_count(&w->w_stats.es_late_start, 1);
+
+	/* the task may be freed or submitted again by its function */
+	(*et->et_fn)(et->et_arg);
+
+	now = edf_now();
+	if (now > deadline) {
+		edf_count(&w->w_stats.es_missed, 1);
+		edf_count(&w->w_stats.es_late, now - deadline);
+	}
+
+	/* edf_stats sees the other counts for every task in es_run */
+	__atomic_store_n(&w->w_stats.es_run, w->w_stats.es_run + 1,
+	    __ATOMIC_RELEASE);
+
+	if (__atomic_sub_fetch(&e->e_pending, 1, __ATOMIC_ACQ_REL) == 0 &&
+	    __atomic_load_n(&e->e_stop, __ATOMIC_ACQUIRE)) {
+		for (i = 0; i < e->e_nworkers; i++)
+			edf_signal(&e->e_workers[i]);
+	}
+}
+
+static void *
+edf_worker_loop(void *arg)
+{
+	struct edf_worker *w = arg;
+	struct edf *e = w->w_edf;
+	struct edf_task *et;
+	struct timespec ts;
+	int stolen;
+
+	edf_self = w;
+
+	pthread_mutex_lock(&w->w_mtx);
+	for (;;) {
+		et = HEAP_EXTRACT(edf_heap, &w->w_heap);
+		if (et != NULL) {
+			pthread_mutex_unlock(&w->w_mtx);
+			edf_run(w, et);
+			pthread_mutex_lock(&w->w_mtx);
+			continue;
+		}
+
+		/* be visible as idle before looking for work elsewhere */
+		__atomic_store_n(&w->w_idle, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&e->e_nidle, 1, __ATOMIC_SEQ_CST);
+
+		stolen = edf_steal(w);
+		if (!stolen) {
+			if (__atomic_load_n(&e->e_stop, __ATOMIC_ACQUIRE) &&
+			    __atomic_load_n(&e->e_pending,
+			    __ATOMIC_ACQUIRE) == 0) {
+				__atomic_fetch_sub(&e->e_nidle, 1,
+				    __ATOMIC_RELAXED);
+				break;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_nsec += EDF_IDLE_NSEC;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&w->w_cv, &w->w_mtx, &ts);
+		}
+
+		__atomic_store_n(&w->w_idle, 0, __ATOMIC_RELAXED);
+		__atomic_fetch_sub(&e->e_nidle, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&w->w_mtx);
+
+	return (NULL);
+}
+
+static void
+edf_stop(struct edf *e, unsigned int n)
+{
+	struct edf_worker *w;
+	unsigned int i;
+
+	__atomic_store_n(&e->e_stop, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < n; i++)
+		edf_signal(&e->e_workers[i]);
+
+	for (i = 0; i < n; i++)
+		pthread_join(e->e_workers[i].w_thread, NULL);
+
+	for (i = 0; i < e->e_nworkers; i++) {
+		w = &e->e_workers[i];
+		pthread_cond_destroy(&w->w_cv);
+		pthread_mutex_destroy(&w->w_mtx);
+	}
+
+	free(e->e_workers);
+	free(e);
+}
+
+int
+edf_create(struct edf **ep, unsigned int nworkers)
+{
+	pthread_condattr_t ca;
+	struct edf_worker *w;
+	struct edf *e;
+	unsigned int i;
+	void *mem;
+	int error;
+
+	if (nworkers == 0)
+		return (EINVAL);
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL)
+		return (ENOMEM);
+
+	if (posix_memalign(&mem, EDF_ALIGN, nworkers * sizeof(*w)) != 0) {
+		free(e);
+		return (ENOMEM);
+	}
+
+	e->e_workers = mem;
+	e->e_nworkers = nworkers;
+
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	for (i = 0; i < nworkers; i++) {
+		w = &e->e_workers[i];
+
+		pthread_mutex_init(&w->w_mtx, NULL);
+		pthread_cond_init(&w->w_cv, &ca);
+		HEAP_INIT(edf_heap, &w->w_heap);
+		w->w_idle = 0;
+		w->w_edf = e;
+		w->w_id = i;
+		w->w_seed = (i + 1) * 2654435761U;
+		w->w_stats = (struct edf_stats){ 0 };
+	}
+	pthread_condattr_destroy(&ca);
+
+	for (i = 0; i < nworkers; i++) {
+		w = &e->e_workers[i];
+
+		error = pthread_create(&w->w_thread, NULL, edf_worker_loop, w);
+		if (error != 0) {
+			edf_stop(e, i);
+			return (error);
+		}
+	}
+
+	*ep = e;
+
+	return (0);
+}
+
+/* waits for every submitted task to run, and then for the workers */
+void
+edf_destroy(struct edf *e)
+{
+	edf_stop(e, e->e_nworkers);
+}
+
+unsigned int
+edf_worker(struct edf *e)
+{
+	if (edf_self == NULL || edf_self->w_edf != e)
+		return (EDF_ANY);
+
+	return (edf_self->w_id);
+}
+
+void
+edf_stats(struct edf *e, struct edf_stats *es)
+{
+	struct edf_worker *w;
+	unsigned int i;
+
+	*es = (struct edf_stats){ 0 };
+
+	for (i = 0; i < e->e_nworkers; i++) {
+		w = &e->e_workers[i];
+
+		es->es_run += __atomic_load_n(&w->w_stats.es_run,
+		    __ATOMIC_ACQUIRE);
+		es->es_missed += __atomic_load_n(&w->w_stats.es_missed,
+		    __ATOMIC_RELAXED);
+		es->es_late += __atomic_load_n(&w->w_stats.es_late,
+		    __ATOMIC_RELAXED);
+		es->es_late_start += __atomic_load_n(
+		    &w->w_stats.es_late_start, __ATOMIC_RELAXED);
+		es->es_steals += __atomic_load_n(&w->w_stats.es_steals,
+		    __ATOMIC_RELAXED);
+	}
+
+	es->es_wakeups = __atomic_load_n(&e->e_wakeups, __ATOMIC_RELAXED);
+}
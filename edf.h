@@ -0,0 +1,67 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _EDF_H_
+#define _EDF_H_
+
+/*
+ * An earliest deadline first task scheduler.
+ *
+ * Each worker thread has a pairing heap of runnable tasks ordered by
+ * deadline and runs the earliest one. A worker that runs out of tasks
+ * steals half the subtrees under the root of another worker's heap.
+ * Deadlines are absolute times in nanoseconds on the clock returned
+ * by edf_now().
+ */
+
+#include <stdint.h>
+
+#include "heap.h"
+
+#define EDF_ANY			(~0U)	/* let edf_submit pick a worker */
+
+struct edf_task {
+	HEAP_ENTRY(edf_task)	  et_entry;
+	uint64_t		  et_deadline;
+	void			(*et_fn)(void *);
+	void			 *et_arg;
+};
+
+struct edf_stats {
+	uint64_t		  es_run;	/* tasks that have run */
+	uint64_t		  es_missed;	/* finished after deadline */
+	uint64_t		  es_late;	/* total ns finished late */
+	uint64_t		  es_late_start; /* started after deadline */
+	uint64_t		  es_steals;
+	uint64_t		  es_wakeups;	/* of idle workers */
+};
+
+struct edf;
+
+uint64_t edf_now(void);
+
+int	 edf_create(struct edf **, unsigned int);
+void	 edf_destroy(struct edf *);
+
+void	 edf_task_init(struct edf_task *, void (*)(void *), void *);
+void	 edf_submit(struct edf *, struct edf_task *, uint64_t, unsigned int);
+unsigned int
+	 edf_worker(struct edf *);
+void	 edf_stats(struct edf *, struct edf_stats *);
+
+#endif /* _EDF_H_ */
@@ -34,6 +34,93 @@ heap_e2n(const struct _heap_type *t, const struct _heap_entry *he)
 	return ((void *)(addr - t->t_offset));
 }
 
+#ifdef HEAP_STATS
+#define HEAP_STATS_NCOUNTERS						\
+	(sizeof(struct heap_counters) / sizeof(uint64_t))
+
+__thread unsigned int _heap_stats_idx;
+static unsigned int heap_stats_threads;
+
+unsigned int
+_heap_stats_assign(void)
+{
+	unsigned int n;
+
+	n = __atomic_fetch_add(&heap_stats_threads, 1, __ATOMIC_RELAXED);
+	_heap_stats_idx = n % HEAP_STATS_SLOTS + 1;
+
+	return (_heap_stats_idx);
+}
+
+static inline struct heap_counters *
+heap_stats(const struct _heap_type *t)
+{
+	unsigned int idx = _heap_stats_idx;
+
+	if (t->t_stats == NULL)
+		return (NULL);
+	if (idx == 0)
+		idx = _heap_stats_assign();
+
+	return (&t->t_stats->hs_slots[idx - 1].hss_counters);
+}
+
+/* only the thread that a slot belongs to adds to it */
+#define HEAP_STATS_ADD(_t, _c, _n) do {					\
+	struct heap_counters *_hc = heap_stats(_t);			\
+	if (_hc != NULL) {						\
+		__atomic_store_n(&_hc->_c,				\
+		    __atomic_load_n(&_hc->_c, __ATOMIC_RELAXED) + (_n),	\
+		    __ATOMIC_RELAXED);					\
+	}								\
+} while (0)
+
+void
+_heap_stats_snapshot(const struct _heap_type *t, struct heap_counters *hc)
+{
+	uint64_t *dst = (uint64_t *)hc;
+	const uint64_t *src;
+	unsigned int i, c;
+
+	for (c = 0; c < HEAP_STATS_NCOUNTERS; c++)
+		dst[c] = 0;
+
+	if (t->t_stats == NULL)
+		return;
+
+	for (i = 0; i < HEAP_STATS_SLOTS; i++) {
+		src = (const uint64_t *)&t->t_stats->hs_slots[i].hss_counters;
+		for (c = 0; c < HEAP_STATS_NCOUNTERS; c++)
+			dst[c] += __atomic_load_n(&src[c], __ATOMIC_RELAXED);
+	}
+}
+
+void
+_heap_stats_reset(const struct _heap_type *t)
+{
+	uint64_t *dst;
+	unsigned int i, c;
+
+	if (t->t_stats == NULL)
+		return;
+
+	for (i = 0; i < HEAP_STATS_SLOTS; i++) {
+		dst = (uint64_t *)&t->t_stats->hs_slots[i].hss_counters;
+		for (c = 0; c < HEAP_STATS_NCOUNTERS; c++)
+			__atomic_store_n(&dst[c], 0, __ATOMIC_RELAXED);
+	}
+}
+#else
+#define HEAP_STATS_ADD(_t, _c, _n)	do { } while (0)
+#endif
+
+static inline int
+heap_compare(const struct _heap_type *t, const void *a, const void *b)
+{
+	HEAP_STATS_ADD(t, hc_compares, 1);
+	return (t->t_compare(a, b));
+}
+
 struct _heap_entry *
 _heap_merge(const struct _heap_type *t,
     struct _heap_entry *he1, struct _heap_entry *he2)
@@ -46,7 +133,7 @@ _heap_merge(const struct _heap_type *t,
 	if (he2 == NULL)
 		return (he1);
 
-	if (t->t_compare(heap_e2n(t, he1), heap_e2n(t, he2)) < 0) {
+	if (heap_compare(t, heap_e2n(t, he1), heap_e2n(t, he2)) < 0) {
 		lo = he1;
 		hi = he2;
 	} else {
@@ -67,6 +154,21 @@ _heap_merge(const struct _heap_type *t,
 	return (lo);
 }
 
+/* elements that are not in a heap have no links */
+static inline void
+_heap_entry_clear(struct _heap_entry *he)
+{
+	he->he_left = NULL;
+	he->he_child = NULL;
+	he->he_nextsibling = NULL;
+}
+
+static inline int
+_heap_linked(struct _heap *h, struct _heap_entry *he)
+{
+	return (he == h->h_root || he == h->h_aux || he->he_left != NULL);
+}
+
 static inline void
 _heap_sibling_remove(struct _heap_entry *he)
 {
@@ -96,12 +198,14 @@ _heap_2pass_merge(const struct _heap_type *t, struct _heap_entry *root)
 		return (NULL);
 
 	root->he_child = NULL;
+	HEAP_STATS_ADD(t, hc_merges, 1);
 
 	/* first pass */
 	for (next = node->he_nextsibling; next != NULL;
 	    next = (node != NULL ? node->he_nextsibling : NULL)) {
 		tmp = next->he_nextsibling;
 		node = _heap_merge(t, node, next);
+		HEAP_STATS_ADD(t, hc_merged, 2);
 
 		/* insert head */
 		node->he_nextsibling = list;
@@ -113,6 +217,7 @@ _heap_2pass_merge(const struct _heap_type *t, struct _heap_entry *root)
 	if (node != NULL) {
 		node->he_nextsibling = list;
 		list = node;
+		HEAP_STATS_ADD(t, hc_merged, 1);
 	}
 
 	/* second pass */
@@ -128,6 +233,113 @@ _heap_2pass_merge(const struct _heap_type *t, struct _heap_entry *root)
 	return (list);
 }
 
+/*
+ * merge a list of heaps linked by he_nextsibling by repeatedly taking
+ * the first two off the list and putting the result on the end. this
+ * takes n - 1 comparisons, and the result is balanced.
+ */
+static struct _heap_entry *
+_heap_multipass_merge(const struct _heap_type *t, struct _heap_entry *list)
+{
+	struct _heap_entry *tail, *he1, *he2;
+
+	if (list == NULL)
+		return (NULL);
+
+	for (tail = list; tail->he_nextsibling != NULL;
+	    tail = tail->he_nextsibling)
+		;
+
+	while (list != tail) {
+		he1 = list;
+		he2 = he1->he_nextsibling;
+		list = he2->he_nextsibling;
+
+		he1 = _heap_merge(t, he1, he2);
+		if (list == NULL)
+			list = he1;
+		else
+			tail->he_nextsibling = he1;
+		tail = he1;
+	}
+
+	list->he_left = NULL;
+	list->he_nextsibling = NULL;
+
+	return (list);
+}
+
+static void	_heap_remove_entry(const struct _heap_type *,
+		    struct _heap *, struct _heap_entry *);
+
+/*
+ * other threads push elements onto h_intake and removal requests onto
+ * h_cancel without locking. the thread that owns the heap swaps both
+ * stacks out and applies them before it looks at the heap. the
+ * cancels are taken first so the inserts they refer to have already
+ * been pushed.
+ *
+ * the thread that queued a removal can't know if the owner extracted
+ * the element first, so elements that are no longer in the heap are
+ * skipped. the request goes back to that thread when its state is
+ * set, so it is not touched after that.
+ */
+static void
+_heap_intake_drain(const struct _heap_type *t, struct _heap *h)
+{
+	struct _heap_req *hr, *nhr;
+	struct _heap_entry *list, *he;
+	unsigned int state;
+
+	hr = __atomic_exchange_n(&h->h_cancel, NULL, __ATOMIC_ACQUIRE);
+	list = __atomic_exchange_n(&h->h_intake, NULL, __ATOMIC_ACQUIRE);
+
+	h->h_root = _heap_merge(t, h->h_root, _heap_multipass_merge(t, list));
+
+	for (; hr != NULL; hr = nhr) {
+		nhr = hr->hr_next;
+		he = heap_n2e(t, hr->hr_node);
+
+		if (_heap_linked(h, he)) {
+			_heap_remove_entry(t, h, he);
+			state = HEAP_REQ_REMOVED;
+		} else
+			state = HEAP_REQ_MISSED;
+
+		__atomic_store_n(&hr->hr_state, state, __ATOMIC_RELEASE);
+	}
+}
+
+static inline void
+_heap_intake(const struct _heap_type *t, struct _heap *h)
+{
+	if (!(t->t_flags & HEAP_F_INTAKE))
+		return;
+
+	if (__atomic_load_n(&h->h_intake, __ATOMIC_RELAXED) != NULL ||
+	    __atomic_load_n(&h->h_cancel, __ATOMIC_RELAXED) != NULL)
+		_heap_intake_drain(t, h);
+}
+
+/*
+ * lazy heaps put inserted elements on h_aux without comparing them to
+ * anything. they are melded into h_root when the minimum is needed.
+ */
+static inline void
+_heap_consolidate(const struct _heap_type *t, struct _heap *h)
+{
+	struct _heap_entry *list;
+
+	_heap_intake(t, h);
+
+	list = h->h_aux;
+	if (list == NULL)
+		return;
+
+	h->h_aux = NULL;
+	h->h_root = _heap_merge(t, h->h_root, _heap_multipass_merge(t, list));
+}
+
 void
 _heap_insert(const struct _heap_type *t, struct _heap *h, void *node)
 {
@@ -137,28 +349,233 @@ _heap_insert(const struct _heap_type *t, struct _heap *h, void *node)
 	he->he_child = NULL;
 	he->he_nextsibling = NULL;
 
+	if (t->t_flags & HEAP_F_LAZY) {
+		/* elements after the first on h_aux point back like siblings */
+		if ((he->he_nextsibling = h->h_aux) != NULL)
+			h->h_aux->he_left = he;
+		h->h_aux = he;
+		return;
+	}
+
 	h->h_root = _heap_merge(t, h->h_root, he);
 }
 
+static inline void
+_heap_build_link(struct _heap_entry **tailp, struct _heap_entry *he)
+{
+	he->he_left = NULL;
+	he->he_child = NULL;
+	he->he_nextsibling = NULL;
+
+	*tailp = he;
+}
+
+/*
+ * adds the elements returned by next until it returns NULL. they are
+ * melded in pairs, so a batch of n elements takes n comparisons.
+ */
 void
-_heap_remove(const struct _heap_type *t, struct _heap *h, void *node)
+_heap_build(const struct _heap_type *t, struct _heap *h,
+    void *(*next)(void *), void *arg)
+{
+	struct _heap_entry *list = NULL, **tailp = &list;
+	void *node;
+
+	while ((node = (*next)(arg)) != NULL) {
+		_heap_build_link(tailp, heap_n2e(t, node));
+		tailp = &(*tailp)->he_nextsibling;
+	}
+
+	h->h_root = _heap_merge(t, h->h_root, _heap_multipass_merge(t, list));
+}
+
+void
+_heap_build_array(const struct _heap_type *t, struct _heap *h,
+    void **nodes, size_t n)
+{
+	struct _heap_entry *list = NULL, **tailp = &list;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		_heap_build_link(tailp, heap_n2e(t, nodes[i]));
+		tailp = &(*tailp)->he_nextsibling;
+	}
+
+	h->h_root = _heap_merge(t, h->h_root, _heap_multipass_merge(t, list));
+}
+
+/*
+ * elements are pushed onto h_intake by other threads with only
+ * he_nextsibling set, and melded in by the thread that owns the heap.
+ */
+void
+_heap_intake_insert(const struct _heap_type *t, struct _heap *h, void *node)
 {
 	struct _heap_entry *he = heap_n2e(t, node);
+	struct _heap_entry *head;
+
+	he->he_left = NULL;
+	he->he_child = NULL;
+
+	head = __atomic_load_n(&h->h_intake, __ATOMIC_RELAXED);
+	do {
+		he->he_nextsibling = head;
+	} while (!__atomic_compare_exchange_n(&h->h_intake, &head, he, 1,
+	    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void
+_heap_intake_remove(struct _heap *h, void *node, struct _heap_req *hr)
+{
+	struct _heap_req *head;
 
-	if (he->he_left == NULL) {
-		_heap_extract(t, h);
+	hr->hr_node = node;
+	hr->hr_state = HEAP_REQ_QUEUED;
+
+	head = __atomic_load_n(&h->h_cancel, __ATOMIC_RELAXED);
+	do {
+		hr->hr_next = head;
+	} while (!__atomic_compare_exchange_n(&h->h_cancel, &head, hr, 1,
+	    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void
+_heap_remove(const struct _heap_type *t, struct _heap *h, void *node)
+{
+	_heap_intake(t, h);
+	_heap_remove_entry(t, h, heap_n2e(t, node));
+}
+
+static void
+_heap_remove_entry(const struct _heap_type *t, struct _heap *h,
+    struct _heap_entry *he)
+{
+	if (he == h->h_root) {
+		h->h_root = _heap_2pass_merge(t, he);
+		_heap_entry_clear(he);
+		return;
+	}
+
+	if (he == h->h_aux) {
+		if ((h->h_aux = he->he_nextsibling) != NULL)
+			h->h_aux->he_left = NULL;
+		_heap_entry_clear(he);
 		return;
 	}
 
 	_heap_sibling_remove(he);
 	h->h_root = _heap_merge(t, h->h_root, _heap_2pass_merge(t, he));
+	_heap_entry_clear(he);
+}
+
+/*
+ * the key of node has gone down, so it can only be out of order with
+ * its parent. cut it and its subtree out and meld that with the root.
+ */
+void
+_heap_decrease(const struct _heap_type *t, struct _heap *h, void *node)
+{
+	struct _heap_entry *he = heap_n2e(t, node);
+
+	_heap_intake(t, h);
+
+	if (he->he_left == NULL)
+		return;
+
+	_heap_sibling_remove(he);
+	h->h_root = _heap_merge(t, h->h_root, he);
+}
+
+/* the key of node has changed in either direction */
+void
+_heap_update(const struct _heap_type *t, struct _heap *h, void *node)
+{
+	struct _heap_entry *he = heap_n2e(t, node);
+	struct _heap_entry *child;
+
+	_heap_intake(t, h);
+
+	for (child = he->he_child; child != NULL;
+	    child = child->he_nextsibling) {
+		if (heap_compare(t, heap_e2n(t, child), node) < 0)
+			break;
+	}
+
+	/* the children are still in order, so treat it as a decrease */
+	if (child == NULL) {
+		_heap_decrease(t, h, node);
+		return;
+	}
+
+	_heap_remove(t, h, node);
+	_heap_insert(t, h, node);
+}
+
+/* moves all the elements in h2 into h1 */
+void
+_heap_meld(const struct _heap_type *t, struct _heap *h1, struct _heap *h2)
+{
+	struct _heap_entry *tail;
+
+	_heap_intake(t, h1);
+	_heap_intake(t, h2);
+
+	h1->h_root = _heap_merge(t, h1->h_root, h2->h_root);
+
+	if (h2->h_aux != NULL) {
+		for (tail = h2->h_aux; tail->he_nextsibling != NULL;
+		    tail = tail->he_nextsibling)
+			;
+
+		if ((tail->he_nextsibling = h1->h_aux) != NULL)
+			h1->h_aux->he_left = tail;
+		h1->h_aux = h2->h_aux;
+	}
+}
+
+/*
+ * moves the later half of the subtrees below the root of h into out,
+ * which gives another thread some of the work without walking the
+ * heap. the root stays in h.
+ */
+int
+_heap_split(const struct _heap_type *t, struct _heap *h, struct _heap *out)
+{
+	struct _heap_entry *root, *he, *list;
+	unsigned int n = 0, i;
+
+	_heap_consolidate(t, h);
+
+	root = h->h_root;
+	if (root == NULL || root->he_child == NULL)
+		return (0);
+
+	for (he = root->he_child; he != NULL; he = he->he_nextsibling)
+		n++;
+
+	for (i = 0, list = root->he_child; i < n / 2; i++)
+		list = list->he_nextsibling;
+
+	if (list->he_left == root)
+		root->he_child = NULL;
+	else
+		list->he_left->he_nextsibling = NULL;
+	list->he_left = NULL;
+
+	out->h_root = _heap_merge(t, out->h_root,
+	    _heap_multipass_merge(t, list));
+
+	return (1);
 }
 
 void *
 _heap_first(const struct _heap_type *t, struct _heap *h)
 {
-	struct _heap_entry *first = h->h_root;
+	struct _heap_entry *first;
+
+	_heap_consolidate(t, h);
 
+	first = h->h_root;
 	if (first == NULL)
 		return (NULL);
 
@@ -168,12 +585,16 @@ _heap_first(const struct _heap_type *t, struct _heap *h)
 void *
 _heap_extract(const struct _heap_type *t, struct _heap *h)
 {
-	struct _heap_entry *first = h->h_root;
+	struct _heap_entry *first;
 
+	_heap_consolidate(t, h);
+
+	first = h->h_root;
 	if (first == NULL)
 		return (NULL);
 
 	h->h_root = _heap_2pass_merge(t, first);
+	_heap_entry_clear(first);
 
 	return (heap_e2n(t, first));
 }
@@ -181,21 +602,75 @@ _heap_extract(const struct _heap_type *t, struct _heap *h)
 void *
 _heap_cextract(const struct _heap_type *t, struct _heap *h, const void *key)
 {
-	struct _heap_entry *first = h->h_root;
+	struct _heap_entry *first;
 	void *node;
 
+	_heap_consolidate(t, h);
+
+	first = h->h_root;
 	if (first == NULL)
 		return (NULL);
 
 	node = heap_e2n(t, first);
-	if (t->t_compare(key, node) < 0)
+	if (heap_compare(t, key, node) < 0)
 		return (NULL);
 
 	h->h_root = _heap_2pass_merge(t, first);
+	_heap_entry_clear(first);
 
 	return (node);
 }
 
+/*
+ * removes every node that compares lower than or equal to key and
+ * passes it to fn. the nodes are found by walking down from the root
+ * until a subtree is higher than key, and those subtrees are melded
+ * into the new root once at the end.
+ */
+size_t
+_heap_extract_until(const struct _heap_type *t, struct _heap *h,
+    const void *key, void (*fn)(void *, void *), void *arg)
+{
+	struct _heap_entry *stack, *rest = NULL;
+	struct _heap_entry *he, *child, *next;
+	size_t n = 0;
+
+	_heap_consolidate(t, h);
+
+	stack = h->h_root;
+	if (stack == NULL || heap_compare(t, key, heap_e2n(t, stack)) < 0)
+		return (0);
+
+	/* both lists are linked with he_nextsibling */
+	stack->he_nextsibling = NULL;
+	while ((he = stack) != NULL) {
+		stack = he->he_nextsibling;
+
+		for (child = he->he_child; child != NULL; child = next) {
+			next = child->he_nextsibling;
+			child->he_left = NULL;
+
+			if (heap_compare(t, key, heap_e2n(t, child)) < 0) {
+				child->he_nextsibling = rest;
+				rest = child;
+			} else {
+				child->he_nextsibling = stack;
+				stack = child;
+			}
+		}
+
+		he->he_child = NULL;
+		he->he_nextsibling = NULL;
+
+		(*fn)(arg, heap_e2n(t, he));
+		n++;
+	}
+
+	h->h_root = _heap_multipass_merge(t, rest);
+
+	return (n);
+}
+
 void *
 _heap_iter_next(const struct _heap_type *t, const void *node)
 {
@@ -231,3 +706,131 @@ _heap_iter_next(const struct _heap_type *t, const void *node)
 
 	return (NULL);
 }
+
+/*
+ * Ordered iteration.
+ *
+ * Every element in the heap orders higher than or equal to its parent,
+ * so the next element in order is always a child of one of the elements
+ * that have already been returned. Those children are kept in a binary
+ * heap in storage provided by the caller, so the heap itself is not
+ * modified.
+ *
+ * The size of the frontier bounds how many elements are returned. Once
+ * r elements have been returned, only the lowest size - r candidates
+ * can be among the rest, so when the frontier is full the highest
+ * candidate is dropped. A root with many children, which is what a run
+ * of inserts leaves behind, then costs a scan of the frontier leaves
+ * for each child that does not fit, on top of the log of the frontier
+ * size for each child that does.
+ */
+
+static void
+_heap_oiter_sift(struct _heap_oiter *it, unsigned int i, void *node)
+{
+	const struct _heap_type *t = it->hoi_type;
+	void **f = it->hoi_frontier;
+	unsigned int p;
+
+	for (; i > 0; i = p) {
+		p = (i - 1) / 2;
+		if (heap_compare(t, f[p], node) <= 0)
+			break;
+		f[i] = f[p];
+	}
+	f[i] = node;
+}
+
+static void
+_heap_oiter_push(struct _heap_oiter *it, void *node)
+{
+	const struct _heap_type *t = it->hoi_type;
+	void **f = it->hoi_frontier;
+	unsigned int i, max;
+
+	if (it->hoi_len < it->hoi_size) {
+		_heap_oiter_sift(it, it->hoi_len++, node);
+		return;
+	}
+
+	/* there are more candidates than elements left to return */
+	it->hoi_overflow = 1;
+	if (it->hoi_len == 0)
+		return;
+
+	/* the highest candidate is one of the leaves */
+	max = it->hoi_len / 2;
+	for (i = max + 1; i < it->hoi_len; i++) {
+		if (heap_compare(t, f[i], f[max]) > 0)
+			max = i;
+	}
+
+	if (heap_compare(t, node, f[max]) < 0)
+		_heap_oiter_sift(it, max, node);
+}
+
+static void *
+_heap_oiter_pop(struct _heap_oiter *it)
+{
+	const struct _heap_type *t = it->hoi_type;
+	void **f = it->hoi_frontier;
+	void *first = f[0];
+	void *node = f[--it->hoi_len];
+	unsigned int i, c, n = it->hoi_len;
+
+	for (i = 0; (c = i * 2 + 1) < n; i = c) {
+		if (c + 1 < n && heap_compare(t, f[c + 1], f[c]) < 0)
+			c++;
+		if (heap_compare(t, node, f[c]) <= 0)
+			break;
+		f[i] = f[c];
+	}
+	f[i] = node;
+
+	return (first);
+}
+
+void
+_heap_oiter_init(const struct _heap_type *t, struct _heap *h,
+    struct _heap_oiter *it, void **frontier, unsigned int size)
+{
+	/* elements on h_aux have no order yet */
+	_heap_consolidate(t, h);
+
+	it->hoi_type = t;
+	it->hoi_frontier = frontier;
+	it->hoi_len = 0;
+	it->hoi_size = size;
+	it->hoi_overflow = 0;
+
+	if (h->h_root == NULL)
+		return;
+
+	_heap_oiter_push(it, heap_e2n(t, h->h_root));
+}
+
+/*
+ * returns NULL at the end of the heap, or once as many elements as the
+ * frontier holds have been returned. HEAP_OITER_OVERFLOW says if there
+ * were more.
+ */
+void *
+_heap_oiter_next(struct _heap_oiter *it)
+{
+	const struct _heap_type *t = it->hoi_type;
+	const struct _heap_entry *he, *child;
+	void *node;
+
+	if (it->hoi_len == 0)
+		return (NULL);
+
+	node = _heap_oiter_pop(it);
+	it->hoi_size--;
+
+	he = heap_n2e(t, node);
+	for (child = he->he_child; child != NULL;
+	    child = child->he_nextsibling)
+		_heap_oiter_push(it, heap_e2n(t, child));
+
+	return (node);
+}
@@ -19,11 +19,21 @@
 #ifndef _HEAP_H_
 #define _HEAP_H_
 
-#include <sys/_null.h>
+#include <stddef.h>
+
+#ifndef __unused
+#define __unused __attribute__((__unused__))
+#endif
 
 struct _heap_type {
 	int			(*t_compare)(const void *, const void *);
 	unsigned int		  t_offset; /* offset of heap_entry in type */
+	unsigned int		  t_flags;
+#define HEAP_F_LAZY			0x1 /* insert onto h_aux */
+#define HEAP_F_INTAKE			0x2 /* drain h_intake and h_cancel */
+#ifdef HEAP_STATS
+	struct _heap_stats	 *t_stats;
+#endif
 };
 
 struct _heap_entry {
@@ -33,8 +43,30 @@ struct _heap_entry {
 };
 #define HEAP_ENTRY(_entry)	struct _heap_entry
 
+/* a removal queued by another thread, see HEAP_INTAKE_REMOVE */
+struct _heap_req {
+	struct _heap_req	*hr_next;
+	void			*hr_node;
+	unsigned int		 hr_state;
+#define HEAP_REQ_QUEUED			0
+#define HEAP_REQ_REMOVED		1
+#define HEAP_REQ_MISSED			2 /* elm was not in the heap */
+};
+
 struct _heap {
 	struct _heap_entry	*h_root;
+	struct _heap_entry	*h_aux;	/* not melded with h_root yet */
+	struct _heap_entry	*h_intake; /* pushed by other threads */
+	struct _heap_req	*h_cancel; /* pushed by other threads */
+};
+
+/* iterates over a heap in order, see HEAP_OITER_INIT */
+struct _heap_oiter {
+	const struct _heap_type	 *hoi_type;
+	void			**hoi_frontier;	/* binary heap of elements */
+	unsigned int		  hoi_len;
+	unsigned int		  hoi_size;	/* elements left to return */
+	int			  hoi_overflow;
 };
 
 #define HEAP_HEAD(_name)						\
@@ -46,26 +78,118 @@ static inline void
 _heap_init(struct _heap *h)
 {
 	h->h_root = NULL;
+	h->h_aux = NULL;
+	h->h_intake = NULL;
+	h->h_cancel = NULL;
 }
 
 static inline int
 _heap_empty(struct _heap *h)
 {
-	return (h->h_root == NULL);
+	return (h->h_root == NULL && h->h_aux == NULL &&
+	    __atomic_load_n(&h->h_intake, __ATOMIC_RELAXED) == NULL);
 }
 
 void	 _heap_insert(const struct _heap_type *, struct _heap *, void *);
 void	 _heap_remove(const struct _heap_type *, struct _heap *, void *);
+void	 _heap_intake_insert(const struct _heap_type *, struct _heap *,
+	     void *);
+void	 _heap_intake_remove(struct _heap *, void *, struct _heap_req *);
+
+/* the owner is done with req once it is no longer HEAP_REQ_QUEUED */
+static inline unsigned int
+_heap_req_state(const struct _heap_req *hr)
+{
+	return (__atomic_load_n(&hr->hr_state, __ATOMIC_ACQUIRE));
+}
+void	 _heap_decrease(const struct _heap_type *, struct _heap *, void *);
+void	 _heap_update(const struct _heap_type *, struct _heap *, void *);
 void	*_heap_first(const struct _heap_type *, struct _heap *);
 struct _heap_entry *
 	_heap_merge(const struct _heap_type *,
 	    struct _heap_entry *, struct _heap_entry *);
+void	 _heap_meld(const struct _heap_type *, struct _heap *, struct _heap *);
+int	 _heap_split(const struct _heap_type *, struct _heap *, struct _heap *);
+void	 _heap_build(const struct _heap_type *, struct _heap *,
+	     void *(*)(void *), void *);
+void	 _heap_build_array(const struct _heap_type *, struct _heap *,
+	     void **, size_t);
 void	*_heap_extract(const struct _heap_type *, struct _heap *);
 void	*_heap_cextract(const struct _heap_type *, struct _heap *,
 	     const void *);
+size_t	 _heap_extract_until(const struct _heap_type *, struct _heap *,
+	     const void *, void (*)(void *, void *), void *);
 void	*_heap_iter_next(const struct _heap_type *, const void *);
+void	 _heap_oiter_init(const struct _heap_type *, struct _heap *,
+	     struct _heap_oiter *, void **, unsigned int);
+void	*_heap_oiter_next(struct _heap_oiter *);
+
+/*
+ * Programs built with HEAP_STATS count what heap.c does for each heap
+ * type. Each thread counts in its own slot, so keeping count is cheap,
+ * but increments may be lost when more than HEAP_STATS_SLOTS threads
+ * use one type. HEAP_STATS_SNAPSHOT adds the slots up and
+ * HEAP_STATS_RESET clears them.
+ */
+#ifdef HEAP_STATS
+#include <stdint.h>
 
-#define HEAP_INITIALIZER(_head)	{ { NULL } }
+#define HEAP_STATS_SLOTS	64
+
+struct heap_counters {
+	uint64_t		  hc_compares;	/* comparison function calls */
+	uint64_t		  hc_merges;	/* two-pass merges */
+	uint64_t		  hc_merged;	/* heaps in the merged lists */
+};
+
+struct _heap_stats_slot {
+	struct heap_counters	  hss_counters;
+} __attribute__((__aligned__(64)));
+
+struct _heap_stats {
+	struct _heap_stats_slot	  hs_slots[HEAP_STATS_SLOTS];
+};
+
+extern __thread unsigned int _heap_stats_idx;	/* slot + 1, or 0 */
+unsigned int	 _heap_stats_assign(void);
+void	 _heap_stats_snapshot(const struct _heap_type *,
+	     struct heap_counters *);
+void	 _heap_stats_reset(const struct _heap_type *);
+
+#define HEAP_STATS_PROTOTYPE(_name)					\
+									\
+static __unused inline void						\
+_name##_HEAP_STATS_SNAPSHOT(struct heap_counters *hc)			\
+{									\
+	_heap_stats_snapshot(_name##_HEAP_TYPE, hc);			\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_STATS_RESET(void)						\
+{									\
+	_heap_stats_reset(_name##_HEAP_TYPE);				\
+}
+#define HEAP_STATS_GENERATE(_name)					\
+static struct _heap_stats _name##_HEAP_STATS;
+#define HEAP_STATS_TYPE(_name)		&_name##_HEAP_STATS,
+
+#define HEAP_STATS_SNAPSHOT(_name, _hc)	_name##_HEAP_STATS_SNAPSHOT((_hc))
+#define HEAP_STATS_RESET(_name)		_name##_HEAP_STATS_RESET()
+#else
+#define HEAP_STATS_PROTOTYPE(_name)
+#define HEAP_STATS_GENERATE(_name)
+#define HEAP_STATS_TYPE(_name)
+#endif
+
+/* heap_mq.c */
+struct _heap_mq;
+int	 _heap_mq_create(const struct _heap_type *, struct _heap_mq **,
+	     unsigned int);
+void	 _heap_mq_destroy(struct _heap_mq *);
+void	 _heap_mq_insert(struct _heap_mq *, void *);
+void	*_heap_mq_extract(struct _heap_mq *);
+
+#define HEAP_INITIALIZER(_head)	{ { NULL, NULL, NULL, NULL } }
 
 #define HEAP_PROTOTYPE(_name, _type)					\
 extern const struct _heap_type *const _name##_HEAP_TYPE;		\
@@ -88,6 +212,31 @@ _name##_HEAP_REMOVE(struct _name *head, struct _type *elm)		\
 	_heap_remove(_name##_HEAP_TYPE, &head->heap, elm);		\
 }									\
 									\
+static __unused inline void						\
+_name##_HEAP_INTAKE_INSERT(struct _name *head, struct _type *elm)	\
+{									\
+	_heap_intake_insert(_name##_HEAP_TYPE, &head->heap, elm);	\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_INTAKE_REMOVE(struct _name *head, struct _type *elm,	\
+    struct _heap_req *req)						\
+{									\
+	_heap_intake_remove(&head->heap, elm, req);			\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_DECREASE(struct _name *head, struct _type *elm)		\
+{									\
+	_heap_decrease(_name##_HEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_UPDATE(struct _name *head, struct _type *elm)		\
+{									\
+	_heap_update(_name##_HEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
 static __unused inline struct _type *					\
 _name##_HEAP_FIRST(struct _name *head)					\
 {									\
@@ -97,8 +246,28 @@ _name##_HEAP_FIRST(struct _name *head)					\
 static __unused inline void						\
 _name##_HEAP_MERGE(struct _name *head1, struct _name *head2)		\
 {									\
-	head1->heap.h_root = _heap_merge(_name##_HEAP_TYPE,		\
-	    head1->heap.h_root, head2->heap.h_root);			\
+	_heap_meld(_name##_HEAP_TYPE, &head1->heap, &head2->heap);	\
+}									\
+									\
+static __unused inline int						\
+_name##_HEAP_SPLIT(struct _name *head, struct _name *out)		\
+{									\
+	return _heap_split(_name##_HEAP_TYPE, &head->heap, &out->heap);	\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_BUILD(struct _name *head,					\
+    void *(*next)(void *), void *arg)					\
+{									\
+	_heap_build(_name##_HEAP_TYPE, &head->heap, next, arg);		\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_BUILD_ARRAY(struct _name *head, struct _type **elms,	\
+    size_t n)								\
+{									\
+	_heap_build_array(_name##_HEAP_TYPE, &head->heap,		\
+	    (void **)elms, n);						\
 }									\
 									\
 static __unused inline struct _type *					\
@@ -113,6 +282,14 @@ _name##_HEAP_CEXTRACT(struct _name *head, const struct _type *key)	\
 	return _heap_cextract(_name##_HEAP_TYPE, &head->heap, key);	\
 }									\
 									\
+static __unused inline size_t						\
+_name##_HEAP_EXTRACT_UNTIL(struct _name *head, const struct _type *key,	\
+    void (*fn)(void *, void *), void *arg)				\
+{									\
+	return _heap_extract_until(_name##_HEAP_TYPE, &head->heap,	\
+	    key, fn, arg);						\
+}									\
+									\
 static __unused inline int						\
 _name##_HEAP_EMPTY(struct _name *head)					\
 {									\
@@ -129,31 +306,100 @@ static __unused inline struct _type *					\
 _name##_HEAP_ITER_NEXT(struct _type *elm)				\
 {									\
 	return _heap_iter_next(_name##_HEAP_TYPE, elm);			\
-}
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_OITER_INIT(struct _name *head, struct _heap_oiter *it,	\
+    struct _type **frontier, unsigned int size)				\
+{									\
+	_heap_oiter_init(_name##_HEAP_TYPE, &head->heap, it,		\
+	    (void **)frontier, size);					\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_OITER_NEXT(struct _heap_oiter *it)				\
+{									\
+	return _heap_oiter_next(it);					\
+}									\
+									\
+static __unused inline int						\
+_name##_HEAP_MQ_CREATE(struct _heap_mq **mqp, unsigned int nshards)	\
+{									\
+	return _heap_mq_create(_name##_HEAP_TYPE, mqp, nshards);	\
+}									\
+									\
+static __unused inline void						\
+_name##_HEAP_MQ_INSERT(struct _heap_mq *mq, struct _type *elm)		\
+{									\
+	_heap_mq_insert(mq, elm);					\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_HEAP_MQ_EXTRACT(struct _heap_mq *mq)				\
+{									\
+	return _heap_mq_extract(mq);					\
+}									\
+HEAP_STATS_PROTOTYPE(_name)
 
-#define HEAP_GENERATE(_name, _type, _field, _cmp)			\
+#define HEAP_GENERATE_INTERNAL(_name, _type, _field, _cmp, _flags)	\
 static int								\
 _name##_HEAP_COMPARE(const void *lptr, const void *rptr)		\
 {									\
 	const struct _type *l = lptr, *r = rptr;			\
 	return _cmp(l, r);						\
 }									\
+HEAP_STATS_GENERATE(_name)						\
 static const struct _heap_type _name##_HEAP_INFO = {			\
 	_name##_HEAP_COMPARE,						\
 	offsetof(struct _type, _field),					\
+	_flags,								\
+	HEAP_STATS_TYPE(_name)						\
 };									\
 const struct _heap_type *const _name##_HEAP_TYPE = &_name##_HEAP_INFO
 
+#define HEAP_GENERATE(_name, _type, _field, _cmp)			\
+    HEAP_GENERATE_INTERNAL(_name, _type, _field, _cmp, 0)
+
+#define HEAP_GENERATE_LAZY(_name, _type, _field, _cmp)			\
+    HEAP_GENERATE_INTERNAL(_name, _type, _field, _cmp, HEAP_F_LAZY)
+
+#define HEAP_GENERATE_INTAKE(_name, _type, _field, _cmp)		\
+    HEAP_GENERATE_INTERNAL(_name, _type, _field, _cmp, HEAP_F_INTAKE)
+
 #define HEAP_INIT(_name, _h)		_name##_HEAP_INIT((_h))
 #define HEAP_INSERT(_name, _h, _e)	_name##_HEAP_INSERT((_h), (_e))
 #define HEAP_REMOVE(_name, _h, _e)	_name##_HEAP_REMOVE((_h), (_e))
+#define HEAP_INTAKE_INSERT(_name, _h, _e)				\
+	_name##_HEAP_INTAKE_INSERT((_h), (_e))
+#define HEAP_INTAKE_REMOVE(_name, _h, _e, _r)				\
+	_name##_HEAP_INTAKE_REMOVE((_h), (_e), (_r))
+#define HEAP_INTAKE_STATE(_r)		_heap_req_state((_r))
+#define HEAP_DECREASE(_name, _h, _e)	_name##_HEAP_DECREASE((_h), (_e))
+#define HEAP_UPDATE(_name, _h, _e)	_name##_HEAP_UPDATE((_h), (_e))
 #define HEAP_FIRST(_name, _h)		_name##_HEAP_FIRST((_h))
 #define HEAP_MERGE(_name, _h1, _h2)	_name##_HEAP_MERGE((_h1), (_h2))
+#define HEAP_SPLIT(_name, _h, _out)	_name##_HEAP_SPLIT((_h), (_out))
+#define HEAP_BUILD(_name, _h, _next, _arg)				\
+	_name##_HEAP_BUILD((_h), (_next), (_arg))
+#define HEAP_BUILD_ARRAY(_name, _h, _elms, _n)				\
+	_name##_HEAP_BUILD_ARRAY((_h), (_elms), (_n))
 #define HEAP_EXTRACT(_name, _h)		_name##_HEAP_EXTRACT((_h))
 #define HEAP_CEXTRACT(_name, _h, _k)	_name##_HEAP_CEXTRACT((_h), (_k))
+#define HEAP_EXTRACT_UNTIL(_name, _h, _k, _fn, _arg)			\
+	_name##_HEAP_EXTRACT_UNTIL((_h), (_k), (_fn), (_arg))
 #define HEAP_EMPTY(_name, _h)		_name##_HEAP_EMPTY((_h))
 
 #define HEAP_ITER_FIRST(_name, _h)	_name##_HEAP_ITER_FIRST((_h))
 #define HEAP_ITER_NEXT(_name, _e)	_name##_HEAP_ITER_NEXT((_e))
 
+#define HEAP_OITER_INIT(_name, _h, _it, _f, _n)				\
+	_name##_HEAP_OITER_INIT((_h), (_it), (_f), (_n))
+#define HEAP_OITER_NEXT(_name, _it)	_name##_HEAP_OITER_NEXT((_it))
+#define HEAP_OITER_OVERFLOW(_it)	((_it)->hoi_overflow)
+
+#define HEAP_MQ_CREATE(_name, _mqp, _n)	_name##_HEAP_MQ_CREATE((_mqp), (_n))
+#define HEAP_MQ_DESTROY(_mq)		_heap_mq_destroy((_mq))
+#define HEAP_MQ_INSERT(_name, _mq, _e)	_name##_HEAP_MQ_INSERT((_mq), (_e))
+#define HEAP_MQ_EXTRACT(_name, _mq)	_name##_HEAP_MQ_EXTRACT((_mq))
+
 #endif /* _HEAP_H_ */
@@ -0,0 +1,223 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A relaxed priority queue for many threads, made of several heaps
+ * that each have their own lock.
+ *
+ * Inserts go to a random heap. Extracts pick two random heaps and take
+ * the first element of the one that orders lower, so the element
+ * returned is not always the lowest in the queue, but is close to it.
+ * Locks are only ever tried, and a thread that can't get one picks
+ * other heaps instead of waiting. A couple of heaps per thread keeps
+ * the chance of collisions low.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "heap.h"
+
+#define HEAP_MQ_ALIGN		64
+#define HEAP_MQ_TRIES		8	/* before extract looks at every heap */
+
+struct _heap_mq_shard {
+	pthread_mutex_t		  s_mtx;
+	struct _heap		  s_heap;
+} __attribute__((__aligned__(HEAP_MQ_ALIGN)));
+
+struct _heap_mq {
+	const struct _heap_type	 *mq_type;
+	unsigned int		  mq_nshards;
+	struct _heap_mq_shard	 *mq_shards;
+};
+
+static __thread uint32_t heap_mq_seed;
+
+static inline uint32_t
+heap_mq_random(unsigned int n)
+{
+	uint32_t x = heap_mq_seed;
+
+	if (x == 0) {
+		/* each thread has its own copy of the seed */
+		x = (uint32_t)((uintptr_t)&heap_mq_seed >> 4) | 1;
+	}
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	heap_mq_seed = x;
+
+	return (((uint64_t)x * n) >> 32);
+}
+
+int
+_heap_mq_create(const struct _heap_type *t, struct _heap_mq **mqp,
+    unsigned int nshards)
+{
+	struct _heap_mq *mq;
+	struct _heap_mq_shard *s;
+	unsigned int i;
+	void *mem;
+
+	if (nshards == 0)
+		return (EINVAL);
+
+	mq = malloc(sizeof(*mq));
+	if (mq == NULL)
+		return (ENOMEM);
+
+	if (posix_memalign(&mem, HEAP_MQ_ALIGN, nshards * sizeof(*s)) != 0) {
+		free(mq);
+		return (ENOMEM);
+	}
+
+	mq->mq_type = t;
+	mq->mq_nshards = nshards;
+	mq->mq_shards = mem;
+
+	for (i = 0; i < nshards; i++) {
+		s = &mq->mq_shards[i];
+		pthread_mutex_init(&s->s_mtx, NULL);
+		_heap_init(&s->s_heap);
+	}
+
+	*mqp = mq;
+
+	return (0);
+}
+
+void
+_heap_mq_destroy(struct _heap_mq *mq)
+{
+	unsigned int i;
+
+	for (i = 0; i < mq->mq_nshards; i++)
+		pthread_mutex_destroy(&mq->mq_shards[i].s_mtx);
+
+	free(mq->mq_shards);
+	free(mq);
+}
+
+void
+_heap_mq_insert(struct _heap_mq *mq, void *node)
+{
+	struct _heap_mq_shard *s;
+
+	do {
+		s = &mq->mq_shards[heap_mq_random(mq->mq_nshards)];
+	} while (pthread_mutex_trylock(&s->s_mtx) != 0);
+
+	_heap_insert(mq->mq_type, &s->s_heap, node);
+
+	pthread_mutex_unlock(&s->s_mtx);
+}
+
+/* takes the first element from a heap that is already locked */
+static void *
+heap_mq_take(struct _heap_mq *mq, struct _heap_mq_shard *s)
+{
+	void *node;
+
+	node = _heap_extract(mq->mq_type, &s->s_heap);
+	pthread_mutex_unlock(&s->s_mtx);
+
+	return (node);
+}
+
+/* takes the first element of any heap, or says they're all empty */
+static void *
+heap_mq_scan(struct _heap_mq *mq)
+{
+	struct _heap_mq_shard *s;
+	unsigned int i, o;
+
+	o = heap_mq_random(mq->mq_nshards);
+	for (i = 0; i < mq->mq_nshards; i++) {
+		s = &mq->mq_shards[(o + i) % mq->mq_nshards];
+
+		pthread_mutex_lock(&s->s_mtx);
+		if (!_heap_empty(&s->s_heap))
+			return (heap_mq_take(mq, s));
+		pthread_mutex_unlock(&s->s_mtx);
+	}
+
+	return (NULL);
+}
+
+void *
+_heap_mq_extract(struct _heap_mq *mq)
+{
+	const struct _heap_type *t = mq->mq_type;
+	struct _heap_mq_shard *a, *b;
+	unsigned int n = mq->mq_nshards;
+	unsigned int i, j, try;
+	void *fa, *fb;
+
+	if (n == 1) {
+		a = &mq->mq_shards[0];
+		pthread_mutex_lock(&a->s_mtx);
+		return (heap_mq_take(mq, a));
+	}
+
+	for (try = 0; try < HEAP_MQ_TRIES; try++) {
+		i = heap_mq_random(n);
+		j = heap_mq_random(n - 1);
+		if (j >= i)
+			j++;
+
+		a = &mq->mq_shards[i];
+		b = &mq->mq_shards[j];
+
+		if (pthread_mutex_trylock(&a->s_mtx) != 0)
+			continue;
+		if (pthread_mutex_trylock(&b->s_mtx) != 0) {
+			/* settle for the one we got */
+			fa = _heap_first(t, &a->s_heap);
+			if (fa != NULL)
+				return (heap_mq_take(mq, a));
+			pthread_mutex_unlock(&a->s_mtx);
+			continue;
+		}
+
+		fa = _heap_first(t, &a->s_heap);
+		fb = _heap_first(t, &b->s_heap);
+		if (fa == NULL && fb == NULL) {
+			pthread_mutex_unlock(&b->s_mtx);
+			pthread_mutex_unlock(&a->s_mtx);
+			continue;
+		}
+
+		if (fb == NULL ||
+		    (fa != NULL && (*t->t_compare)(fa, fb) <= 0)) {
+			pthread_mutex_unlock(&b->s_mtx);
+			return (heap_mq_take(mq, a));
+		}
+
+		pthread_mutex_unlock(&a->s_mtx);
+		return (heap_mq_take(mq, b));
+	}
+
+	/* the queue may be nearly empty, so look everywhere */
+	return (heap_mq_scan(mq));
+}
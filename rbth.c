@@ -0,0 +1,348 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The table is split into groups of 16 slots, with a control byte per
+ * slot that is either empty, deleted, or the low 7 bits of the hash of
+ * the element in it. A lookup picks a group from the rest of the hash
+ * and compares all 16 control bytes against those 7 bits at once, so
+ * the comparison function is usually only called on the element it is
+ * looking for. Groups are probed in triangular steps until one with an
+ * empty slot is found.
+ *
+ * Removing an element only leaves a deleted marker if its group is
+ * full, since a lookup could have gone past the group while it was.
+ * Deleted slots are reused by inserts and cleared out by rehashing.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "rbth.h"
+
+#define RBTH_GROUP		16
+#define RBTH_MINSLOTS		RBTH_GROUP
+
+#define RBTH_EMPTY		0x80
+#define RBTH_DELETED		0xfe	/* both have the high bit set */
+
+/* 7 in every 8 slots can be used before the table is rehashed */
+#define RBTH_CAPACITY(_slots)	((_slots) - (_slots) / 8)
+
+static inline uint64_t
+rbth_hash(const struct rbth_type *t, const void *node)
+{
+	uint64_t h = (*t->t_hash)(node);
+
+	/* spread weak hashes, like small integers, over every bit */
+	h ^= h >> 31;
+	h *= 0x9e3779b97f4a7c15ULL;
+	h ^= h >> 32;
+
+	return (h);
+}
+
+static inline uint8_t
+rbth_h2(uint64_t h)
+{
+	return (h & 0x7f);
+}
+
+static inline size_t
+rbth_group(const struct rbth_index *rhi, uint64_t h)
+{
+	return ((h >> 7) & (rhi->rhi_mask / RBTH_GROUP));
+}
+
+#ifdef __SSE2__
+static inline unsigned int
+rbth_match(const uint8_t *ctrl, uint8_t b)
+{
+	__m128i g = _mm_load_si128((const __m128i *)ctrl);
+
+	return (_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(b))));
+}
+
+/* empty or deleted slots */
+static inline unsigned int
+rbth_match_free(const uint8_t *ctrl)
+{
+	__m128i g = _mm_load_si128((const __m128i *)ctrl);
+
+	return (_mm_movemask_epi8(g));
+}
+#else
+static inline unsigned int
+rbth_match(const uint8_t *ctrl, uint8_t b)
+{
+	unsigned int i, m = 0;
+
+	for (i = 0; i < RBTH_GROUP; i++)
+		m |= (unsigned int)(ctrl[i] == b) << i;
+
+	return (m);
+}
+
+static inline unsigned int
+rbth_match_free(const uint8_t *ctrl)
+{
+	unsigned int i, m = 0;
+
+	for (i = 0; i < RBTH_GROUP; i++)
+		m |= (unsigned int)(ctrl[i] >> 7) << i;
+
+	return (m);
+}
+#endif
+
+static inline size_t
+rbth_slots(size_t n)
+{
+	size_t slots = RBTH_MINSLOTS;
+
+	while (RBTH_CAPACITY(slots) < n)
+		slots *= 2;
+
+	return (slots);
+}
+
+/* puts a node that isn't in the table yet into a free slot */
+static void
+rbth_place(struct rbth_index *rhi, uint64_t h, void *node)
+{
+	size_t g = rbth_group(rhi, h);
+	size_t step = 0;
+	unsigned int m;
+	size_t i;
+
+	for (;;) {
+		m = rbth_match_free(rhi->rhi_ctrl + g * RBTH_GROUP);
+		if (m != 0)
+			break;
+
+		g = (g + ++step) & (rhi->rhi_mask / RBTH_GROUP);
+	}
+
+	i = g * RBTH_GROUP + __builtin_ctz(m);
+	if (rhi->rhi_ctrl[i] == RBTH_EMPTY)
+		rhi->rhi_left--;
+	rhi->rhi_ctrl[i] = rbth_h2(h);
+	rhi->rhi_slots[i] = node;
+	rhi->rhi_len++;
+}
+
+/*
+ * builds a new table from the tree with room for n elements, which
+ * must be at least as many as there are in the tree.
+ */
+static int
+rbth_rehash(const struct rbth_type *t, struct bstree *bst,
+    struct rbth_index *rhi, size_t n)
+{
+	const struct bst_type *bt = &t->t_rbt->t_bst;
+	size_t slots = rbth_slots(n);
+	void *mem, *node;
+
+	if (posix_memalign(&mem, 64,
+	    slots * (sizeof(*rhi->rhi_ctrl) + sizeof(*rhi->rhi_slots))) != 0)
+		return (ENOMEM);
+
+	free(rhi->rhi_ctrl);
+
+	rhi->rhi_ctrl = mem;
+	rhi->rhi_slots = (void **)(rhi->rhi_ctrl + slots);
+	rhi->rhi_mask = slots - 1;
+	rhi->rhi_len = 0;
+	rhi->rhi_left = RBTH_CAPACITY(slots);
+	memset(rhi->rhi_ctrl, RBTH_EMPTY, slots);
+
+	for (node = _bst_min(bt, bst); node != NULL;
+	    node = _bst_next(bt, node))
+		rbth_place(rhi, rbth_hash(t, node), node);
+
+	return (0);
+}
+
+/* the table is gone if it couldn't grow, but the tree is fine */
+static inline int
+rbth_lost(struct bstree *bst, struct rbth_index *rhi)
+{
+	return (rhi->rhi_ctrl == NULL && !_bst_empty(bst));
+}
+
+static size_t
+rbth_count(const struct rbth_type *t, struct bstree *bst)
+{
+	const struct bst_type *bt = &t->t_rbt->t_bst;
+	size_t n = 0;
+	void *node;
+
+	for (node = _bst_min(bt, bst); node != NULL;
+	    node = _bst_next(bt, node))
+		n++;
+
+	return (n);
+}
+
+void
+_rbth_destroy(struct rbth_index *rhi)
+{
+	free(rhi->rhi_ctrl);
+
+	rhi->rhi_ctrl = NULL;
+	rhi->rhi_slots = NULL;
+	rhi->rhi_mask = 0;
+	rhi->rhi_len = 0;
+	rhi->rhi_left = 0;
+}
+
+int
+_rbth_reserve(const struct rbth_type *t, struct bstree *bst,
+    struct rbth_index *rhi, size_t n)
+{
+	size_t len;
+
+	if (rhi->rhi_ctrl != NULL) {
+		if (n <= rhi->rhi_len + rhi->rhi_left)
+			return (0);
+		len = rhi->rhi_len;
+	} else
+		len = rbth_count(t, bst);
+
+	return (rbth_rehash(t, bst, rhi, n > len ? n : len));
+}
+
+void *
+_rbth_find(const struct rbth_type *t, struct bstree *bst,
+    struct rbth_index *rhi, const void *key)
+{
+	int (*cmp)(const void *, const void *) = t->t_rbt->t_bst.t_compare;
+	const uint8_t *ctrl;
+	uint64_t h;
+	size_t g, step = 0;
+	unsigned int m, i;
+	void *node;
+
+	if (rhi->rhi_ctrl == NULL)
+		return (_bst_find(&t->t_rbt->t_bst, bst, key));
+
+	h = rbth_hash(t, key);
+	g = rbth_group(rhi, h);
+
+	for (;;) {
+		ctrl = rhi->rhi_ctrl + g * RBTH_GROUP;
+
+		for (m = rbth_match(ctrl, rbth_h2(h)); m != 0; m &= m - 1) {
+			i = __builtin_ctz(m);
+			node = rhi->rhi_slots[g * RBTH_GROUP + i];
+			if ((*cmp)(key, node) == 0)
+				return (node);
+		}
+
+		if (rbth_match(ctrl, RBTH_EMPTY) != 0)
+			return (NULL);
+
+		g = (g + ++step) & (rhi->rhi_mask / RBTH_GROUP);
+	}
+}
+
+void *
+_rbth_insert(const struct rbth_type *t, struct bstree *bst,
+    struct rbth_index *rhi, void *node)
+{
+	size_t cap = RBTH_CAPACITY(rhi->rhi_mask + 1);
+	void *res;
+
+	if (rbth_lost(bst, rhi))
+		return (_rbt_insert(t->t_rbt, bst, node));
+
+	if (rhi->rhi_ctrl != NULL) {
+		res = _rbth_find(t, bst, rhi, node);
+		if (res != NULL)
+			return (res);
+	}
+
+	res = _rbt_insert(t->t_rbt, bst, node);
+	if (res != NULL)
+		return (res);
+
+	if (rhi->rhi_left == 0) {
+		/*
+		 * the rehash puts node in the table too. the table only
+		 * doubles if it is more than half full, otherwise it is
+		 * deleted slots that ran it out of room.
+		 */
+		if (rbth_rehash(t, bst, rhi, rhi->rhi_len + 1 > cap / 2 ?
+		    cap + 1 : cap) != 0)
+			_rbth_destroy(rhi);
+		return (NULL);
+	}
+
+	rbth_place(rhi, rbth_hash(t, node), node);
+
+	return (NULL);
+}
+
+void *
+_rbth_remove(const struct rbth_type *t, struct bstree *bst,
+    struct rbth_index *rhi, void *node)
+{
+	const uint8_t *ctrl;
+	uint64_t h;
+	size_t g, step = 0;
+	unsigned int m;
+	size_t i;
+
+	_rbt_remove(t->t_rbt, bst, node);
+
+	if (rhi->rhi_ctrl == NULL)
+		return (node);
+
+	h = rbth_hash(t, node);
+	g = rbth_group(rhi, h);
+
+	for (;;) {
+		ctrl = rhi->rhi_ctrl + g * RBTH_GROUP;
+
+		for (m = rbth_match(ctrl, rbth_h2(h)); m != 0; m &= m - 1) {
+			i = g * RBTH_GROUP + __builtin_ctz(m);
+			if (rhi->rhi_slots[i] != node)
+				continue;
+
+			if (rbth_match(ctrl, RBTH_EMPTY) != 0) {
+				rhi->rhi_ctrl[i] = RBTH_EMPTY;
+				rhi->rhi_left++;
+			} else
+				rhi->rhi_ctrl[i] = RBTH_DELETED;
+			rhi->rhi_len--;
+
+			return (node);
+		}
+
+		if (rbth_match(ctrl, RBTH_EMPTY) != 0)
+			return (node);
+
+		g = (g + ++step) & (rhi->rhi_mask / RBTH_GROUP);
+	}
+}
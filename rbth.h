@@ -0,0 +1,153 @@
+/* */
+
+/*
+ * Copyright (c) 2016 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _RBTH_H_
+#define _RBTH_H_
+
+/*
+ * A red-black tree with a hash index for exact lookups.
+ *
+ * RBTH_HEAD contains an RBT tree and an open addressing table of
+ * pointers to the same elements. RBTH_INSERT and RBTH_REMOVE keep both
+ * up to date, and RBTH_FIND looks in the table instead of walking down
+ * the tree. RBTH_PROTOTYPE and RBTH_GENERATE include their RBT
+ * counterparts, so RBT_NFIND, RBT_MIN, RBT_NEXT, RBT_FOREACH and the
+ * other RBT macros that don't change the tree work on the head as
+ * usual. Changing the tree with RBT_INSERT or RBT_REMOVE leaves the
+ * table behind.
+ *
+ * The hash function is called on elements and on lookup keys, and has
+ * to give the same value for any two that compare equal. Keys must be
+ * unique, so RBT_INSERT_MULTI has no counterpart.
+ *
+ * The table grows as elements are inserted. If it can't, it is
+ * dropped and RBTH_FIND falls back to the tree until RBTH_RESERVE
+ * builds it again. RBTH_DESTROY frees it.
+ */
+
+#include "bst.h"
+
+struct rbth_type {
+	const struct rbt_type	 *t_rbt;
+	uint64_t		(*t_hash)(const void *);
+};
+
+struct rbth_index {
+	uint8_t			 *rhi_ctrl;	/* a byte per slot */
+	void			**rhi_slots;
+	size_t			  rhi_mask;	/* slots - 1 */
+	size_t			  rhi_len;
+	size_t			  rhi_left;	/* inserts before a rehash */
+};
+
+#define RBTH_HEAD(_name, _type)						\
+struct _name {								\
+	struct bstree		  rb_tree;				\
+	struct rbth_index	  rb_index;				\
+}
+
+#define RBTH_ENTRY(_type)	struct bst_entry
+
+#define RBTH_INITIALIZER(_head)	{ BST_INITIALIZER(), { NULL, NULL, 0, 0, 0 } }
+
+static inline void
+_rbth_init(struct bstree *bst, struct rbth_index *rhi)
+{
+	_bst_init(bst);
+	rhi->rhi_ctrl = NULL;
+	rhi->rhi_slots = NULL;
+	rhi->rhi_mask = 0;
+	rhi->rhi_len = 0;
+	rhi->rhi_left = 0;
+}
+
+void	 _rbth_destroy(struct rbth_index *);
+int	 _rbth_reserve(const struct rbth_type *, struct bstree *,
+	     struct rbth_index *, size_t);
+void	*_rbth_insert(const struct rbth_type *, struct bstree *,
+	     struct rbth_index *, void *);
+void	*_rbth_remove(const struct rbth_type *, struct bstree *,
+	     struct rbth_index *, void *);
+void	*_rbth_find(const struct rbth_type *, struct bstree *,
+	     struct rbth_index *, const void *);
+
+#define RBTH_PROTOTYPE(_name, _type, _field, _cmp)			\
+RBT_PROTOTYPE(_name, _type, _field, _cmp)				\
+extern const struct rbth_type _name##_RBTH_TYPE;			\
+									\
+__unused static inline void						\
+_name##_RBTH_INIT(struct _name *head)					\
+{									\
+	_rbth_init(&head->rb_tree, &head->rb_index);			\
+}									\
+									\
+__unused static inline void						\
+_name##_RBTH_DESTROY(struct _name *head)				\
+{									\
+	_rbth_destroy(&head->rb_index);					\
+}									\
+									\
+__unused static inline int						\
+_name##_RBTH_RESERVE(struct _name *head, size_t n)			\
+{									\
+	return _rbth_reserve(&_name##_RBTH_TYPE, &head->rb_tree,	\
+	    &head->rb_index, n);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBTH_INSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _rbth_insert(&_name##_RBTH_TYPE, &head->rb_tree,		\
+	    &head->rb_index, elm);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBTH_REMOVE(struct _name *head, struct _type *elm)		\
+{									\
+	return _rbth_remove(&_name##_RBTH_TYPE, &head->rb_tree,		\
+	    &head->rb_index, elm);					\
+}									\
+									\
+__unused static inline struct _type *					\
+_name##_RBTH_FIND(struct _name *head, const struct _type *key)		\
+{									\
+	return _rbth_find(&_name##_RBTH_TYPE, &head->rb_tree,		\
+	    &head->rb_index, key);					\
+}
+
+#define RBTH_GENERATE(_name, _type, _field, _cmp, _hash)		\
+RBT_GENERATE(_name, _type, _field, _cmp);				\
+static uint64_t								\
+_name##_RBTH_HASH(const void *ptr)					\
+{									\
+	const struct _type *p = ptr;					\
+	return _hash(p);						\
+}									\
+const struct rbth_type _name##_RBTH_TYPE = {				\
+	&_name##_RBT_TYPE,						\
+	_name##_RBTH_HASH,						\
+}
+
+#define RBTH_INIT(_name, _head)		_name##_RBTH_INIT(_head)
+#define RBTH_DESTROY(_name, _head)	_name##_RBTH_DESTROY(_head)
+#define RBTH_RESERVE(_name, _head, _n)	_name##_RBTH_RESERVE(_head, _n)
+#define RBTH_INSERT(_name, _head, _elm)	_name##_RBTH_INSERT(_head, _elm)
+#define RBTH_REMOVE(_name, _head, _elm)	_name##_RBTH_REMOVE(_head, _elm)
+#define RBTH_FIND(_name, _head, _key)	_name##_RBTH_FIND(_head, _key)
+
+#endif /* _RBTH_H_ */
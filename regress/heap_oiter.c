@@ -0,0 +1,155 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Ordered iteration over a pairing heap.
+ *
+ *	cc -O2 -I.. heap_oiter.c ../heap.c && ./a.out
+ *
+ * A run of inserts leaves every element as a child of the root, which
+ * is the shape that needs the frontier to drop candidates. The heap is
+ * also peeked at after some extracts have paired its elements up, with
+ * a frontier that is smaller than, the same size as, and bigger than
+ * the heap. The heap is then drained to check it was left alone.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "heap.h"
+
+#define NELMS		1000
+#define NPEEK		64
+
+struct elm {
+	unsigned int		  e_key;
+	HEAP_ENTRY(elm)		  e_entry;
+};
+
+static int
+elm_cmp(const struct elm *a, const struct elm *b)
+{
+	if (a->e_key < b->e_key)
+		return (-1);
+	if (a->e_key > b->e_key)
+		return (1);
+	return (0);
+}
+
+HEAP_HEAD(elm_heap);
+HEAP_PROTOTYPE(elm_heap, elm);
+HEAP_GENERATE(elm_heap, elm, e_entry, elm_cmp);
+
+static struct elm elms[NELMS];
+static struct elm *frontier[NELMS + 1];
+
+/* the keys in the heap are lo to hi - 1 */
+static void
+peek(const char *name, struct elm_heap *h, unsigned int lo,
+    unsigned int hi, unsigned int size)
+{
+	struct _heap_oiter it;
+	struct elm *e;
+	unsigned int n = 0;
+	unsigned int want;
+
+	want = hi - lo < size ? hi - lo : size;
+
+	HEAP_OITER_INIT(elm_heap, h, &it, frontier, size);
+	while ((e = HEAP_OITER_NEXT(elm_heap, &it)) != NULL) {
+		if (e->e_key != lo + n)
+			errx(1, "%s: element %u has key %u", name, n, e->e_key);
+		n++;
+	}
+
+	if (n != want)
+		errx(1, "%s: %u elements, not %u", name, n, want);
+	if (!HEAP_OITER_OVERFLOW(&it) != (hi - lo <= size))
+		errx(1, "%s: overflow is %d", name, HEAP_OITER_OVERFLOW(&it));
+}
+
+static void
+drain(const char *name, struct elm_heap *h, unsigned int lo,
+    unsigned int hi)
+{
+	struct elm *e;
+	unsigned int key;
+
+	for (key = lo; key < hi; key++) {
+		e = HEAP_EXTRACT(elm_heap, h);
+		if (e == NULL || e->e_key != key)
+			errx(1, "%s: extracted %d, not %u", name,
+			    e == NULL ? -1 : (int)e->e_key, key);
+	}
+	if (!HEAP_EMPTY(elm_heap, h))
+		errx(1, "%s: heap is not empty", name);
+}
+
+static void
+insert(struct elm_heap *h, int shuffle)
+{
+	unsigned int i, j, key;
+
+	for (i = 0; i < NELMS; i++)
+		elms[i].e_key = i;
+	if (shuffle) {
+		for (i = NELMS - 1; i > 0; i--) {
+			j = arc4random_uniform(i + 1);
+			key = elms[i].e_key;
+			elms[i].e_key = elms[j].e_key;
+			elms[j].e_key = key;
+		}
+	}
+
+	HEAP_INIT(elm_heap, h);
+	for (i = 0; i < NELMS; i++)
+		HEAP_INSERT(elm_heap, h, &elms[i]);
+}
+
+int
+main(void)
+{
+	struct elm_heap h;
+	unsigned int i;
+
+	insert(&h, 0);
+	peek("ascending inserts", &h, 0, NELMS, NPEEK);
+	drain("ascending inserts", &h, 0, NELMS);
+
+	insert(&h, 1);
+	peek("random inserts", &h, 0, NELMS, NPEEK);
+	peek("random inserts, no frontier", &h, 0, NELMS, 0);
+	drain("random inserts", &h, 0, NELMS);
+
+	insert(&h, 1);
+	for (i = 0; i < NPEEK; i++)
+		HEAP_EXTRACT(elm_heap, &h);
+	peek("paired", &h, NPEEK, NELMS, NPEEK);
+	peek("paired, all", &h, NPEEK, NELMS, NELMS - NPEEK);
+	peek("paired, more", &h, NPEEK, NELMS, NELMS + 1);
+	drain("paired", &h, NPEEK, NELMS);
+
+	HEAP_INIT(elm_heap, &h);
+	peek("empty", &h, 0, 0, NPEEK);
+
+	printf("ok\n");
+
+	return (0);
+}
@@ -0,0 +1,220 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+
+#include "rheap.h"
+
+static inline struct _rheap_entry *
+rheap_n2e(const struct _rheap_type *t, const void *node)
+{
+	unsigned long addr = (unsigned long)node;
+
+	return ((struct _rheap_entry *)(addr + t->t_offset));
+}
+
+static inline void *
+rheap_e2n(const struct _rheap_type *t, struct _rheap_entry *rhe)
+{
+	unsigned long addr = (unsigned long)rhe;
+
+	return ((void *)(addr - t->t_offset));
+}
+
+/* bucket 0 holds rh_last, bucket b holds keys that differ at bit b - 1 */
+static inline unsigned int
+rheap_bucket(const struct _rheap *rh, uint64_t key)
+{
+	uint64_t diff = key ^ rh->rh_last;
+
+	if (diff == 0)
+		return (0);
+
+	return (64 - __builtin_clzll(diff));
+}
+
+static inline void
+rheap_push(struct _rheap *rh, struct _rheap_entry *rhe)
+{
+	unsigned int b = rheap_bucket(rh, rhe->rhe_key);
+	struct _rheap_entry **head = &rh->rh_buckets[b];
+	struct _rheap_entry *next = *head;
+
+	rhe->rhe_bucket = b;
+	rhe->rhe_next = next;
+	if (next != NULL)
+		next->rhe_prev = &rhe->rhe_next;
+	rhe->rhe_prev = head;
+	*head = rhe;
+
+	if (b > 0)
+		rh->rh_pending |= 1ULL << (b - 1);
+}
+
+static inline void
+rheap_unlink(struct _rheap *rh, struct _rheap_entry *rhe)
+{
+	struct _rheap_entry *next = rhe->rhe_next;
+	unsigned int b = rhe->rhe_bucket;
+
+	if (next != NULL)
+		next->rhe_prev = rhe->rhe_prev;
+	*rhe->rhe_prev = next;
+
+	if (b > 0 && rh->rh_buckets[b] == NULL)
+		rh->rh_pending &= ~(1ULL << (b - 1));
+}
+
+/* finds the element with the lowest key without moving anything */
+static struct _rheap_entry *
+rheap_min(struct _rheap *rh)
+{
+	struct _rheap_entry *rhe, *min;
+
+	min = rh->rh_buckets[0];
+	if (min != NULL || rh->rh_pending == 0)
+		return (min);
+
+	min = rh->rh_buckets[__builtin_ctzll(rh->rh_pending) + 1];
+	for (rhe = min->rhe_next; rhe != NULL; rhe = rhe->rhe_next) {
+		if (rhe->rhe_key < min->rhe_key)
+			min = rhe;
+	}
+
+	return (min);
+}
+
+/*
+ * makes the key of min the new rh_last, which spreads the rest of its
+ * bucket over the buckets below it.
+ */
+static void
+rheap_redistribute(struct _rheap *rh, struct _rheap_entry *min)
+{
+	struct _rheap_entry *rhe, *next;
+	unsigned int b = min->rhe_bucket;
+
+	rhe = rh->rh_buckets[b];
+	rh->rh_buckets[b] = NULL;
+	rh->rh_pending &= ~(1ULL << (b - 1));
+	rh->rh_last = min->rhe_key;
+
+	do {
+		next = rhe->rhe_next;
+		rheap_push(rh, rhe);
+		rhe = next;
+	} while (rhe != NULL);
+}
+
+static void *
+rheap_take(const struct _rheap_type *t, struct _rheap *rh,
+    struct _rheap_entry *min)
+{
+	if (min->rhe_bucket != 0)
+		rheap_redistribute(rh, min);
+
+	rheap_unlink(rh, min);
+
+	return (rheap_e2n(t, min));
+}
+
+void
+_rheap_init(struct _rheap *rh)
+{
+	unsigned int b;
+
+	rh->rh_last = 0;
+	rh->rh_pending = 0;
+	for (b = 0; b < RHEAP_BUCKETS; b++)
+		rh->rh_buckets[b] = NULL;
+}
+
+int
+_rheap_insert(const struct _rheap_type *t, struct _rheap *rh, void *node)
+{
+	struct _rheap_entry *rhe = rheap_n2e(t, node);
+	uint64_t key = (*t->t_key)(node);
+
+	if (key < rh->rh_last)
+		return (EINVAL);
+
+	rhe->rhe_key = key;
+	rheap_push(rh, rhe);
+
+	return (0);
+}
+
+void
+_rheap_remove(const struct _rheap_type *t, struct _rheap *rh, void *node)
+{
+	rheap_unlink(rh, rheap_n2e(t, node));
+}
+
+int
+_rheap_update(const struct _rheap_type *t, struct _rheap *rh, void *node)
+{
+	struct _rheap_entry *rhe = rheap_n2e(t, node);
+	uint64_t key = (*t->t_key)(node);
+
+	if (key < rh->rh_last)
+		return (EINVAL);
+
+	rheap_unlink(rh, rhe);
+	rhe->rhe_key = key;
+	rheap_push(rh, rhe);
+
+	return (0);
+}
+
+void *
+_rheap_first(const struct _rheap_type *t, struct _rheap *rh)
+{
+	struct _rheap_entry *min;
+
+	min = rheap_min(rh);
+	if (min == NULL)
+		return (NULL);
+
+	return (rheap_e2n(t, min));
+}
+
+void *
+_rheap_extract(const struct _rheap_type *t, struct _rheap *rh)
+{
+	struct _rheap_entry *min;
+
+	min = rheap_min(rh);
+	if (min == NULL)
+		return (NULL);
+
+	return (rheap_take(t, rh, min));
+}
+
+void *
+_rheap_cextract(const struct _rheap_type *t, struct _rheap *rh,
+    uint64_t key)
+{
+	struct _rheap_entry *min;
+
+	min = rheap_min(rh);
+	if (min == NULL || min->rhe_key > key)
+		return (NULL);
+
+	return (rheap_take(t, rh, min));
+}
@@ -0,0 +1,159 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _RHEAP_H_
+#define _RHEAP_H_
+
+/*
+ * A radix heap for unsigned 64bit keys that are extracted in
+ * non-decreasing order.
+ *
+ * The heap remembers the last key that was extracted, and elements
+ * are kept in buckets by the highest bit where their key differs from
+ * it. Extracting from an empty bucket 0 takes the lowest bucket with
+ * elements in it and moves them to lower buckets, so each element
+ * moves at most 64 times on its way out of the heap.
+ *
+ * Elements can only be inserted with keys at or above the last key
+ * that was extracted. The key of an element is read when it is
+ * inserted, and RHEAP_UPDATE must be called if it changes while the
+ * element is in the heap.
+ */
+
+#include <sys/_null.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RHEAP_BUCKETS		65
+
+struct _rheap_type {
+	uint64_t		(*t_key)(const void *);
+	unsigned int		  t_offset; /* offset of rheap_entry in type */
+};
+
+struct _rheap_entry {
+	struct _rheap_entry	 *rhe_next;
+	struct _rheap_entry	**rhe_prev;
+	uint64_t		  rhe_key;
+	unsigned int		  rhe_bucket;
+};
+#define RHEAP_ENTRY(_entry)	struct _rheap_entry
+
+struct _rheap {
+	uint64_t		  rh_last;
+	uint64_t		  rh_pending;	/* buckets 1 to 64 */
+	struct _rheap_entry	 *rh_buckets[RHEAP_BUCKETS];
+};
+
+#define RHEAP_HEAD(_name)						\
+struct _name {								\
+	struct _rheap		heap;					\
+}
+
+#define RHEAP_INITIALIZER(_head)	{ { 0, 0, { NULL } } }
+
+static inline int
+_rheap_empty(struct _rheap *rh)
+{
+	return (rh->rh_pending == 0 && rh->rh_buckets[0] == NULL);
+}
+
+void	 _rheap_init(struct _rheap *);
+int	 _rheap_insert(const struct _rheap_type *, struct _rheap *, void *);
+void	 _rheap_remove(const struct _rheap_type *, struct _rheap *, void *);
+int	 _rheap_update(const struct _rheap_type *, struct _rheap *, void *);
+void	*_rheap_first(const struct _rheap_type *, struct _rheap *);
+void	*_rheap_extract(const struct _rheap_type *, struct _rheap *);
+void	*_rheap_cextract(const struct _rheap_type *, struct _rheap *,
+	     uint64_t);
+
+#define RHEAP_PROTOTYPE(_name, _type)					\
+extern const struct _rheap_type *const _name##_RHEAP_TYPE;		\
+									\
+static __unused inline void						\
+_name##_RHEAP_INIT(struct _name *head)					\
+{									\
+	_rheap_init(&head->heap);					\
+}									\
+									\
+static __unused inline int						\
+_name##_RHEAP_INSERT(struct _name *head, struct _type *elm)		\
+{									\
+	return _rheap_insert(_name##_RHEAP_TYPE, &head->heap, elm);	\
+}									\
+									\
+static __unused inline void						\
+_name##_RHEAP_REMOVE(struct _name *head, struct _type *elm)		\
+{									\
+	_rheap_remove(_name##_RHEAP_TYPE, &head->heap, elm);		\
+}									\
+									\
+static __unused inline int						\
+_name##_RHEAP_UPDATE(struct _name *head, struct _type *elm)		\
+{									\
+	return _rheap_update(_name##_RHEAP_TYPE, &head->heap, elm);	\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_RHEAP_FIRST(struct _name *head)					\
+{									\
+	return _rheap_first(_name##_RHEAP_TYPE, &head->heap);		\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_RHEAP_EXTRACT(struct _name *head)				\
+{									\
+	return _rheap_extract(_name##_RHEAP_TYPE, &head->heap);		\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_RHEAP_CEXTRACT(struct _name *head, uint64_t key)		\
+{									\
+	return _rheap_cextract(_name##_RHEAP_TYPE, &head->heap, key);	\
+}									\
+									\
+static __unused inline int						\
+_name##_RHEAP_EMPTY(struct _name *head)					\
+{									\
+	return _rheap_empty(&head->heap);				\
+}
+
+#define RHEAP_GENERATE(_name, _type, _field, _key)			\
+static uint64_t								\
+_name##_RHEAP_KEY(const void *ptr)					\
+{									\
+	const struct _type *p = ptr;					\
+	return _key(p);							\
+}									\
+									\
+static const struct _rheap_type _name##_RHEAP_INFO = {			\
+	_name##_RHEAP_KEY,						\
+	offsetof(struct _type, _field),					\
+};									\
+const struct _rheap_type *const _name##_RHEAP_TYPE = &_name##_RHEAP_INFO
+
+#define RHEAP_INIT(_name, _h)		_name##_RHEAP_INIT((_h))
+#define RHEAP_INSERT(_name, _h, _e)	_name##_RHEAP_INSERT((_h), (_e))
+#define RHEAP_REMOVE(_name, _h, _e)	_name##_RHEAP_REMOVE((_h), (_e))
+#define RHEAP_UPDATE(_name, _h, _e)	_name##_RHEAP_UPDATE((_h), (_e))
+#define RHEAP_FIRST(_name, _h)		_name##_RHEAP_FIRST((_h))
+#define RHEAP_EXTRACT(_name, _h)	_name##_RHEAP_EXTRACT((_h))
+#define RHEAP_CEXTRACT(_name, _h, _k)	_name##_RHEAP_CEXTRACT((_h), (_k))
+#define RHEAP_EMPTY(_name, _h)		_name##_RHEAP_EMPTY((_h))
+
+#endif /* _RHEAP_H_ */
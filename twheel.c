@@ -0,0 +1,277 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "twheel.h"
+
+/*
+ * the wheel keeps these invariants between operations:
+ *
+ * - an element in a slot on level l has a tick that matches tw_now
+ *   above level l, and is higher than tw_now in level l itself.
+ * - a slot is on the tw_pending bitmap for its level if it is not
+ *   empty.
+ * - an expired element has a tick at or below tw_now.
+ *
+ * so every element on a level expires before the elements on the
+ * levels above it, and the lowest pending slot on the lowest pending
+ * level holds the next elements to expire.
+ */
+
+#define TWHEEL_BITS		6
+#define TWHEEL_MASK		(TWHEEL_SLOTS - 1)
+
+static inline struct _twheel_entry *
+twheel_n2e(const struct _twheel_type *t, const void *node)
+{
+	unsigned long addr = (unsigned long)node;
+
+	return ((struct _twheel_entry *)(addr + t->t_offset));
+}
+
+static inline void *
+twheel_e2n(const struct _twheel_type *t, struct _twheel_entry *twe)
+{
+	unsigned long addr = (unsigned long)twe;
+
+	return ((void *)(addr - t->t_offset));
+}
+
+static inline uint64_t
+twheel_tick(const struct _twheel_type *t, const void *node)
+{
+	return ((*t->t_key)(node) >> t->t_shift);
+}
+
+/* the first tick covered by a slot on a level */
+static inline uint64_t
+twheel_slot_tick(uint64_t now, unsigned int level, unsigned int slot)
+{
+	unsigned int shift = level * TWHEEL_BITS;
+	uint64_t tick = 0;
+
+	if (level + 1 < TWHEEL_LEVELS)
+		tick = (now >> (shift + TWHEEL_BITS)) << (shift + TWHEEL_BITS);
+
+	return (tick | ((uint64_t)slot << shift));
+}
+
+static inline void
+twheel_list_insert(struct _twheel_entry **head, struct _twheel_entry *twe)
+{
+	struct _twheel_entry *next = *head;
+
+	twe->twe_link.twe_list.next = next;
+	if (next != NULL)
+		next->twe_link.twe_list.prev = &twe->twe_link.twe_list.next;
+	twe->twe_link.twe_list.prev = head;
+	*head = twe;
+}
+
+static inline void
+twheel_list_remove(struct _twheel_entry *twe)
+{
+	struct _twheel_entry *next = twe->twe_link.twe_list.next;
+
+	if (next != NULL)
+		next->twe_link.twe_list.prev = twe->twe_link.twe_list.prev;
+	*twe->twe_link.twe_list.prev = next;
+}
+
+static void
+twheel_place(const struct _twheel_type *t, struct _twheel *w, void *node)
+{
+	struct _twheel_entry *twe = twheel_n2e(t, node);
+	uint64_t tick = twheel_tick(t, node);
+	unsigned int level, slot;
+
+	if (tick <= w->tw_now) {
+		twe->twe_slot = TWHEEL_EXPIRED;
+		if (t->t_heap != NULL)
+			_heap_insert(t->t_heap, &w->tw_expired, node);
+		else
+			twheel_list_insert(&w->tw_slots[TWHEEL_EXPIRED], twe);
+		return;
+	}
+
+	level = (63 - __builtin_clzll(tick ^ w->tw_now)) / TWHEEL_BITS;
+	slot = (tick >> (level * TWHEEL_BITS)) & TWHEEL_MASK;
+
+	twe->twe_slot = level * TWHEEL_SLOTS + slot;
+	twheel_list_insert(&w->tw_slots[twe->twe_slot], twe);
+	w->tw_pending[level] |= 1ULL << slot;
+}
+
+static inline int
+twheel_expired(const struct _twheel_type *t, struct _twheel *w)
+{
+	if (t->t_heap != NULL)
+		return (!_heap_empty(&w->tw_expired));
+
+	return (w->tw_slots[TWHEEL_EXPIRED] != NULL);
+}
+
+/*
+ * moves tw_now forward to the next pending slot and cascades it, or
+ * to tick if that comes first.
+ */
+static void
+twheel_advance(const struct _twheel_type *t, struct _twheel *w,
+    uint64_t tick)
+{
+	struct _twheel_entry *twe, *next;
+	unsigned int level, slot;
+	uint64_t start;
+
+	for (level = 0; level < TWHEEL_LEVELS; level++) {
+		if (w->tw_pending[level] != 0)
+			break;
+	}
+	if (level == TWHEEL_LEVELS) {
+		w->tw_now = tick;
+		return;
+	}
+
+	slot = __builtin_ctzll(w->tw_pending[level]);
+	start = twheel_slot_tick(w->tw_now, level, slot);
+	if (start > tick) {
+		w->tw_now = tick;
+		return;
+	}
+
+	w->tw_now = start;
+
+	twe = w->tw_slots[level * TWHEEL_SLOTS + slot];
+	w->tw_slots[level * TWHEEL_SLOTS + slot] = NULL;
+	w->tw_pending[level] &= ~(1ULL << slot);
+
+	while (twe != NULL) {
+		next = twe->twe_link.twe_list.next;
+		twheel_place(t, w, twheel_e2n(t, twe));
+		twe = next;
+	}
+}
+
+void
+_twheel_init(const struct _twheel_type *t, struct _twheel *w, uint64_t now)
+{
+	unsigned int i;
+
+	w->tw_now = now >> t->t_shift;
+	for (i = 0; i < TWHEEL_LEVELS; i++)
+		w->tw_pending[i] = 0;
+	_heap_init(&w->tw_expired);
+	for (i = 0; i <= TWHEEL_EXPIRED; i++)
+		w->tw_slots[i] = NULL;
+}
+
+int
+_twheel_empty(const struct _twheel_type *t, struct _twheel *w)
+{
+	unsigned int i;
+
+	if (twheel_expired(t, w))
+		return (0);
+
+	for (i = 0; i < TWHEEL_LEVELS; i++) {
+		if (w->tw_pending[i] != 0)
+			return (0);
+	}
+
+	return (1);
+}
+
+void
+_twheel_insert(const struct _twheel_type *t, struct _twheel *w, void *node)
+{
+	twheel_place(t, w, node);
+}
+
+void
+_twheel_remove(const struct _twheel_type *t, struct _twheel *w, void *node)
+{
+	struct _twheel_entry *twe = twheel_n2e(t, node);
+	unsigned int slot = twe->twe_slot;
+
+	if (slot == TWHEEL_EXPIRED) {
+		if (t->t_heap != NULL)
+			_heap_remove(t->t_heap, &w->tw_expired, node);
+		else
+			twheel_list_remove(twe);
+		return;
+	}
+
+	twheel_list_remove(twe);
+	if (w->tw_slots[slot] == NULL) {
+		w->tw_pending[slot / TWHEEL_SLOTS] &=
+		    ~(1ULL << (slot % TWHEEL_SLOTS));
+	}
+}
+
+void *
+_twheel_cextract(const struct _twheel_type *t, struct _twheel *w,
+    uint64_t now)
+{
+	uint64_t tick = now >> t->t_shift;
+	struct _twheel_entry *twe;
+	void *node;
+
+	while (!twheel_expired(t, w)) {
+		if (w->tw_now >= tick)
+			return (NULL);
+
+		twheel_advance(t, w, tick);
+	}
+
+	if (t->t_heap != NULL) {
+		node = _heap_first(t->t_heap, &w->tw_expired);
+		if ((*t->t_key)(node) > now)
+			return (NULL);
+
+		_heap_remove(t->t_heap, &w->tw_expired, node);
+		return (node);
+	}
+
+	twe = w->tw_slots[TWHEEL_EXPIRED];
+	twheel_list_remove(twe);
+
+	return (twheel_e2n(t, twe));
+}
+
+uint64_t
+_twheel_next(const struct _twheel_type *t, struct _twheel *w)
+{
+	unsigned int level, slot;
+
+	if (t->t_heap != NULL && !_heap_empty(&w->tw_expired))
+		return ((*t->t_key)(_heap_first(t->t_heap, &w->tw_expired)));
+	if (w->tw_slots[TWHEEL_EXPIRED] != NULL)
+		return (w->tw_now << t->t_shift);
+
+	for (level = 0; level < TWHEEL_LEVELS; level++) {
+		if (w->tw_pending[level] != 0)
+			break;
+	}
+	if (level == TWHEEL_LEVELS)
+		return (UINT64_MAX);
+
+	slot = __builtin_ctzll(w->tw_pending[level]);
+
+	return (twheel_slot_tick(w->tw_now, level, slot) << t->t_shift);
+}
@@ -0,0 +1,179 @@
+/* */
+
+/*
+ * Copyright (c) 2017 David Gwynne <dlg@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TWHEEL_H_
+#define _TWHEEL_H_
+
+/*
+ * A hierarchical timing wheel for timeouts.
+ *
+ * Elements are keyed by an unsigned 64bit deadline, which is shifted
+ * down by the shift given to TWHEEL_GENERATE to get the tick it
+ * expires in. Each level of the wheel has 64 slots, and an element
+ * is put in the lowest level where its tick and the current tick of
+ * the wheel differ, so inserting and removing an element is a list
+ * operation. As time advances the slots are cascaded down a level,
+ * until elements reach the list of expired elements.
+ *
+ * Elements are returned in tick order, but elements that expire in
+ * the same tick are returned in any order. Wheels generated with
+ * TWHEEL_GENERATE_PRECISE keep the expired elements in a pairing heap
+ * instead, so they are returned in the order of their keys.
+ */
+
+#include <stdint.h>
+
+#include "heap.h"
+
+#define TWHEEL_SLOTS		64
+#define TWHEEL_LEVELS		11	/* 64 bits in 6 bit levels */
+#define TWHEEL_EXPIRED		(TWHEEL_LEVELS * TWHEEL_SLOTS)
+
+struct _twheel_type {
+	uint64_t		(*t_key)(const void *);
+	const struct _heap_type	 *t_heap;	/* or NULL */
+	unsigned int		  t_offset; /* offset of twheel_entry in type */
+	unsigned int		  t_shift;
+};
+
+struct _twheel_entry {
+	union {
+		struct {
+			struct _twheel_entry	 *next;
+			struct _twheel_entry	**prev;
+		}			  twe_list;
+		struct _heap_entry	  twe_heap;	/* if precise */
+	}			  twe_link;
+	unsigned int		  twe_slot;
+};
+#define TWHEEL_ENTRY(_entry)	struct _twheel_entry
+
+struct _twheel {
+	uint64_t		  tw_now;	/* in ticks */
+	uint64_t		  tw_pending[TWHEEL_LEVELS];
+	struct _heap		  tw_expired;
+	struct _twheel_entry	 *tw_slots[TWHEEL_EXPIRED + 1];
+};
+
+#define TWHEEL_HEAD(_name)						\
+struct _name {								\
+	struct _twheel		wheel;					\
+}
+
+void	 _twheel_init(const struct _twheel_type *, struct _twheel *,
+	     uint64_t);
+int	 _twheel_empty(const struct _twheel_type *, struct _twheel *);
+void	 _twheel_insert(const struct _twheel_type *, struct _twheel *,
+	     void *);
+void	 _twheel_remove(const struct _twheel_type *, struct _twheel *,
+	     void *);
+void	*_twheel_cextract(const struct _twheel_type *, struct _twheel *,
+	     uint64_t);
+uint64_t _twheel_next(const struct _twheel_type *, struct _twheel *);
+
+#define TWHEEL_PROTOTYPE(_name, _type)					\
+extern const struct _twheel_type *const _name##_TWHEEL_TYPE;		\
+									\
+static __unused inline void						\
+_name##_TWHEEL_INIT(struct _name *head, uint64_t now)			\
+{									\
+	_twheel_init(_name##_TWHEEL_TYPE, &head->wheel, now);		\
+}									\
+									\
+static __unused inline int						\
+_name##_TWHEEL_EMPTY(struct _name *head)				\
+{									\
+	return _twheel_empty(_name##_TWHEEL_TYPE, &head->wheel);	\
+}									\
+									\
+static __unused inline void						\
+_name##_TWHEEL_INSERT(struct _name *head, struct _type *elm)		\
+{									\
+	_twheel_insert(_name##_TWHEEL_TYPE, &head->wheel, elm);		\
+}									\
+									\
+static __unused inline void						\
+_name##_TWHEEL_REMOVE(struct _name *head, struct _type *elm)		\
+{									\
+	_twheel_remove(_name##_TWHEEL_TYPE, &head->wheel, elm);		\
+}									\
+									\
+static __unused inline struct _type *					\
+_name##_TWHEEL_CEXTRACT(struct _name *head, uint64_t now)		\
+{									\
+	return _twheel_cextract(_name##_TWHEEL_TYPE, &head->wheel,	\
+	    now);							\
+}									\
+									\
+static __unused inline uint64_t						\
+_name##_TWHEEL_NEXT(struct _name *head)					\
+{									\
+	return _twheel_next(_name##_TWHEEL_TYPE, &head->wheel);		\
+}
+
+#define TWHEEL_GENERATE_INTERNAL(_name, _type, _field, _key, _hp, _sh)	\
+static const struct _twheel_type _name##_TWHEEL_INFO = {		\
+	_key,								\
+	_hp,								\
+	offsetof(struct _type, _field),					\
+	_sh,								\
+};									\
+const struct _twheel_type *const _name##_TWHEEL_TYPE = &_name##_TWHEEL_INFO
+
+#define TWHEEL_GENERATE(_name, _type, _field, _key, _shift)		\
+static uint64_t								\
+_name##_TWHEEL_KEY(const void *ptr)					\
+{									\
+	const struct _type *p = ptr;					\
+	return _key(p);							\
+}									\
+TWHEEL_GENERATE_INTERNAL(_name, _type, _field,				\
+    _name##_TWHEEL_KEY, NULL, _shift)
+
+#define TWHEEL_GENERATE_PRECISE(_name, _type, _field, _key, _shift)	\
+static uint64_t								\
+_name##_TWHEEL_KEY(const void *ptr)					\
+{									\
+	const struct _type *p = ptr;					\
+	return _key(p);							\
+}									\
+									\
+static int								\
+_name##_TWHEEL_COMPARE(const void *lptr, const void *rptr)		\
+{									\
+	uint64_t l = _name##_TWHEEL_KEY(lptr);				\
+	uint64_t r = _name##_TWHEEL_KEY(rptr);				\
+	return (l < r ? -1 : l > r);					\
+}									\
+									\
+static const struct _heap_type _name##_TWHEEL_HEAP = {			\
+	_name##_TWHEEL_COMPARE,						\
+	offsetof(struct _type, _field.twe_link.twe_heap),		\
+	0,								\
+};									\
+TWHEEL_GENERATE_INTERNAL(_name, _type, _field,				\
+    _name##_TWHEEL_KEY, &_name##_TWHEEL_HEAP, _shift)
+
+#define TWHEEL_INIT(_name, _w, _now)	_name##_TWHEEL_INIT((_w), (_now))
+#define TWHEEL_EMPTY(_name, _w)		_name##_TWHEEL_EMPTY((_w))
+#define TWHEEL_INSERT(_name, _w, _e)	_name##_TWHEEL_INSERT((_w), (_e))
+#define TWHEEL_REMOVE(_name, _w, _e)	_name##_TWHEEL_REMOVE((_w), (_e))
+#define TWHEEL_CEXTRACT(_name, _w, _now) _name##_TWHEEL_CEXTRACT((_w), (_now))
+#define TWHEEL_NEXT(_name, _w)		_name##_TWHEEL_NEXT((_w))
+
+#endif /* _TWHEEL_H_ */